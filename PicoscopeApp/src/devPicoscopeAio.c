@@ -33,12 +33,19 @@
 #include <alarm.h>
 #include <epicsExport.h>
 #include <errlog.h>
+#include <epicsAtomic.h>
 #include <sys/time.h>
 
 #include <aiRecord.h>
 #include <aoRecord.h>
 
+#include "PicoStatus.h"
+
 #include "devPicoscopeCommon.h"
+#include "drvPicoscopeRecorder.h"
+#include "drvPicoscopePostMortem.h"
+#include "drvPicoscopeDataServer.h"
+#include "picoscopeShm.h"
 
 enum ioType
     {
@@ -72,7 +79,53 @@ enum ioType
     GET_AUTO_TRIGGER_US,
     GET_TRIGGER_FREQUENCY, 
     GET_TRIGGERS_MISSED,
-    GET_NUM_SUBWAVEFORMS
+    GET_NUM_SUBWAVEFORMS,
+    SET_NUM_SEGMENTS,
+    GET_NUM_SEGMENTS,
+    GET_POLL_INTERVAL,
+    GET_POLL_EFFICIENCY,
+    GET_BUFFER_POOL_ALLOCATED,
+    GET_BUFFER_POOL_PEAK,
+    GET_QUEUE_DEPTH,
+    GET_QUEUE_OVERRUNS,
+    GET_SDK_DATA_WAIT,
+    GET_SDK_DATA_SERVICE,
+    GET_SDK_CAPTURE_WAIT,
+    GET_SDK_CAPTURE_SERVICE,
+    GET_SDK_CONFIG_WAIT,
+    GET_SDK_CONFIG_SERVICE,
+    GET_SDK_HEALTH_WAIT,
+    GET_SDK_HEALTH_SERVICE,
+    GET_DEVICE_CACHE_HITS,
+    GET_DEVICE_CACHE_MISSES,
+    SET_RESTART_WINDOW,
+    GET_RESTARTS_REQUESTED,
+    GET_RESTARTS_EXECUTED,
+    GET_CONFIG_VERSION,
+    GET_WAVEFORM_CONFIG_VERSION,
+    GET_START_LATENCY,
+    GET_STOP_LATENCY,
+    GET_MAX_STOP_LATENCY,
+    GET_STOP_LATENCY_BOUND,
+    GET_AUTO_TRIGGERED_FRAMES,
+    GET_CAPTURE_TIMEOUTS,
+    GET_WRITER_LAST_WRITE,
+    GET_WRITER_MAX_WRITE,
+    GET_WRITER_SYNCHRONOUS,
+    GET_RECORDER_RATE,
+    GET_RECORDER_QUEUE_DEPTH,
+    GET_RECORDER_DROPPED,
+    SET_POST_MORTEM_FRAMES,
+    GET_POST_MORTEM_FRAMES,
+    SET_POST_MORTEM_POST_FRAMES,
+    GET_POST_MORTEM_POST_FRAMES,
+    GET_POST_MORTEM_FILL,
+    GET_POST_MORTEM_DUMP_TIME,
+    GET_DATA_SERVER_SUBSCRIBERS,
+    GET_DATA_SERVER_RATE,
+    GET_DATA_SERVER_DROPPED,
+    GET_SHM_RING_FRAMES,
+    GET_SHM_RING_DROPPED
 };
 
 enum ioFlag
@@ -118,7 +171,53 @@ static struct aioType
         {"get_auto_trigger_us", isInput, GET_AUTO_TRIGGER_US, ""},
         {"get_trigger_frequency", isInput, GET_TRIGGER_FREQUENCY, ""},
         {"get_triggers_missed", isInput, GET_TRIGGERS_MISSED, ""},
-        {"get_num_subwaveforms", isInput, GET_NUM_SUBWAVEFORMS, ""}
+        {"get_num_subwaveforms", isInput, GET_NUM_SUBWAVEFORMS, ""},
+        {"set_num_segments", isOutput, SET_NUM_SEGMENTS, ""},
+        {"get_num_segments", isInput, GET_NUM_SEGMENTS, ""},
+        {"get_poll_interval", isInput, GET_POLL_INTERVAL, ""},
+        {"get_poll_efficiency", isInput, GET_POLL_EFFICIENCY, ""},
+        {"get_buffer_pool_allocated", isInput, GET_BUFFER_POOL_ALLOCATED, ""},
+        {"get_buffer_pool_peak", isInput, GET_BUFFER_POOL_PEAK, ""},
+        {"get_queue_depth", isInput, GET_QUEUE_DEPTH, ""},
+        {"get_queue_overruns", isInput, GET_QUEUE_OVERRUNS, ""},
+        {"get_sdk_data_wait", isInput, GET_SDK_DATA_WAIT, ""},
+        {"get_sdk_data_service", isInput, GET_SDK_DATA_SERVICE, ""},
+        {"get_sdk_capture_wait", isInput, GET_SDK_CAPTURE_WAIT, ""},
+        {"get_sdk_capture_service", isInput, GET_SDK_CAPTURE_SERVICE, ""},
+        {"get_sdk_config_wait", isInput, GET_SDK_CONFIG_WAIT, ""},
+        {"get_sdk_config_service", isInput, GET_SDK_CONFIG_SERVICE, ""},
+        {"get_sdk_health_wait", isInput, GET_SDK_HEALTH_WAIT, ""},
+        {"get_sdk_health_service", isInput, GET_SDK_HEALTH_SERVICE, ""},
+        {"get_device_cache_hits", isInput, GET_DEVICE_CACHE_HITS, ""},
+        {"get_device_cache_misses", isInput, GET_DEVICE_CACHE_MISSES, ""},
+        {"set_restart_window", isOutput, SET_RESTART_WINDOW, ""},
+        {"get_restarts_requested", isInput, GET_RESTARTS_REQUESTED, ""},
+        {"get_restarts_executed", isInput, GET_RESTARTS_EXECUTED, ""},
+        {"get_config_version", isInput, GET_CONFIG_VERSION, ""},
+        {"get_waveform_config_version", isInput, GET_WAVEFORM_CONFIG_VERSION, ""},
+        {"get_start_latency", isInput, GET_START_LATENCY, ""},
+        {"get_stop_latency", isInput, GET_STOP_LATENCY, ""},
+        {"get_max_stop_latency", isInput, GET_MAX_STOP_LATENCY, ""},
+        {"get_stop_latency_bound", isInput, GET_STOP_LATENCY_BOUND, ""},
+        {"get_auto_triggered_frames", isInput, GET_AUTO_TRIGGERED_FRAMES, ""},
+        {"get_capture_timeouts", isInput, GET_CAPTURE_TIMEOUTS, ""},
+        {"get_writer_last_write", isInput, GET_WRITER_LAST_WRITE, ""},
+        {"get_writer_max_write", isInput, GET_WRITER_MAX_WRITE, ""},
+        {"get_writer_synchronous", isInput, GET_WRITER_SYNCHRONOUS, ""},
+        {"get_recorder_rate", isInput, GET_RECORDER_RATE, ""},
+        {"get_recorder_queue_depth", isInput, GET_RECORDER_QUEUE_DEPTH, ""},
+        {"get_recorder_dropped", isInput, GET_RECORDER_DROPPED, ""},
+        {"set_post_mortem_frames", isOutput, SET_POST_MORTEM_FRAMES, ""},
+        {"get_post_mortem_frames", isInput, GET_POST_MORTEM_FRAMES, ""},
+        {"set_post_mortem_post_frames", isOutput, SET_POST_MORTEM_POST_FRAMES, ""},
+        {"get_post_mortem_post_frames", isInput, GET_POST_MORTEM_POST_FRAMES, ""},
+        {"get_post_mortem_fill", isInput, GET_POST_MORTEM_FILL, ""},
+        {"get_post_mortem_dump_time", isInput, GET_POST_MORTEM_DUMP_TIME, ""},
+        {"get_data_server_subscribers", isInput, GET_DATA_SERVER_SUBSCRIBERS, ""},
+        {"get_data_server_rate", isInput, GET_DATA_SERVER_RATE, ""},
+        {"get_data_server_dropped", isInput, GET_DATA_SERVER_DROPPED, ""},
+        {"get_shm_ring_frames", isInput, GET_SHM_RING_FRAMES, ""},
+        {"get_shm_ring_dropped", isInput, GET_SHM_RING_DROPPED, ""}
 
     };
 
@@ -132,6 +231,15 @@ struct PicoscopeAioData
         char paramLabel[32];
         int paramValid;
         struct PS6000AModule* mp;
+        struct AsyncWrite async;    // Output records only 
+        double write_val;           // VAL when the write was queued, the writer thread reads no record fields 
+        int write_failed;           // Alarm raised when the write completes 
+        // Record fields a write changed, set on the record when it completes 
+        double val;
+        double drvh;
+        double drvl;
+        int update_val;
+        int update_limits;
     };
 
 static enum ioType findAioType(enum ioFlag ioFlag, char *param, char **cmdString)
@@ -155,6 +263,7 @@ static enum ioType findAioType(enum ioFlag ioFlag, char *param, char **cmdString
 typedef long (*DEVSUPFUN_AI)(struct aiRecord *);
 
 static long init_record_ai (struct aiRecord *pai);
+static long get_ioint_info_ai (int cmd, struct aiRecord *pai, IOSCANPVT *ppvt);
 static long read_ai (struct aiRecord *pai);
 
 struct
@@ -171,7 +280,7 @@ struct
         NULL,
         NULL,
         init_record_ai,
-        NULL,
+        (DEVSUPFUN_AI) get_ioint_info_ai,
         read_ai,
     };
 
@@ -247,6 +356,38 @@ static long init_record_ai (struct aiRecord *pai)
 }
 
 
+/**
+ * Provides the scan list for ai records with SCAN set to I/O Intr. The trigger timing records are 
+ * scanned by the acquisition thread after every capture. 
+ */
+static long get_ioint_info_ai (int cmd, struct aiRecord *pai, IOSCANPVT *ppvt){
+    struct PicoscopeAioData *vdp = (struct PicoscopeAioData *)pai->dpvt;
+
+    if (!vdp || !vdp->mp) {
+        return -1;
+    }
+    switch (vdp->ioType) {
+        case GET_TRIGGER_FREQUENCY:
+        case GET_TRIGGERS_MISSED:
+        case GET_AUTO_TRIGGERED_FRAMES:
+        case GET_CAPTURE_TIMEOUTS:
+            *ppvt = vdp->mp->trigger_timing_scan;
+            break;
+
+        case GET_ACQUISITION_STATUS:
+        case GET_START_LATENCY:
+        case GET_STOP_LATENCY:
+        case GET_MAX_STOP_LATENCY:
+            *ppvt = vdp->mp->acquisition->state_scan;
+            break;
+
+        default:
+            errlogPrintf("%s: I/O Intr not supported for %s\n", pai->name, vdp->paramLabel);
+            return -1;
+    }
+    return 0;
+}
+
 static long read_ai (struct aiRecord *pai){
         
     char* record_name; 
@@ -296,7 +437,7 @@ static long read_ai (struct aiRecord *pai){
             break; 
         
         case GET_ACQUISITION_STATUS:
-            pai->val = (float)*vdp->mp->dataAcquisitionFlag;
+            pai->val = (float)acquisition_active(vdp->mp);
             break;
 
         case GET_TRIGGER_UPPER:
@@ -320,18 +461,223 @@ static long read_ai (struct aiRecord *pai){
             break; 
 
         case GET_TRIGGER_FREQUENCY: 
-            pai->val = vdp->mp->trigger_timing_info.trigger_freq_secs;  
+            pai->val = vdp->mp->trigger_timing_info->trigger_freq_secs;  
             break;
 
         case GET_TRIGGERS_MISSED: 
-            if (vdp->mp->trigger_timing_info.missed_triggers == 0){ 
-                pai->val = vdp->mp->trigger_timing_info.missed_triggers;
+            if (vdp->mp->trigger_timing_info->missed_triggers == 0){ 
+                pai->val = vdp->mp->trigger_timing_info->missed_triggers;
                 break;
             }
-            pai->val = vdp->mp->trigger_timing_info.missed_triggers - 1; // subtract trigger that was detected 
+            pai->val = vdp->mp->trigger_timing_info->missed_triggers - 1; // subtract trigger that was detected 
             break; 
         case GET_NUM_SUBWAVEFORMS:
             pai->val = vdp->mp->subwaveform_num;
+            break;
+
+        case GET_NUM_SEGMENTS: 
+            pai->val = vdp->mp->sample_config.num_segments; 
+            break; 
+
+        case GET_POLL_INTERVAL: 
+            pai->val = vdp->mp->stream_poll_stats->poll_interval_secs; 
+            break; 
+
+        case GET_POLL_EFFICIENCY: 
+            if (vdp->mp->stream_poll_stats->polls == 0) {
+                pai->val = 0; 
+                break; 
+            }
+            pai->val = 100.0 * vdp->mp->stream_poll_stats->useful_polls / vdp->mp->stream_poll_stats->polls; 
+            break; 
+
+        case GET_BUFFER_POOL_ALLOCATED: 
+            pai->val = vdp->mp->buffer_pool->allocated_bytes; 
+            break; 
+
+        case GET_BUFFER_POOL_PEAK: 
+            pai->val = vdp->mp->buffer_pool->peak_bytes; 
+            break; 
+
+        case GET_QUEUE_DEPTH: 
+            channel_index = find_channel_index_from_record(pai->name, vdp->mp->channel_configs); 
+            if (channel_index < 0 || !vdp->mp->frame_queue[channel_index]) {
+                pai->val = 0; 
+                break; 
+            }
+            pai->val = epicsRingPointerGetUsed(vdp->mp->frame_queue[channel_index]->ready); 
+            break; 
+
+        case GET_QUEUE_OVERRUNS: 
+            channel_index = find_channel_index_from_record(pai->name, vdp->mp->channel_configs); 
+            if (channel_index < 0 || !vdp->mp->frame_queue[channel_index]) {
+                pai->val = 0; 
+                break; 
+            }
+            pai->val = vdp->mp->frame_queue[channel_index]->overruns; 
+            break; 
+
+        case GET_SDK_DATA_WAIT: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_DATA].wait_ms; 
+            break; 
+
+        case GET_SDK_DATA_SERVICE: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_DATA].service_ms; 
+            break; 
+
+        case GET_SDK_CAPTURE_WAIT: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_CAPTURE].wait_ms; 
+            break; 
+
+        case GET_SDK_CAPTURE_SERVICE: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_CAPTURE].service_ms; 
+            break; 
+
+        case GET_SDK_CONFIG_WAIT: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_CONFIG].wait_ms; 
+            break; 
+
+        case GET_SDK_CONFIG_SERVICE: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_CONFIG].service_ms; 
+            break; 
+
+        case GET_SDK_HEALTH_WAIT: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_HEALTH].wait_ms; 
+            break; 
+
+        case GET_SDK_HEALTH_SERVICE: 
+            pai->val = vdp->mp->sdk_queue->stats[SDK_CMD_HEALTH].service_ms; 
+            break; 
+
+        case GET_DEVICE_CACHE_HITS: 
+            pai->val = vdp->mp->device_cache->hits; 
+            break; 
+
+        case GET_DEVICE_CACHE_MISSES: 
+            pai->val = vdp->mp->device_cache->misses; 
+            break; 
+
+        case GET_RESTARTS_REQUESTED: 
+            pai->val = vdp->mp->restart_coalescer->requested; 
+            break; 
+
+        case GET_RESTARTS_EXECUTED: 
+            pai->val = vdp->mp->restart_coalescer->executed; 
+            break; 
+
+        case GET_CONFIG_VERSION: 
+            epicsMutexLock(vdp->mp->config_store->lock);
+            pai->val = vdp->mp->config_store->latest.version; 
+            epicsMutexUnlock(vdp->mp->config_store->lock);
+            break; 
+
+        case GET_WAVEFORM_CONFIG_VERSION: 
+            channel_index = find_channel_index_from_record(pai->name, vdp->mp->channel_configs); 
+            if (channel_index < 0) {
+                pai->val = 0; 
+                break; 
+            }
+            pai->val = vdp->mp->waveform_config_version[channel_index]; 
+            break; 
+
+        case GET_START_LATENCY: 
+            epicsMutexLock(vdp->mp->acquisition->lock);
+            pai->val = vdp->mp->acquisition->last_start_latency * 1e3; 
+            epicsMutexUnlock(vdp->mp->acquisition->lock);
+            break; 
+
+        case GET_STOP_LATENCY: 
+            epicsMutexLock(vdp->mp->acquisition->lock);
+            pai->val = vdp->mp->acquisition->last_stop_latency * 1e3; 
+            epicsMutexUnlock(vdp->mp->acquisition->lock);
+            break; 
+
+        case GET_MAX_STOP_LATENCY: 
+            epicsMutexLock(vdp->mp->acquisition->lock);
+            pai->val = vdp->mp->acquisition->max_stop_latency * 1e3; 
+            epicsMutexUnlock(vdp->mp->acquisition->lock);
+            break; 
+
+        case GET_STOP_LATENCY_BOUND: 
+            pai->val = stop_latency_bound(vdp->mp) * 1e3; 
+            break; 
+
+        case GET_AUTO_TRIGGERED_FRAMES: 
+            pai->val = vdp->mp->trigger_timing_info->auto_triggered_frames; 
+            break; 
+
+        case GET_CAPTURE_TIMEOUTS: 
+            pai->val = vdp->mp->trigger_timing_info->capture_timeouts; 
+            break; 
+
+        case GET_WRITER_LAST_WRITE: 
+            pai->val = vdp->mp->async_writer->last_write_secs * 1e3; 
+            break; 
+
+        case GET_WRITER_MAX_WRITE: 
+            pai->val = vdp->mp->async_writer->max_write_secs * 1e3; 
+            break; 
+
+        case GET_WRITER_SYNCHRONOUS: 
+            pai->val = vdp->mp->async_writer->synchronous; 
+            break; 
+
+        case GET_RECORDER_RATE: 
+            pai->val = vdp->mp->recorder->rate_mbps; 
+            break; 
+
+        case GET_RECORDER_QUEUE_DEPTH: 
+            pai->val = recorder_queue_depth(vdp->mp->recorder); 
+            break; 
+
+        case GET_RECORDER_DROPPED: 
+            pai->val = epicsAtomicGetSizeT(&vdp->mp->recorder->dropped); 
+            break; 
+
+        case GET_POST_MORTEM_FRAMES: 
+            pai->val = vdp->mp->sample_config.post_mortem_frames; 
+            break; 
+
+        case GET_POST_MORTEM_POST_FRAMES: 
+            pai->val = vdp->mp->post_mortem->post_frames; 
+            break; 
+
+        case GET_POST_MORTEM_FILL: 
+            pai->val = post_mortem_fill(vdp->mp->post_mortem); 
+            break; 
+
+        case GET_POST_MORTEM_DUMP_TIME: 
+            pai->val = vdp->mp->post_mortem->dump_secs; 
+            break; 
+
+        // The data server is optional, its readbacks stay at 0 without one 
+        case GET_DATA_SERVER_SUBSCRIBERS: 
+            pai->val = vdp->mp->data_server ? epicsAtomicGetIntT(&vdp->mp->data_server->num_subscribers) : 0; 
+            break; 
+
+        case GET_DATA_SERVER_RATE: 
+            pai->val = vdp->mp->data_server ? vdp->mp->data_server->rate_mbps : 0; 
+            break; 
+
+        case GET_DATA_SERVER_DROPPED: 
+            pai->val = vdp->mp->data_server ? epicsAtomicGetSizeT(&vdp->mp->data_server->dropped) : 0; 
+            break; 
+
+        case GET_SHM_RING_FRAMES: 
+            pai->val = vdp->mp->shm_ring ? shm_ring_published(vdp->mp->shm_ring) : 0; 
+            break; 
+
+        case GET_SHM_RING_DROPPED: 
+            pai->val = vdp->mp->shm_ring ? shm_ring_dropped(vdp->mp->shm_ring) : 0; 
+            break; 
+
+        // Queued by update_status_pv 
+        case GET_STATUS_CODE: 
+            epicsMutexLock(vdp->mp->log_lock);
+            pai->val = vdp->mp->log_status_code; 
+            epicsMutexUnlock(vdp->mp->log_lock);
+            break; 
+
         default:
             return 2;
 
@@ -464,6 +810,22 @@ static long init_record_ao (struct aoRecord *pao)
             vdp->mp->trigger_config.autoTriggerMicroSeconds = (uint32_t) pao->val; 
             break; 
 
+        case SET_NUM_SEGMENTS: 
+            vdp->mp->sample_config.num_segments = pao->val < 1 ? 1 : (uint64_t) pao->val; 
+            break; 
+
+        case SET_RESTART_WINDOW: 
+            vdp->mp->restart_coalescer->window_secs = pao->val < 0 ? 0 : pao->val; 
+            break; 
+
+        case SET_POST_MORTEM_FRAMES: 
+            vdp->mp->sample_config.post_mortem_frames = pao->val < 0 ? 0 : (uint64_t) pao->val; 
+            break; 
+
+        case SET_POST_MORTEM_POST_FRAMES: 
+            vdp->mp->post_mortem->post_frames = pao->val < 0 ? 0 : (uint64_t) pao->val; 
+            break; 
+
         default:
             return 0;
     }
@@ -472,12 +834,13 @@ static long init_record_ao (struct aoRecord *pao)
 }
 
 
-static long write_ao (struct aoRecord *pao)
+static long write_ao_settings (struct aoRecord *pao)
 {    
     uint32_t timebase = 0; 
     double sample_interval, sample_rate = 0; 
     int16_t channel_status = 0;
     int returnState = 0;
+    int trigger_only = 0;   // Applied between block captures, streaming restarts 
     
     char* record_name; 
     int channel_index; 
@@ -487,11 +850,12 @@ static long write_ao (struct aoRecord *pao)
     struct PicoscopeAioData *vdp;
     vdp = (struct PicoscopeAioData *)pao->dpvt;
     uint64_t previous_num_samples;
+    vdp->update_val = vdp->update_limits = 0;
     switch (vdp->ioType)
     {
         case SET_NUM_DIVISIONS: 
             int16_t previous_num_divisions = vdp->mp->sample_config.timebase_configs.num_divisions; 
-            vdp->mp->sample_config.timebase_configs.num_divisions = (int) pao->val; 
+            vdp->mp->sample_config.timebase_configs.num_divisions = (int) vdp->write_val; 
 
             result = get_valid_timebase_configs(
                 vdp->mp,
@@ -501,7 +865,7 @@ static long write_ao (struct aoRecord *pao)
             );
 
             if (result != 0) {
-                snprintf(log_message, sizeof(log_message), "Error setting the number of divisions to %d", (int)pao->val);
+                snprintf(log_message, sizeof(log_message), "Error setting the number of divisions to %d", (int)vdp->write_val);
                 vdp->mp->sample_config.timebase_configs.num_divisions = previous_num_divisions; 
             } 
 
@@ -514,8 +878,8 @@ static long write_ao (struct aoRecord *pao)
         case SET_NUM_SAMPLES:
 
             previous_num_samples = vdp->mp->sample_config.num_samples; 
-            vdp->mp->sample_config.num_samples = (int) pao->val; 
-            vdp->mp->sample_config.unadjust_num_samples = (int) pao->val; 
+            vdp->mp->sample_config.num_samples = (int) vdp->write_val; 
+            vdp->mp->sample_config.unadjust_num_samples = (int) vdp->write_val; 
             result = get_valid_timebase_configs(
                 vdp->mp,
                 &sample_interval, 
@@ -524,10 +888,10 @@ static long write_ao (struct aoRecord *pao)
             ); 
 
             if (result != 0) {
-                snprintf(log_message, sizeof(log_message), "Error setting the number of samples to %d", (int) pao->val); 
+                snprintf(log_message, sizeof(log_message), "Error setting the number of samples to %d", (int) vdp->write_val); 
                 update_log_pvs(vdp->mp, log_message, result);
                 vdp->mp->sample_config.num_samples = previous_num_samples;
-                vdp->mp->sample_config.unadjust_num_samples = (int) pao->val; 
+                vdp->mp->sample_config.unadjust_num_samples = (int) vdp->write_val; 
                 break;
             } 
 
@@ -549,7 +913,7 @@ static long write_ao (struct aoRecord *pao)
             break;  
 
         case SET_TRIGGER_PULSE_WIDTH:
-            vdp->mp->trigger_config.AUXTriggerSignalPulseWidth = (double)pao->val;
+            vdp->mp->trigger_config.AUXTriggerSignalPulseWidth = (double)vdp->write_val;
             result = get_valid_timebase_configs(
                 vdp->mp,
                 &sample_interval, 
@@ -557,8 +921,8 @@ static long write_ao (struct aoRecord *pao)
                 &sample_rate
             );
             if (result != 0) {
-                snprintf(log_message, sizeof(log_message), "Error setting the width of trigger signal to %d.", (int) pao->val); 
-                vdp->mp->sample_config.unadjust_num_samples = (int) pao->val; 
+                snprintf(log_message, sizeof(log_message), "Error setting the width of trigger signal to %d.", (int) vdp->write_val); 
+                vdp->mp->sample_config.unadjust_num_samples = (int) vdp->write_val; 
             } else {
                 vdp->mp->sample_config.timebase_configs.sample_interval_secs = sample_interval;
                 vdp->mp->sample_config.timebase_configs.timebase = timebase;
@@ -568,11 +932,11 @@ static long write_ao (struct aoRecord *pao)
             break;
 
         case SET_DOWN_SAMPLE_RATIO: 
-            vdp->mp->sample_config.down_sample_ratio = (int)pao->val; 
+            vdp->mp->sample_config.down_sample_ratio = (int)vdp->write_val; 
             break; 
         
         case SET_TRIGGER_POSITION_RATIO:
-            vdp->mp->sample_config.trigger_position_ratio = (float)pao->val;
+            vdp->mp->sample_config.trigger_position_ratio = (float)vdp->write_val;
             break;  
         
         case SET_ANALOG_OFFSET: 
@@ -590,19 +954,20 @@ static long write_ao (struct aoRecord *pao)
                 &min_analog_offset
             );
             if (result != 0) {
-                snprintf(log_message, sizeof(log_message), "Error setting analog offset limits to %d.", (int) pao->val); 
+                snprintf(log_message, sizeof(log_message), "Error setting analog offset limits to %d.", (int) vdp->write_val); 
             } else {
-                pao->drvh = max_analog_offset; 
-                pao->drvl = min_analog_offset;
+                vdp->drvh = max_analog_offset; 
+                vdp->drvl = min_analog_offset;
+                vdp->update_limits = 1;
 
-                if (pao->val > max_analog_offset) {
+                if (vdp->write_val > max_analog_offset) {
                     vdp->mp->channel_configs[channel_index].analog_offset = max_analog_offset;
                 }
-                else if (pao->val < min_analog_offset) { 
+                else if (vdp->write_val < min_analog_offset) { 
                     vdp->mp->channel_configs[channel_index].analog_offset = min_analog_offset;
                 }
                 else {
-                    vdp->mp->channel_configs[channel_index].analog_offset = pao->val; 
+                    vdp->mp->channel_configs[channel_index].analog_offset = vdp->write_val; 
                 }  
 
                 channel_status = get_channel_status(vdp->mp->channel_configs[channel_index].channel, vdp->mp->channel_status); 
@@ -614,7 +979,7 @@ static long write_ao (struct aoRecord *pao)
                     );               
                     // If channel is not succesfully set on, return to previous value 
                     if (result != 0) {
-                        snprintf(log_message, sizeof(log_message), "Error setting analog offset limits to %d.", (int) pao->val); 
+                        snprintf(log_message, sizeof(log_message), "Error setting analog offset limits to %d.", (int) vdp->write_val); 
                         vdp->mp->channel_configs[channel_index].analog_offset = previous_analog_offset;
                     }
                 }
@@ -623,94 +988,172 @@ static long write_ao (struct aoRecord *pao)
             break;
         
         case SET_TRIGGER_UPPER:
+            trigger_only = 1;
             if (vdp->mp->trigger_config.channel == TRIGGER_AUX || vdp->mp->trigger_config.triggerType == NO_TRIGGER) {
                 vdp->mp->trigger_config.thresholdUpper = 0;
                 vdp->mp->trigger_config.thresholdUpperVolts = 0; 
-                pao->val = 0; 
+                vdp->val = 0; 
+                vdp->update_val = 1;
                 break;
             }
             int16_t upper_scaled; 
             result = calculate_scaled_value(
                 vdp->mp, 
-                pao->val, 
+                vdp->write_val, 
                 vdp->mp->channel_configs[vdp->mp->trigger_config.channel].range, 
                 &upper_scaled
             );
             if (result != 0) { 
-                snprintf(log_message, sizeof(log_message), "Upper threshold of %d is outside of the trigger channel range.", (int) pao->val); 
-                vdp->mp->trigger_config.thresholdUpper = 0; 
-                vdp->mp->trigger_config.thresholdUpperVolts = 0; 
-                pao->val = 0; 
-            } else {
-                vdp->mp->trigger_config.thresholdUpperVolts = pao->val;
-                vdp->mp->trigger_config.thresholdUpper = upper_scaled;
+                // Refused, the trigger keeps its threshold and nothing is posted 
+                snprintf(log_message, sizeof(log_message), "Upper threshold of %d is outside of the trigger channel range.", (int) vdp->write_val); 
+                update_log_pvs(vdp->mp, log_message, result); 
+                vdp->val = vdp->mp->trigger_config.thresholdUpperVolts; 
+                vdp->update_val = 1;
+                return result;
             }
-            update_log_pvs(vdp->mp, log_message[0] ? log_message : NULL, result); 
+            vdp->mp->trigger_config.thresholdUpperVolts = vdp->write_val;
+            vdp->mp->trigger_config.thresholdUpper = upper_scaled;
+            update_log_pvs(vdp->mp, NULL, result); 
             break;
 
         case SET_TRIGGER_UPPER_HYSTERESIS: 
-            vdp->mp->trigger_config.thresholdUpperHysteresis = (uint16_t) pao->val; 
+            trigger_only = 1;
+            vdp->mp->trigger_config.thresholdUpperHysteresis = (uint16_t) vdp->write_val; 
             // if (vdp->mp->trigger_config.triggerType == NO_TRIGGER){
             //     vdp->mp->trigger_config.thresholdUpperHysteresis = 0; 
             // } 
             break;
 
         case SET_TRIGGER_LOWER:
+            trigger_only = 1;
             if (vdp->mp->trigger_config.channel == TRIGGER_AUX || vdp->mp->trigger_config.triggerType == NO_TRIGGER) {
                 vdp->mp->trigger_config.thresholdLower = 0; 
                 vdp->mp->trigger_config.thresholdLowerVolts = 0; 
-                pao->val = 0; 
+                vdp->val = 0; 
+                vdp->update_val = 1;
                 break;
             }
 
             int16_t lower_scaled; 
             result = calculate_scaled_value(
                 vdp->mp, 
-                pao->val, 
+                vdp->write_val, 
                 vdp->mp->channel_configs[vdp->mp->trigger_config.channel].range, 
                 &lower_scaled
             );
             if (result != 0){ 
-                snprintf(log_message, sizeof(log_message), "Lower threshold of %d is outside of the trigger channel range.", (int) pao->val); 
-                vdp->mp->trigger_config.thresholdLower = 0; 
-                vdp->mp->trigger_config.thresholdLowerVolts = 0; 
-                pao->val = 0; 
-            } else {
-                vdp->mp->trigger_config.thresholdLowerVolts = pao->val;            
-                vdp->mp->trigger_config.thresholdLower = lower_scaled;
+                // Refused, the trigger keeps its threshold and nothing is posted 
+                snprintf(log_message, sizeof(log_message), "Lower threshold of %d is outside of the trigger channel range.", (int) vdp->write_val); 
+                update_log_pvs(vdp->mp, log_message, result); 
+                vdp->val = vdp->mp->trigger_config.thresholdLowerVolts; 
+                vdp->update_val = 1;
+                return result;
             }
-            
-            update_log_pvs(vdp->mp, log_message[0] ? log_message : NULL, result); 
+            vdp->mp->trigger_config.thresholdLowerVolts = vdp->write_val;            
+            vdp->mp->trigger_config.thresholdLower = lower_scaled;
+            update_log_pvs(vdp->mp, NULL, result); 
             break;
 
         case SET_TRIGGER_LOWER_HYSTERESIS: 
-            vdp->mp->trigger_config.thresholdLowerHysteresis = (uint16_t) pao->val; 
+            trigger_only = 1;
+            vdp->mp->trigger_config.thresholdLowerHysteresis = (uint16_t) vdp->write_val; 
             if (vdp->mp->trigger_config.triggerType == NO_TRIGGER){
                 vdp->mp->trigger_config.thresholdLowerHysteresis = 0; 
             } 
             break;
 
         case SET_AUTO_TRIGGER_US: 
-            vdp->mp->trigger_config.autoTriggerMicroSeconds = (uint32_t) pao->val; 
+            trigger_only = 1;
+            vdp->mp->trigger_config.autoTriggerMicroSeconds = (uint32_t) vdp->write_val; 
             if (vdp->mp->trigger_config.triggerType == NO_TRIGGER){ 
                 vdp->mp->trigger_config.autoTriggerMicroSeconds = 0; 
             } 
             break; 
 
+        case SET_NUM_SEGMENTS: 
+            uint64_t num_segments = vdp->write_val < 1 ? 1 : (uint64_t) vdp->write_val; 
+            // Every segment must fit in the segment waveform and segment timestamps records 
+            if (num_segments > 1 && 
+                (num_segments > vdp->mp->segment_timestamps_size || 
+                 num_segments * vdp->mp->sample_config.num_samples > vdp->mp->segment_waveform_size)) {
+                snprintf(log_message, sizeof(log_message), "Error setting the number of segments to %d, segments do not fit in segment waveform.", (int) vdp->write_val); 
+                update_log_pvs(vdp->mp, log_message, PICO_TOO_MANY_SEGMENTS);
+                vdp->val = vdp->mp->sample_config.num_segments; 
+                vdp->update_val = 1;
+                break;
+            }
+            vdp->mp->sample_config.num_segments = num_segments; 
+            update_log_pvs(vdp->mp, NULL, PICO_OK);
+            break; 
+
+        case SET_RESTART_WINDOW: 
+            // Not a capture setting, applies to the next write without a restart 
+            vdp->mp->restart_coalescer->window_secs = vdp->write_val < 0 ? 0 : vdp->write_val; 
+            return 0; 
+
+        case SET_POST_MORTEM_FRAMES: 
+            // The ring is sized when the acquisition starts 
+            vdp->mp->sample_config.post_mortem_frames = vdp->write_val < 0 ? 0 : (uint64_t) vdp->write_val; 
+            break; 
+
+        case SET_POST_MORTEM_POST_FRAMES: 
+            // Read by the next freeze, no restart needed 
+            epicsMutexLock(vdp->mp->post_mortem->lock);
+            vdp->mp->post_mortem->post_frames = vdp->write_val < 0 ? 0 : (uint64_t) vdp->write_val; 
+            epicsMutexUnlock(vdp->mp->post_mortem->lock);
+            return 0; 
+
         default:
                 returnState = -1;
     }
 
     if (returnState < 0)
     {
+        vdp->write_failed = 1;
+        return 2;
+    }else if (trigger_only && !config_streams(vdp->mp)){
+        post_trigger_config(vdp->mp);
+    }else{
+        re_acquire_waveform(vdp->mp);
+    }
+    return 0;
+}
+
+// Completion of an ao write, on the callback thread with the record's lock held 
+static void complete_ao(struct aoRecord *pao)
+{
+    struct PicoscopeAioData *vdp = (struct PicoscopeAioData *)pao->dpvt;
+
+    if (vdp->write_failed) {
         if (recGblSetSevr(pao, READ_ALARM, INVALID_ALARM)  &&  errVerbose
             &&  (pao->stat != READ_ALARM  ||  pao->sevr != INVALID_ALARM))
             {
                 errlogPrintf("%s: Read Error\n", pao->name);
             }
-        return 2;
-    }else{
-        re_acquire_waveform(vdp->mp);
     }
-    return 0;
-}
\ No newline at end of file
+    if (vdp->update_limits) {
+        pao->drvh = vdp->drvh; 
+        pao->drvl = vdp->drvl;
+    }
+    if (vdp->update_val) {
+        pao->val = vdp->val;
+    }
+}
+
+/**
+ * Hands the write to the module's writer thread, which runs write_ao_settings with the 
+ * configuration store write lock held. The record completes once the SDK calls are done, 
+ * without holding its lock set while they run. 
+ */
+static long write_ao (struct aoRecord *pao)
+{
+    struct PicoscopeAioData *vdp = (struct PicoscopeAioData *)pao->dpvt;
+
+    if (!pao->pact) {
+        vdp->write_val = pao->val;
+        vdp->write_failed = 0;
+    }
+    vdp->async.complete = (void (*)(struct dbCommon *))complete_ao;
+    return write_async(vdp->mp, (struct dbCommon *)pao, &vdp->async, 
+                       (long (*)(struct dbCommon *))write_ao_settings);
+}
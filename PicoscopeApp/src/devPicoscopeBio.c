@@ -36,7 +36,10 @@
 #include <biRecord.h>
 #include <boRecord.h>
 
+#include "PicoStatus.h"
+
 #include "devPicoscopeCommon.h"
+#include "drvPicoscopePostMortem.h"
 
 
 enum ioType
@@ -46,6 +49,11 @@ enum ioType
     GET_DEVICE_STATUS,
     SET_CHANNEL_ON,
     GET_CHANNEL_STATUS,
+    SET_DOUBLE_BUFFER,
+    GET_DOUBLE_BUFFER,
+    SET_RECORDER_ENABLE,
+    GET_RECORDER_ENABLE,
+    SET_POST_MORTEM_FREEZE,
 };
 
 enum ioFlag
@@ -67,6 +75,11 @@ struct bioType
     {"get_device_status",  isInput,    GET_DEVICE_STATUS,   1,    0 },
     {"set_channel_on",     isOutput,   SET_CHANNEL_ON,      1,    0 },
     {"get_channel_status", isInput,    GET_CHANNEL_STATUS,  1,    0 },
+    {"set_double_buffer",  isOutput,   SET_DOUBLE_BUFFER,   1,    0 },
+    {"get_double_buffer",  isInput,    GET_DOUBLE_BUFFER,   1,    0 },
+    {"set_recorder_enable", isOutput,  SET_RECORDER_ENABLE, 1,    0 },
+    {"get_recorder_enable", isInput,   GET_RECORDER_ENABLE, 1,    0 },
+    {"set_post_mortem_freeze", isOutput, SET_POST_MORTEM_FREEZE, 1, 0 },
 
 };
 
@@ -82,6 +95,13 @@ struct PicoscopeBioData
         int onCmd;
 	    int offCmd;
         struct PS6000AModule* mp;
+        struct AsyncWrite async;    // Output records only 
+        int write_val;              // VAL when the write was queued, the writer thread reads no record fields 
+        int write_failed;           // Alarm raised when the write completes 
+        // Record fields a write changed, set on the record when it completes 
+        int rbv;
+        int update_rbv;
+        int reset_val;
     };
 
 static enum ioType findBioType(enum ioFlag ioFlag, char *param,  int *onCmd, int *offCmd)
@@ -192,6 +212,17 @@ init_record_bo (struct boRecord *pbo)
             }
             break;
 
+        case SET_DOUBLE_BUFFER: 
+            vdp->mp->sample_config.double_buffer = (int8_t) pbo->val; 
+            break; 
+
+        case SET_RECORDER_ENABLE: 
+            vdp->mp->sample_config.record_to_disk = (int8_t) pbo->val; 
+            break; 
+
+        case SET_POST_MORTEM_FREEZE: 
+            break; 
+
         default:
             return -1; 
     }
@@ -200,7 +231,7 @@ init_record_bo (struct boRecord *pbo)
 }
 
 static long
-write_bo (struct boRecord *pbo)
+write_bo_settings (struct boRecord *pbo)
 {
     uint32_t timebase = 0; 
     double sample_interval, sample_rate = 0;    
@@ -210,11 +241,12 @@ write_bo (struct boRecord *pbo)
     int rbv = 1; 
     uint32_t result = 0;
     char log_message[LOG_MESSAGE_LENGTH] = {0}; 
+    vdp->update_rbv = vdp->reset_val = 0;
 
 
 	switch (vdp->ioType){
         case OPEN_PICOSCOPE: 
-            int pv_value = (int)pbo->val; 
+            int pv_value = (int)vdp->write_val; 
             
             if (pv_value == 1){
                 int16_t handle; 
@@ -227,12 +259,11 @@ write_bo (struct boRecord *pbo)
                     vdp->mp->handle = handle; // Update device handle if successful
                 }
             } else {
-                if (*vdp->mp->dataAcquisitionFlag == 1) {
-                    dbProcess((struct dbCommon *)vdp->mp->pWaveformStopPtr);
-
-                    // this is to make sure the capturing thread is actually stopped
-                    epicsMutexLock(vdp->mp->epics_acquisition_thread_mutex);
-                    epicsMutexUnlock(vdp->mp->epics_acquisition_thread_mutex);
+                // Not in record processing here, stop without the STOP record 
+                request_acquisition_stop(vdp->mp);
+                if (acquisition_state(vdp->mp) != ACQ_IDLE) {
+                    // Make sure the capturing thread is actually stopped before closing 
+                    wait_acquisition_idle(vdp->mp);
                     printf("Data acquisition stopped\n");
                 }
                 result = close_picoscope(vdp->mp); 
@@ -247,7 +278,7 @@ write_bo (struct boRecord *pbo)
         case SET_CHANNEL_ON:    
             char* record_name = pbo->name;
             int channel_index = find_channel_index_from_record(record_name, vdp->mp->channel_configs); 
-            pv_value = pbo->val;
+            pv_value = vdp->write_val;
 
             // If PV value is 1 (ON) set channel on 
             if (pv_value == 1) { 
@@ -267,7 +298,7 @@ write_bo (struct boRecord *pbo)
 
             if (result != 0) {
                 strcpy(log_message, pv_value == 1 ? "Error setting channel on." : "Error setting channel off.");
-                pbo->val = 0; // Default to channel OFF when error occurs 
+                vdp->reset_val = 1; // Default to channel OFF when error occurs 
             }
             update_log_pvs(vdp->mp, log_message[0] ? log_message : NULL, result);
 
@@ -289,6 +320,17 @@ write_bo (struct boRecord *pbo)
             re_acquire_waveform(vdp->mp);
             break;
 
+        case SET_DOUBLE_BUFFER: 
+            vdp->mp->sample_config.double_buffer = (int8_t) vdp->write_val; 
+            re_acquire_waveform(vdp->mp);
+            break; 
+
+        case SET_RECORDER_ENABLE: 
+            // Takes effect at the next start, each acquisition is recorded to its own archive 
+            vdp->mp->sample_config.record_to_disk = (int8_t) vdp->write_val; 
+            re_acquire_waveform(vdp->mp);
+            break; 
+
 		
         default:
 			returnStatus = -1;
@@ -296,17 +338,74 @@ write_bo (struct boRecord *pbo)
 	}
 
 	if (returnStatus <= 0 ){
-		if (recGblSetSevr(pbo, WRITE_ALARM, INVALID_ALARM)  &&  errVerbose
-				&& (pbo->stat != WRITE_ALARM  ||  pbo->sevr != INVALID_ALARM))
-			printf("%s: Write error (bo)\n\n", pbo->name);
+		vdp->write_failed = 1;
 		return 2;
 	}
     
-    pbo->rbv = rbv;
+    vdp->rbv = rbv;
+    vdp->update_rbv = 1;
 
 	return 0;
 }
 
+// Completion of a bo write, on the callback thread with the record's lock held 
+static void complete_bo(struct boRecord *pbo)
+{
+    struct PicoscopeBioData *vdp = (struct PicoscopeBioData *)pbo->dpvt;
+
+    if (vdp->write_failed) {
+		if (recGblSetSevr(pbo, WRITE_ALARM, INVALID_ALARM)  &&  errVerbose
+				&& (pbo->stat != WRITE_ALARM  ||  pbo->sevr != INVALID_ALARM))
+			printf("%s: Write error (bo)\n\n", pbo->name);
+    }
+    if (vdp->reset_val) {
+        pbo->val = 0;
+    }
+    if (vdp->update_rbv) {
+        pbo->rbv = vdp->rbv;
+    }
+}
+
+/**
+ * Freezes the post-mortem ring in record processing. A freeze is a machine protection action, 
+ * it only takes the post-mortem lock so it is not queued behind slow SDK writes. Acquisition 
+ * carries on, the dump thread writes the ring out. 
+ */
+static long freeze_post_mortem(struct boRecord *pbo)
+{
+    struct PicoscopeBioData *vdp = (struct PicoscopeBioData *)pbo->dpvt;
+
+    if (pbo->val != 1) {
+        return 0;
+    }
+    if (post_mortem_freeze(vdp->mp) != 0) {
+        update_log_pvs(vdp->mp, "Post-mortem ring is empty, disabled or already being dumped.", PICO_BUSY);
+        pbo->rbv = 0; 
+    } else {
+        update_log_pvs(vdp->mp, NULL, PICO_OK);
+        pbo->rbv = 1; 
+    }
+    return 0;
+}
+
+// Asynchronous, opening and closing the device run on the writer thread with the configuration 
+// store write lock held 
+static long write_bo (struct boRecord *pbo)
+{
+    struct PicoscopeBioData *vdp = (struct PicoscopeBioData *)pbo->dpvt;
+
+    if (vdp->ioType == SET_POST_MORTEM_FREEZE) {
+        return freeze_post_mortem(pbo);
+    }
+    if (!pbo->pact) {
+        vdp->write_val = pbo->val;
+        vdp->write_failed = 0;
+    }
+    vdp->async.complete = (void (*)(struct dbCommon *))complete_bo;
+    return write_async(vdp->mp, (struct dbCommon *)pbo, &vdp->async, 
+                       (long (*)(struct dbCommon *))write_bo_settings);
+}
+
 
 /****************************************************************************************
  * Binary Input Records - bi
@@ -410,6 +509,16 @@ static long read_bi (struct biRecord *pbi)
             
             break; 
 
+        case GET_DOUBLE_BUFFER: 
+            pbi->val = vdp->mp->sample_config.double_buffer; 
+            pbi->rval = vdp->mp->sample_config.double_buffer; 
+            break; 
+
+        case GET_RECORDER_ENABLE: 
+            pbi->val = vdp->mp->sample_config.record_to_disk; 
+            pbi->rval = vdp->mp->sample_config.record_to_disk; 
+            break; 
+
 		default:
             returnStatus = -1; 
 		}
@@ -27,9 +27,13 @@
  */
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <dbAccess.h>
+#include <dbScan.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
 
 #include "picoscopeConfig.h"
 #include "devPicoscopeCommon.h"
@@ -51,21 +55,316 @@ int convertPicoscopeParams(char *string, char *paramName, char *serialNum)
     return 0;
 }
 
-void re_acquire_waveform(struct PS6000AModule *mp){
-    if (*mp->dataAcquisitionFlag!=1) {
+/**
+ * Stops the acquisition and starts it again, so the acquisition thread picks up the current 
+ * configuration. Does nothing if acquisition has stopped in the meantime. Goes through the 
+ * acquisition state machine rather than processing the STOP and START records, no record may 
+ * be locked here while write_lock is held. 
+ * 
+ * @param mp PS6000AModule Pointer to the module to restart. 
+ */
+static void restart_acquisition(struct PS6000AModule *mp){
+    // Held across the stop and start, so no write or other restart can land in between 
+    epicsMutexLock(mp->config_store->write_lock);
+    if (!acquisition_active(mp)) {
+        epicsMutexUnlock(mp->config_store->write_lock);
         return;
     }
-    epicsMutexLock(mp->epics_acquisition_restart_mutex);    // this is to make sure Stop and Start PV invoked in sequence.
     
-    dbProcess((struct dbCommon *)mp->pWaveformStopPtr);
-
-    // this is to make sure the capureting thread is actually stopped
-    epicsMutexLock(mp->epics_acquisition_thread_mutex);
-    epicsMutexUnlock(mp->epics_acquisition_thread_mutex);
+    request_acquisition_stop(mp);
+    wait_acquisition_idle(mp);
     
-    dbProcess((struct dbCommon *)mp->pWaveformStartPtr);
+    publish_config(mp);
+    if (request_acquisition_start(mp) == 0) {
+        mp->restart_coalescer->executed++;
+    }
     
-    epicsMutexUnlock(mp->epics_acquisition_restart_mutex);
+    epicsMutexUnlock(mp->config_store->write_lock);
+}
+
+/**
+ * Restart thread of a module. Waits for a restart request, then for the writes to go quiet for 
+ * one window, and restarts the acquisition once for all of them. Returns once stopping is set. 
+ * 
+ * @param arg Void Pointer Passed in from EPICS thread create, a PS6000A Module pointer. 
+ */
+static void restart_thread_function(void *arg){
+    struct PS6000AModule *mp = (struct PS6000AModule *)arg;
+    struct RestartCoalescer *coalescer = mp->restart_coalescer;
+    epicsTimeStamp first_request, now;
+
+    while (1) {
+        epicsEventMustWait(coalescer->request_event);
+        if (coalescer->stopping) {
+            return;
+        }
+        epicsTimeGetCurrent(&first_request);
+
+        // Each write inside the window extends it, up to RESTART_MAX_DELAY_WINDOWS windows 
+        while (epicsEventWaitWithTimeout(coalescer->request_event, coalescer->window_secs) == epicsEventWaitOK) {
+            epicsTimeGetCurrent(&now);
+            if (epicsTimeDiffInSeconds(&now, &first_request) >= coalescer->window_secs * RESTART_MAX_DELAY_WINDOWS) {
+                break;
+            }
+        }
+        if (coalescer->stopping) {
+            return;
+        }
+        restart_acquisition(mp);
+    }
+}
+
+/**
+ * Allocates a restart coalescer. Its restart thread is started by start_restart_coalescer. 
+ * 
+ * @return   Pointer to the new RestartCoalescer, or NULL on failure. 
+ */
+struct RestartCoalescer* create_restart_coalescer(void){
+    struct RestartCoalescer *coalescer = calloc(1, sizeof(struct RestartCoalescer));
+    if (!coalescer) {
+        return NULL;
+    }
+    coalescer->lock = epicsMutexCreate();
+    coalescer->request_event = epicsEventCreate(epicsEventEmpty);
+    if (!coalescer->lock || !coalescer->request_event) {
+        destroy_restart_coalescer(coalescer);
+        return NULL;
+    }
+    coalescer->window_secs = RESTART_WINDOW_SECS;
+    return coalescer;
+}
+
+/**
+ * Starts the restart thread of a module's restart coalescer. 
+ * 
+ * @param mp PS6000AModule Pointer to the module, its restart_coalescer set. 
+ * 
+ * @return   0 on success, -1 if the thread could not be created. 
+ */
+int start_restart_coalescer(struct PS6000AModule *mp){
+    epicsThreadOpts opts = EPICS_THREAD_OPTS_INIT;
+    char thread_name[32];
+
+    opts.priority = epicsThreadPriorityMedium;
+    opts.stackSize = epicsThreadGetStackSize(epicsThreadStackSmall);
+    opts.joinable = 1;
+    snprintf(thread_name, sizeof(thread_name), "restart%s", mp->serial_num);
+    mp->restart_coalescer->thread = epicsThreadCreateOpt(thread_name, restart_thread_function, mp, &opts);
+    return mp->restart_coalescer->thread ? 0 : -1;
+}
+
+/**
+ * Ends the restart thread and waits for it, dropping any restart it has not made yet. 
+ * 
+ * @param coalescer RestartCoalescer Pointer The coalescer whose thread was started. 
+ */
+void stop_restart_coalescer(struct RestartCoalescer *coalescer){
+    coalescer->stopping = 1;
+    epicsEventSignal(coalescer->request_event);
+    epicsThreadMustJoin(coalescer->thread);
+    coalescer->thread = NULL;
+}
+
+// Frees a restart coalescer whose thread is not running 
+void destroy_restart_coalescer(struct RestartCoalescer *coalescer){
+    if (coalescer->lock)
+        epicsMutexDestroy(coalescer->lock);
+    if (coalescer->request_event)
+        epicsEventDestroy(coalescer->request_event);
+    free(coalescer);
+}
+
+/**
+ * Runs one write with the configuration store write lock held, so a snapshot published by a 
+ * concurrent start never holds half of it, and times it. 
+ * 
+ * @param mp      PS6000AModule Pointer to the module written to. 
+ * @param request AsyncWrite Pointer The write to run, its status is stored in it. 
+ */
+static void run_write(struct PS6000AModule *mp, struct AsyncWrite *request){
+    struct AsyncWriter *writer = mp->async_writer;
+    epicsTimeStamp start, end;
+
+    epicsTimeGetCurrent(&start);
+    epicsMutexLock(mp->config_store->write_lock);
+    request->status = request->write(request->precord);
+    epicsMutexUnlock(mp->config_store->write_lock);
+    epicsTimeGetCurrent(&end);
+
+    writer->last_write_secs = epicsTimeDiffInSeconds(&end, &start);
+    if (writer->last_write_secs > writer->max_write_secs) {
+        writer->max_write_secs = writer->last_write_secs;
+    }
+}
+
+/**
+ * Completes a write, on the callback thread with the record's lock held and the write lock 
+ * released. Runs the record's completion hook, which makes the record field changes the write 
+ * decided on, then queues the records the write asked to be processed with scanOnce. 
+ * 
+ * @param request AsyncWrite Pointer The write that has run. 
+ */
+static void complete_write(struct AsyncWrite *request){
+    if (request->complete) {
+        request->complete(request->precord);
+    }
+    for (int i = 0; i < request->num_process_after; i++) {
+        scanOnce(request->process_after[i]);
+    }
+    request->num_process_after = 0;
+}
+
+/**
+ * Writer thread of a module. Runs the queued writes in order and hands each record back to an 
+ * EPICS callback thread to complete its processing. Returns when a NULL write is received. 
+ * 
+ * @param arg Void Pointer Passed in from EPICS thread create, a PS6000A Module pointer. 
+ */
+static void writer_thread_function(void *arg){
+    struct PS6000AModule *mp = (struct PS6000AModule *)arg;
+    struct AsyncWrite *request;
+
+    while (1) {
+        if (epicsMessageQueueReceive(mp->async_writer->queue, &request, sizeof(request)) != sizeof(request)) {
+            continue;
+        }
+        if (!request) {
+            return;
+        }
+        run_write(mp, request);
+        mp->async_writer->completed++;
+        callbackRequestProcessCallback(&request->callback, priorityMedium, request->precord);
+    }
+}
+
+/**
+ * Allocates an async writer. Its writer thread is started by start_async_writer. 
+ * 
+ * @return   Pointer to the new AsyncWriter, or NULL on failure. 
+ */
+struct AsyncWriter* create_async_writer(void){
+    struct AsyncWriter *writer = calloc(1, sizeof(struct AsyncWriter));
+    if (!writer) {
+        return NULL;
+    }
+    writer->queue = epicsMessageQueueCreate(ASYNC_WRITE_QUEUE_DEPTH, sizeof(struct AsyncWrite *));
+    if (!writer->queue) {
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/**
+ * Starts the writer thread of a module's async writer. 
+ * 
+ * @param mp PS6000AModule Pointer to the module, its async_writer set. 
+ * 
+ * @return   0 on success, -1 if the thread could not be created. 
+ */
+int start_async_writer(struct PS6000AModule *mp){
+    epicsThreadOpts opts = EPICS_THREAD_OPTS_INIT;
+    char thread_name[32];
+
+    opts.priority = epicsThreadPriorityMedium;
+    opts.stackSize = epicsThreadGetStackSize(epicsThreadStackMedium);
+    opts.joinable = 1;
+    snprintf(thread_name, sizeof(thread_name), "writer%s", mp->serial_num);
+    mp->async_writer->thread = epicsThreadCreateOpt(thread_name, writer_thread_function, mp, &opts);
+    return mp->async_writer->thread ? 0 : -1;
+}
+
+/**
+ * Ends the writer thread once it has run the writes already queued, and waits for it. 
+ * 
+ * @param writer AsyncWriter Pointer The writer whose thread was started. 
+ */
+void stop_async_writer(struct AsyncWriter *writer){
+    struct AsyncWrite *request = NULL;
+
+    epicsMessageQueueSend(writer->queue, &request, sizeof(request));
+    epicsThreadMustJoin(writer->thread);
+    writer->thread = NULL;
+}
+
+// Frees an async writer whose thread is not running 
+void destroy_async_writer(struct AsyncWriter *writer){
+    epicsMessageQueueDestroy(writer->queue);
+    free(writer);
+}
+
+/**
+ * Write half of asynchronous device support. On the first pass the write is queued for the 
+ * writer thread and the record is left PACT, on the second pass, made from the callback once the 
+ * write has run, the write is completed and its status returned. If the queue is full the first 
+ * pass waits for room, the write never runs in record processing. 
+ * 
+ * @param mp      PS6000AModule Pointer to the module written to. 
+ * @param precord dbCommon Pointer The output record being processed. 
+ * @param request AsyncWrite Pointer The record's pending write. 
+ * @param write   The device support write, run with the configuration store write lock held. It 
+ *                must not read the record, device support copies the fields it needs first. 
+ * 
+ * @return        The device support write status, or 0 while the write is pending. 
+ */
+long write_async(struct PS6000AModule *mp, struct dbCommon *precord, struct AsyncWrite *request, 
+                 long (*write)(struct dbCommon *precord)){
+    if (precord->pact) {
+        complete_write(request);
+        return request->status;
+    }
+    request->precord = precord;
+    request->write = write;
+    request->num_process_after = 0;
+    if (epicsMessageQueueTrySend(mp->async_writer->queue, &request, sizeof(request)) != 0) {
+        // The writer thread takes no record locks, so it drains the queue while this waits 
+        mp->async_writer->synchronous++;
+        epicsMessageQueueSend(mp->async_writer->queue, &request, sizeof(request));
+    }
+    precord->pact = TRUE;
+    return 0;
+}
+
+/**
+ * Asks for a record to be processed once the running write completes, with scanOnce. Used by 
+ * writes for the readback and limit records they affect, which must not be processed from the 
+ * writer thread. 
+ * 
+ * @param request AsyncWrite Pointer The running write. 
+ * @param precord Pointer to the record to process, ignored if NULL or already asked for. 
+ */
+void process_after_write(struct AsyncWrite *request, void *precord){
+    if (!precord) {
+        return;
+    }
+    for (int i = 0; i < request->num_process_after; i++) {
+        if (request->process_after[i] == precord) {
+            return;
+        }
+    }
+    if (request->num_process_after < ASYNC_WRITE_MAX_PROCESS) {
+        request->process_after[request->num_process_after++] = (struct dbCommon *)precord;
+    }
+}
+
+/**
+ * Requests an acquisition restart after a configuration write, if acquiring. With a restart 
+ * window set, the request is handed to the restart thread and the write returns at once. 
+ * 
+ * @param mp PS6000AModule Pointer to the module whose configuration changed. 
+ */
+void re_acquire_waveform(struct PS6000AModule *mp){
+    if (!acquisition_active(mp)) {
+        return;
+    }
+    epicsMutexLock(mp->restart_coalescer->lock);
+    mp->restart_coalescer->requested++;
+    epicsMutexUnlock(mp->restart_coalescer->lock);
+    if (mp->restart_coalescer->window_secs <= 0) {
+        restart_acquisition(mp);
+        return;
+    }
+    epicsEventSignal(mp->restart_coalescer->request_event);
 }
 
 /** 
@@ -106,8 +405,9 @@ inline int find_channel_index_from_record(const char* record_name, struct Channe
 }
 
 /**
- * A function to update the log PV with the latest error message. Causes the 
- * waveform PV pLog to process. 
+ * A function to update the log PV with the latest error message. The message is kept in the 
+ * module and the waveform PV pLog is queued to process with scanOnce, so it is safe from any 
+ * thread, with or without a record lock held. 
  * 
  * @param mp PS6000AModule Pointer The PS6000AModule structure containing the PV
  *            to be updated.  
@@ -115,19 +415,17 @@ inline int find_channel_index_from_record(const char* record_name, struct Channe
  *        status_code The status code returned by the Picoscope API. 
  */
 void log_message(struct PS6000AModule* mp, char* error_message, uint32_t status_code){
-    char log_buffer[mp->pLog->nelm];
-
-    epicsMutexLock(mp->pLog->mlok);
+    epicsMutexLock(mp->log_lock);
     if (error_message) {
-        snprintf(log_buffer, sizeof(log_buffer), "%s Status code: 0x%08X", error_message, status_code);
-        memcpy(mp->pLog->bptr, log_buffer, strlen(log_buffer) + 1);
-        mp->pLog->nord = strlen(log_buffer) + 1;
+        snprintf(mp->log_text, sizeof(mp->log_text), "%s Status code: 0x%08X", error_message, status_code);
     } else {
-        mp->pLog->nord = 0;  // Make the log PV empty
+        mp->log_text[0] = '\0';  // Make the log PV empty
+    }
+    epicsMutexUnlock(mp->log_lock);
+
+    if (mp->pLog) {
+        scanOnce((struct dbCommon *) mp->pLog);
     }
-    
-    dbProcess((struct dbCommon *) mp->pLog);
-    epicsMutexUnlock(mp->pLog->mlok);
 }
 
 #include <aiRecord.h>
@@ -144,9 +442,13 @@ void log_message(struct PS6000AModule* mp, char* error_message, uint32_t status_
  * 
  */
 inline void update_status_pv(struct PS6000AModule* mp, uint32_t status_code){
-    mp->pStatusCode->val = status_code;
-    dbProcess((struct dbCommon *) mp->pStatusCode);
+    epicsMutexLock(mp->log_lock);
+    mp->log_status_code = status_code;
+    epicsMutexUnlock(mp->log_lock);
 
+    if (mp->pStatusCode) {
+        scanOnce((struct dbCommon *) mp->pStatusCode);
+    }
 }
 
 /**
@@ -167,7 +469,8 @@ void update_log_pvs(struct PS6000AModule* mp, char* error_message, uint32_t stat
 #include <mbboRecord.h>
 
 /**
- * Function to update the enum string and values of mbbo and mbbi records. 
+ * Function to update the enum string and values of mbbo and mbbi records. Takes the records' 
+ * locks, so is called from a write's completion, never from the writer thread. 
  * 
  * @param pmbbo A pointer to a PV of type mbboRecord. 
  *        pmbbi A pointer to a PV of type mbbiRecord. 
@@ -184,6 +487,9 @@ void update_enum_options(struct mbboRecord* pmbbo, struct mbbiRecord* pmbbi, Mul
         }
     }
 
+    // The mbbo forward links to its mbbi readback, so both are in one lock set 
+    dbScanLock((struct dbCommon *)pmbbo);
+    dbScanLock((struct dbCommon *)pmbbi);
     update_field(pmbbo->zrst, pmbbi->zrst, pmbbo->zrvl, pmbbi->zrvl, options.zrst, options.zrvl); 
     update_field(pmbbo->onst, pmbbi->onst, pmbbo->onvl, pmbbi->onvl, options.onst, options.onvl); 
     update_field(pmbbo->twst, pmbbi->twst, pmbbo->twvl, pmbbi->twvl, options.twst, options.twvl); 
@@ -200,5 +506,6 @@ void update_enum_options(struct mbboRecord* pmbbo, struct mbbiRecord* pmbbi, Mul
     update_field(pmbbo->ttst, pmbbi->ttst, pmbbo->ttvl, pmbbi->ttvl, options.ttst, options.ttvl); 
     update_field(pmbbo->ftst, pmbbi->ftst, pmbbo->ftvl, pmbbi->ftvl, options.ftst, options.ftvl); 
     update_field(pmbbo->ffst, pmbbi->ffst, pmbbo->ffvl, pmbbi->ffvl, options.ffst, options.ffvl); 
-
+    dbScanUnlock((struct dbCommon *)pmbbi);
+    dbScanUnlock((struct dbCommon *)pmbbo);
 }
\ No newline at end of file
@@ -29,6 +29,7 @@
 
 #include "drvPicoscope.h"
 #include <waveformRecord.h>
+#include <callback.h>
 
 #define LOG_MESSAGE_LENGTH 500
 
@@ -51,9 +52,32 @@ typedef struct MultiBitBinaryEnums {
     char* ffst; int ffvl; 
 } MultiBitBinaryEnums;
 
+// One output record's pending write. Lives in the record's device private data, the record 
+// stays PACT from queueing until the callback has processed it again. 
+struct AsyncWrite {
+    epicsCallback callback;
+    struct dbCommon *precord;
+    long (*write)(struct dbCommon *precord);
+    void (*complete)(struct dbCommon *precord);    // Optional, record field changes made on completion 
+    struct dbCommon *process_after[ASYNC_WRITE_MAX_PROCESS];   // Processed once the write completes 
+    int num_process_after;
+    long status;                    // Returned by write, reported when the record completes 
+};
+
 void update_enum_options(struct mbboRecord* pmbbo, struct mbbiRecord* pmbbi, MultiBitBinaryEnums options);
 int convertPicoscopeParams(char *string, char *paramName, char *serialNum);
 void re_acquire_waveform(struct PS6000AModule *mp);
+struct RestartCoalescer* create_restart_coalescer(void);
+int start_restart_coalescer(struct PS6000AModule *mp);
+void stop_restart_coalescer(struct RestartCoalescer *coalescer);
+void destroy_restart_coalescer(struct RestartCoalescer *coalescer);
+struct AsyncWriter* create_async_writer(void);
+int start_async_writer(struct PS6000AModule *mp);
+void stop_async_writer(struct AsyncWriter *writer);
+void destroy_async_writer(struct AsyncWriter *writer);
+long write_async(struct PS6000AModule *mp, struct dbCommon *precord, struct AsyncWrite *request, 
+                 long (*write)(struct dbCommon *precord));
+void process_after_write(struct AsyncWrite *request, void *precord);
 int find_channel_index_from_record(const char* record_name, struct ChannelConfigs channel_configs[NUM_CHANNELS]);
 void update_log_pvs(struct PS6000AModule* mp, char error_message[], uint32_t status_code); 
 
@@ -63,6 +63,7 @@ enum ioType
     GET_RANGE,
     SET_BANDWIDTH, 
     GET_BANDWIDTH,
+    GET_ACQUISITION_STATE,
 };
 
 enum ioFlag
@@ -102,6 +103,7 @@ struct mbbioType
         {"get_range",                     isInput,      GET_RANGE,                      ""},
         {"set_bandwidth",                 isOutput,     SET_BANDWIDTH,                  ""}, 
         {"get_bandwidth",                 isInput,      GET_BANDWIDTH,                  ""}, 
+        {"get_acquisition_state",         isInput,      GET_ACQUISITION_STATE,          ""}, 
 
 };
 
@@ -116,6 +118,16 @@ struct PicoscopeMbbioData
         char paramLabel[32];
         int paramValid;
         struct PS6000AModule* mp;
+        struct AsyncWrite async;    // Output records only 
+        // VAL, RVAL and ORAW when the write was queued, the writer thread reads no record fields 
+        epicsEnum16 write_val;
+        epicsUInt32 write_rval;
+        epicsUInt32 write_oraw;
+        int write_failed;           // Alarm raised when the write completes 
+        // Enum options a write changed, set on the records when it completes 
+        struct mbboRecord* enum_mbbo;
+        struct mbbiRecord* enum_mbbi;
+        MultiBitBinaryEnums enum_options;
     };
 
 static enum ioType findMbbioType(enum ioFlag ioFlag, char *param, char **cmdString)
@@ -262,8 +274,42 @@ static long init_record_mbbo (struct mbboRecord *pmbbo)
 }
 
 
+/**
+ * Keeps enum options a write changes until the write completes. The records are not changed 
+ * from the writer thread, which holds no record lock. 
+ * 
+ * @param vdp     PicoscopeMbbioData Pointer of the record being written. 
+ *        pmbbo   A pointer to a PV of type mbboRecord. 
+ *        pmbbi   A pointer to a PV of type mbbiRecord. 
+ *        options Contains new string and values for each enum option. 
+ */
+static void defer_enum_options(struct PicoscopeMbbioData *vdp, struct mbboRecord* pmbbo, 
+                               struct mbbiRecord* pmbbi, MultiBitBinaryEnums options){
+    vdp->enum_mbbo = pmbbo;
+    vdp->enum_mbbi = pmbbi;
+    vdp->enum_options = options;
+}
+
+// Completion of an mbbo write, on the callback thread before the readbacks are processed 
+static void complete_mbbo(struct mbboRecord *pmbbo)
+{
+    struct PicoscopeMbbioData *vdp = (struct PicoscopeMbbioData *)pmbbo->dpvt;
+
+    if (vdp->write_failed) {
+        if (recGblSetSevr(pmbbo, READ_ALARM, INVALID_ALARM)  &&  errVerbose
+            &&  (pmbbo->stat != READ_ALARM  ||  pmbbo->sevr != INVALID_ALARM))
+            {
+                errlogPrintf("%s: Read Error\n", pmbbo->name);
+            }
+    }
+    if (vdp->enum_mbbo) {
+        update_enum_options(vdp->enum_mbbo, vdp->enum_mbbi, vdp->enum_options);
+        vdp->enum_mbbo = NULL;
+    }
+}
+
 static long
-write_mbbo (struct mbboRecord *pmbbo)
+write_mbbo_settings (struct mbboRecord *pmbbo)
 {   
     char* record_name; 
     int channel_index; 
@@ -274,12 +320,13 @@ write_mbbo (struct mbboRecord *pmbbo)
 
     struct PicoscopeMbbioData *vdp = (struct PicoscopeMbbioData *)pmbbo->dpvt;
     int returnState = 0; 
+    int trigger_only = 0;   // Applied between block captures, streaming restarts 
 
     switch (vdp->ioType)
     {        
 
         case SET_RESOLUTION: 
-            int16_t resolution = (int)pmbbo->rval; 
+            int16_t resolution = (int)vdp->write_rval; 
             result = set_resolution(vdp->mp, resolution); 
             if (result !=0) {
                 update_log_pvs(vdp->mp, "Failed to set resolution", result);
@@ -290,7 +337,7 @@ write_mbbo (struct mbboRecord *pmbbo)
             // Sampling resolution affects max and min trigger thresholds, process threshold PVs
             // to ensure thresholds are still within the limits at the new resolution.  
             for(size_t i = 0; i < sizeof(vdp->mp->pTriggerThreshold)/ sizeof(vdp->mp->pTriggerThreshold[0]); i++){ 
-                dbProcess((struct dbCommon *) vdp->mp->pTriggerThreshold[i]);            
+                process_after_write(&vdp->async, vdp->mp->pTriggerThreshold[i]);            
             }
         
             update_log_pvs(vdp->mp, NULL, result);
@@ -302,10 +349,10 @@ write_mbbo (struct mbboRecord *pmbbo)
 
             // Coupling affects the range of valid analog offset values, processing this PV will ensure 
             // the offset for the channel is valid with the new coupling. 
-            dbProcess((struct dbCommon *)vdp->mp->pAnalogOffestRecords[channel_index]);     
+            process_after_write(&vdp->async, vdp->mp->pAnalogOffestRecords[channel_index]);     
     
             int16_t previous_coupling = vdp->mp->channel_configs[channel_index].coupling; 
-            vdp->mp->channel_configs[channel_index].coupling = (int)pmbbo->rval;
+            vdp->mp->channel_configs[channel_index].coupling = (int)vdp->write_rval;
 
             uint32_t channel_status = get_channel_status(vdp->mp->channel_configs[channel_index].channel, vdp->mp->channel_status); 
             if (channel_status == 1) {
@@ -316,7 +363,7 @@ write_mbbo (struct mbboRecord *pmbbo)
                 );                
                 // If channel is not succesfully set on, return to previous value 
                 if (result != 0) {
-                    snprintf(log_message, sizeof(log_message), "Error setting coupling to %d", (int)pmbbo->rval);
+                    snprintf(log_message, sizeof(log_message), "Error setting coupling to %d", (int)vdp->write_rval);
                     vdp->mp->channel_configs[channel_index].coupling = previous_coupling;
                 }
             }
@@ -329,11 +376,11 @@ write_mbbo (struct mbboRecord *pmbbo)
 
             int16_t previous_range = vdp->mp->channel_configs[channel_index].range; 
 
-            vdp->mp->channel_configs[channel_index].range = (int)pmbbo->rval;
+            vdp->mp->channel_configs[channel_index].range = (int)vdp->write_rval;
         
             // Voltage range affects the range of valid analog offset values, processing this PV will ensure 
             // the offset for the channel is valid with the new range. 
-            dbProcess((struct dbCommon *)vdp->mp->pAnalogOffestRecords[channel_index]);     
+            process_after_write(&vdp->async, vdp->mp->pAnalogOffestRecords[channel_index]);     
 
             channel_status = get_channel_status(vdp->mp->channel_configs[channel_index].channel, vdp->mp->channel_status); 
             if (channel_status == 1){
@@ -344,14 +391,14 @@ write_mbbo (struct mbboRecord *pmbbo)
                 );     
                 // If channel is not succesfully set on, return to previous value 
                 if (result != 0) {
-                    snprintf(log_message, sizeof(log_message), "Error setting voltage range to %d", (int)pmbbo->rval);
+                    snprintf(log_message, sizeof(log_message), "Error setting voltage range to %d", (int)vdp->write_rval);
                     vdp->mp->channel_configs[channel_index].range = previous_range;
                 }
             }
 
             // Process trigger thresholds to ensure triggers are set between ±range. 
             for(size_t i = 0; i < sizeof(vdp->mp->pTriggerThreshold)/ sizeof(vdp->mp->pTriggerThreshold[0]); i++){ 
-                dbProcess((struct dbCommon *) vdp->mp->pTriggerThreshold[i]);            
+                process_after_write(&vdp->async, vdp->mp->pTriggerThreshold[i]);            
             }
             
             update_log_pvs(vdp->mp, log_message[0] ? log_message : NULL, result);
@@ -364,7 +411,7 @@ write_mbbo (struct mbboRecord *pmbbo)
             
             int16_t previous_bandwidth = vdp->mp->channel_configs[channel_index].bandwidth;
 
-            vdp->mp->channel_configs[channel_index].bandwidth = (int)pmbbo->rval;
+            vdp->mp->channel_configs[channel_index].bandwidth = (int)vdp->write_rval;
 
             channel_status = get_channel_status(vdp->mp->channel_configs[channel_index].channel, vdp->mp->channel_status); 
             if (channel_status == 1) {
@@ -375,7 +422,7 @@ write_mbbo (struct mbboRecord *pmbbo)
                 );                
                 // If channel is not succesfully set on, return to previous value 
                 if (result != 0) {
-                    snprintf(log_message, sizeof(log_message), "Error setting bandwidth to %d", (int)pmbbo->rval);
+                    snprintf(log_message, sizeof(log_message), "Error setting bandwidth to %d", (int)vdp->write_rval);
                     vdp->mp->channel_configs[channel_index].bandwidth = previous_bandwidth;
                 }
             }
@@ -385,7 +432,7 @@ write_mbbo (struct mbboRecord *pmbbo)
 
         case SET_TIME_PER_DIVISION: 
             double previous_time_per_division = vdp->mp->sample_config.timebase_configs.time_per_division; 
-            vdp->mp->sample_config.timebase_configs.time_per_division = (int) pmbbo->rval; 
+            vdp->mp->sample_config.timebase_configs.time_per_division = (int) vdp->write_rval; 
 
             result = get_valid_timebase_configs(
                 vdp->mp,
@@ -395,7 +442,7 @@ write_mbbo (struct mbboRecord *pmbbo)
             ); 
             
             if (result != 0) {
-                snprintf(log_message, sizeof(log_message), "Error setting time per division to %d", (int)pmbbo->rval);
+                snprintf(log_message, sizeof(log_message), "Error setting time per division to %d", (int)vdp->write_rval);
                 vdp->mp->sample_config.timebase_configs.time_per_division = previous_time_per_division;  
             } else {
                 vdp->mp->sample_config.timebase_configs.sample_interval_secs = sample_interval;
@@ -407,7 +454,7 @@ write_mbbo (struct mbboRecord *pmbbo)
             break; 
 
         case SET_TIME_PER_DIVISION_UNIT:
-            if (pmbbo->val == s_per_div) { 
+            if (vdp->write_val == s_per_div) { 
                 // If unit is seconds, limit to 10 secs per div and update PVs. 
                 MultiBitBinaryEnums s_per_div_options = {0};
                 s_per_div_options.frst = ""; s_per_div_options.frvl = 0; 
@@ -419,7 +466,8 @@ write_mbbo (struct mbboRecord *pmbbo)
                 s_per_div_options.test = ""; s_per_div_options.tevl = 0;
                 s_per_div_options.elst = ""; s_per_div_options.elvl = 0;              
     
-                update_enum_options(
+                defer_enum_options(
+                    vdp,
                     vdp->mp->pTimePerDivision,
                     vdp->mp->pTimePerDivisionFbk, 
                     s_per_div_options
@@ -428,10 +476,10 @@ write_mbbo (struct mbboRecord *pmbbo)
                 // If the time per division is no longer valid, update PVs to valid option. 
                 if (vdp->mp->sample_config.timebase_configs.time_per_division > 10){
                     vdp->mp->sample_config.timebase_configs.time_per_division = 1; 
-                    dbProcess((struct dbCommon *)vdp->mp->pTimePerDivisionFbk); 
+                    process_after_write(&vdp->async, vdp->mp->pTimePerDivisionFbk); 
                 }
 
-            } else if (pmbbo->oraw == s_per_div) {  
+            } else if (vdp->write_oraw == s_per_div) {  
                 // If last unit was seconds, update time per division options to full set of options. 
                 MultiBitBinaryEnums under_s_per_div_options = {0};
                 under_s_per_div_options.frst = "20";   under_s_per_div_options.frvl = 20; 
@@ -443,7 +491,8 @@ write_mbbo (struct mbboRecord *pmbbo)
                 under_s_per_div_options.test = "2000"; under_s_per_div_options.tevl = 2000;
                 under_s_per_div_options.elst = "5000"; under_s_per_div_options.elvl = 5000;
 
-                update_enum_options(
+                defer_enum_options(
+                    vdp,
                     vdp->mp->pTimePerDivision,
                     vdp->mp->pTimePerDivisionFbk, 
                     under_s_per_div_options
@@ -451,7 +500,7 @@ write_mbbo (struct mbboRecord *pmbbo)
 
             }
             int16_t previous_time_per_division_unit = vdp->mp->sample_config.timebase_configs.time_per_division_unit;
-            vdp->mp->sample_config.timebase_configs.time_per_division_unit = (int) pmbbo->val; 
+            vdp->mp->sample_config.timebase_configs.time_per_division_unit = (int) vdp->write_val; 
 
             result = get_valid_timebase_configs(
                 vdp->mp,
@@ -461,7 +510,7 @@ write_mbbo (struct mbboRecord *pmbbo)
             ); 
 
             if (result != 0) {
-                snprintf(log_message, sizeof(log_message), "Error setting time per division unit to %d", (int)pmbbo->rval);
+                snprintf(log_message, sizeof(log_message), "Error setting time per division unit to %d", (int)vdp->write_rval);
                 vdp->mp->sample_config.timebase_configs.time_per_division_unit = previous_time_per_division_unit; 
             } else { 
                 vdp->mp->sample_config.timebase_configs.sample_interval_secs = sample_interval;
@@ -474,11 +523,12 @@ write_mbbo (struct mbboRecord *pmbbo)
 
 
         case SET_DOWN_SAMPLE_RATIO_MODE: 
-            vdp->mp->sample_config.down_sample_ratio_mode = (int)pmbbo->rval;
+            vdp->mp->sample_config.down_sample_ratio_mode = (int)vdp->write_rval;
             break;
         
         case SET_TRIGGER_CHANNEL:
-            vdp->mp->trigger_config.channel = (enum Channel) pmbbo->rval;
+            trigger_only = 1;
+            vdp->mp->trigger_config.channel = (enum Channel) vdp->write_rval;
             if (vdp->mp->trigger_config.channel == TRIGGER_AUX)
             {    
                 vdp->mp->trigger_config.triggerType = SIMPLE_EDGE;
@@ -505,17 +555,18 @@ write_mbbo (struct mbboRecord *pmbbo)
             }
 
             // Update all trigger info to valid options for the trigger channel 
-            dbProcess((struct dbCommon *)vdp->mp->pTriggerType); 
-            dbProcess((struct dbCommon *)vdp->mp->pTriggerDirectionFbk);
-            dbProcess((struct dbCommon *)vdp->mp->pTriggerModeFbk);
+            process_after_write(&vdp->async, vdp->mp->pTriggerType); 
+            process_after_write(&vdp->async, vdp->mp->pTriggerDirectionFbk);
+            process_after_write(&vdp->async, vdp->mp->pTriggerModeFbk);
             for (size_t i = 0; i < sizeof(vdp->mp->pTriggerThresholdFbk)/sizeof(vdp->mp->pTriggerThresholdFbk[0]); i++)
             {
-                dbProcess((struct dbCommon *)vdp->mp->pTriggerThresholdFbk[i]);
+                process_after_write(&vdp->async, vdp->mp->pTriggerThresholdFbk[i]);
             }
             break;
 
         case SET_TRIGGER_TYPE:             
-            vdp->mp->trigger_config.triggerType = (int)pmbbo->val; 
+            trigger_only = 1;
+            vdp->mp->trigger_config.triggerType = (int)vdp->write_val; 
             
             // Update related configurations based on trigger type selected. Including changes
             // to trigger direction mbbo/mbbi options and trigger_config members.
@@ -535,7 +586,8 @@ write_mbbo (struct mbboRecord *pmbbo)
                     no_trigger_options.onst = "";       no_trigger_options.onvl = 0;
                     no_trigger_options.twst = "";       no_trigger_options.twvl = 0;
                     
-                    update_enum_options(
+                    defer_enum_options(
+                    vdp,
                         vdp->mp->pTriggerDirection,
                         vdp->mp->pTriggerDirectionFbk, 
                         no_trigger_options
@@ -556,7 +608,8 @@ write_mbbo (struct mbboRecord *pmbbo)
                     simple_edge_options.onst = "FALLING"; simple_edge_options.onvl = FALLING; 
                     simple_edge_options.twst = "";        simple_edge_options.twvl = 0;
                     
-                    update_enum_options(
+                    defer_enum_options(
+                    vdp,
                         vdp->mp->pTriggerDirection,
                         vdp->mp->pTriggerDirectionFbk, 
                         simple_edge_options
@@ -574,7 +627,8 @@ write_mbbo (struct mbboRecord *pmbbo)
                     window_options.onst = "EXIT";           window_options.onvl = EXIT; 
                     window_options.twst = "ENTER OR EXIT";  window_options.twvl = ENTER_OR_EXIT;
                    
-                    update_enum_options(
+                    defer_enum_options(
+                    vdp,
                         vdp->mp->pTriggerDirection,
                         vdp->mp->pTriggerDirectionFbk, 
                         window_options
@@ -594,7 +648,8 @@ write_mbbo (struct mbboRecord *pmbbo)
                     advanced_edge_options.onst = "FALLING";            advanced_edge_options.onvl = FALLING; 
                     advanced_edge_options.twst = "RISING OR FALLING";  advanced_edge_options.twvl = RISING_OR_FALLING;
                    
-                    update_enum_options(
+                    defer_enum_options(
+                    vdp,
                         vdp->mp->pTriggerDirection,
                         vdp->mp->pTriggerDirectionFbk, 
                         advanced_edge_options
@@ -606,22 +661,22 @@ write_mbbo (struct mbboRecord *pmbbo)
             }
 
             // Update all trigger info to valid options for the trigger type
-            dbProcess((struct dbCommon *)vdp->mp->pTriggerChannelFbk);
-            dbProcess((struct dbCommon *)vdp->mp->pTriggerDirectionFbk);
-            dbProcess((struct dbCommon *)vdp->mp->pTriggerModeFbk);
+            process_after_write(&vdp->async, vdp->mp->pTriggerChannelFbk);
+            process_after_write(&vdp->async, vdp->mp->pTriggerDirectionFbk);
+            process_after_write(&vdp->async, vdp->mp->pTriggerModeFbk);
             for (size_t i = 0; i < sizeof(vdp->mp->pTriggerThresholdFbk)/sizeof(vdp->mp->pTriggerThresholdFbk[0]); i++)
                 {
-                    dbProcess((struct dbCommon *)vdp->mp->pTriggerThresholdFbk[i]);
+                    process_after_write(&vdp->async, vdp->mp->pTriggerThresholdFbk[i]);
                 }
             break; 
 
         case SET_TRIGGER_DIRECTION:
-            
+            trigger_only = 1;
             if (vdp->mp->trigger_config.triggerType == NO_TRIGGER) {
                 vdp->mp->trigger_config.thresholdDirection = NONE; 
             }
             else {
-                vdp->mp->trigger_config.thresholdDirection = (enum ThresholdDirection) pmbbo->rval;
+                vdp->mp->trigger_config.thresholdDirection = (enum ThresholdDirection) vdp->write_rval;
             }
             break;
         
@@ -632,18 +687,32 @@ write_mbbo (struct mbboRecord *pmbbo)
 
     if (returnState < 0)
     {
-        if (recGblSetSevr(pmbbo, READ_ALARM, INVALID_ALARM)  &&  errVerbose
-            &&  (pmbbo->stat != READ_ALARM  ||  pmbbo->sevr != INVALID_ALARM))
-            {
-                errlogPrintf("%s: Read Error\n", pmbbo->name);
-            }
+        vdp->write_failed = 1;
         return 2;
+    }else if (trigger_only && !config_streams(vdp->mp)){
+        post_trigger_config(vdp->mp);
     }else{
         re_acquire_waveform(vdp->mp);
     }
     return 0;
 }
 
+// Asynchronous like write_ao, resolution and channel changes wait on the device 
+static long write_mbbo (struct mbboRecord *pmbbo)
+{
+    struct PicoscopeMbbioData *vdp = (struct PicoscopeMbbioData *)pmbbo->dpvt;
+
+    if (!pmbbo->pact) {
+        vdp->write_val = pmbbo->val;
+        vdp->write_rval = pmbbo->rval;
+        vdp->write_oraw = pmbbo->oraw;
+        vdp->write_failed = 0;
+    }
+    vdp->async.complete = (void (*)(struct dbCommon *))complete_mbbo;
+    return write_async(vdp->mp, (struct dbCommon *)pmbbo, &vdp->async, 
+                       (long (*)(struct dbCommon *))write_mbbo_settings);
+}
+
 
 
 
@@ -655,6 +724,7 @@ typedef long (*DEVSUPFUN_MBBI)(struct mbbiRecord *);
 
 static long init_record_mbbi(struct mbbiRecord *);
 static long read_mbbi(struct mbbiRecord *);
+static long get_ioint_info_mbbi(int cmd, struct mbbiRecord *pmbbi, IOSCANPVT *ppvt);
 
 struct
 {
@@ -670,7 +740,7 @@ struct
         NULL,
         NULL,
         init_record_mbbi,
-        NULL,
+        (DEVSUPFUN_MBBI) get_ioint_info_mbbi,
         read_mbbi,
     };
 
@@ -750,6 +820,28 @@ static long init_record_mbbi(struct mbbiRecord * pmbbi)
     return 0;
 }
 
+/**
+ * Provides the scan list for mbbi records with SCAN set to I/O Intr. The acquisition state 
+ * record is scanned on every state transition. 
+ */
+static long get_ioint_info_mbbi(int cmd, struct mbbiRecord *pmbbi, IOSCANPVT *ppvt){
+    struct PicoscopeMbbioData *vdp = (struct PicoscopeMbbioData *)pmbbi->dpvt;
+
+    if (!vdp || !vdp->mp) {
+        return -1;
+    }
+    switch (vdp->ioType) {
+        case GET_ACQUISITION_STATE:
+            *ppvt = vdp->mp->acquisition->state_scan;
+            break;
+
+        default:
+            errlogPrintf("%s: I/O Intr not supported for %s\n", pmbbi->name, vdp->paramLabel);
+            return -1;
+    }
+    return 0;
+}
+
 static long read_mbbi(struct mbbiRecord *pmbbi){
     
     char* record_name; 
@@ -819,6 +911,10 @@ static long read_mbbi(struct mbbiRecord *pmbbi){
             pmbbi->rval = vdp->mp->trigger_config.triggerType; 
             break; 
 
+        case GET_ACQUISITION_STATE: 
+            pmbbi->rval = acquisition_state(vdp->mp); 
+            break; 
+
         default:
             return 0;
     }
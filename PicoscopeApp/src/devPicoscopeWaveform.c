@@ -45,6 +45,8 @@ enum ioType
     STOP_RETRIEVE_WAVEFORM,
     UPDATE_WAVEFORM,
     GET_LOG, 
+    UPDATE_SEGMENTS,
+    GET_SEGMENT_TIMESTAMPS,
 };
 
 enum ioFlag
@@ -65,6 +67,8 @@ static struct waveformType
     {"stop_retrieve_waveform", isInput, STOP_RETRIEVE_WAVEFORM, "" },
     {"get_log", isInput, GET_LOG, ""}, 
     {"update_waveform", isInput, UPDATE_WAVEFORM, "" },
+    {"update_segments", isInput, UPDATE_SEGMENTS, "" },
+    {"get_segment_timestamps", isInput, GET_SEGMENT_TIMESTAMPS, "" },
 };
 
 #define WAVEFORM_TYPE_SIZE    (sizeof (WaveformType) / sizeof (struct waveformType))
@@ -77,6 +81,8 @@ struct PicoscopeWaveformData
         char paramLabel[32];
         int paramValid;
         struct PS6000AModule* mp;
+        struct Frame* frame;        // Frame currently used as the record's bptr 
+        struct AsyncWrite async;    // START only, the start runs on the writer thread 
     };
 
 static enum ioType findWaveformType(enum ioFlag ioFlag, char *param, char **cmdString)
@@ -103,6 +109,7 @@ typedef long (*DEVSUPFUN_WAVEFORM)(struct waveformRecord *);
 
 
 static long init_record_waveform(struct waveformRecord *);
+static long get_ioint_info_waveform(int cmd, struct waveformRecord *pwaveform, IOSCANPVT *ppvt);
 static long read_waveform(struct waveformRecord *);
 
 struct
@@ -120,7 +127,7 @@ struct
         NULL,
         NULL,
         init_record_waveform,
-        NULL,
+        (DEVSUPFUN_WAVEFORM) get_ioint_info_waveform,
         read_waveform,
     };
 
@@ -130,6 +137,7 @@ static long init_record_waveform(struct waveformRecord * pwaveform)
 {
     struct instio  *pinst;
     struct PicoscopeWaveformData *vdp;
+    int channel_index;
 
     if (pwaveform->inp.type != INST_IO)
     {
@@ -173,11 +181,10 @@ static long init_record_waveform(struct waveformRecord * pwaveform)
         case GET_LOG: 
             // Save log PV to process when errors occur
             vdp->mp->pLog = pwaveform; 
-            vdp->mp->pLog->mlok = epicsMutexCreate();
             break; 
 
         case UPDATE_WAVEFORM:
-            int channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
+            channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
             vdp->mp->pRecordUpdateWaveform[channel_index] = pwaveform;
             vdp->mp->waveform[channel_index] = calloc(pwaveform->nelm, sizeof(int16_t));
             vdp->mp->waveform_size = pwaveform->nelm;
@@ -186,12 +193,43 @@ static long init_record_waveform(struct waveformRecord * pwaveform)
                 errlogPrintf("%s: Waveform memory allocation failed\n", pwaveform->name);
                 return -1;
             }
+            vdp->mp->frame_queue[channel_index] = create_frame_queue();
+            if (!vdp->mp->frame_queue[channel_index]) {
+                errlogPrintf("%s: Frame queue memory allocation failed\n", pwaveform->name);
+                return -1;
+            }
             break;
 
         case STOP_RETRIEVE_WAVEFORM:
             vdp->mp->pWaveformStopPtr = pwaveform;
             break;
 
+        case UPDATE_SEGMENTS:
+            channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
+            vdp->mp->pRecordUpdateSegments[channel_index] = pwaveform;
+            vdp->mp->segment_waveform[channel_index] = calloc(pwaveform->nelm, sizeof(int16_t));
+            vdp->mp->segment_read_waveform[channel_index] = calloc(pwaveform->nelm, sizeof(int16_t));
+            vdp->mp->segment_waveform_size = pwaveform->nelm;
+            if (!vdp->mp->segment_waveform[channel_index] || !vdp->mp->segment_read_waveform[channel_index]) {
+                vdp->mp->segment_waveform_size = 0;
+                errlogPrintf("%s: Segment waveform memory allocation failed\n", pwaveform->name);
+                return -1;
+            }
+            break;
+
+        case GET_SEGMENT_TIMESTAMPS:
+            vdp->mp->pSegmentTimestamps = pwaveform;
+            vdp->mp->segment_timestamps = calloc(pwaveform->nelm, sizeof(double));
+            // The timestamps record bounds the number of segments, size the bulk read arrays with it 
+            vdp->mp->segment_read_buffers = create_segment_read_buffers(pwaveform->nelm);
+            vdp->mp->segment_timestamps_size = pwaveform->nelm;
+            if (!vdp->mp->segment_timestamps || !vdp->mp->segment_read_buffers) {
+                vdp->mp->segment_timestamps_size = 0;
+                errlogPrintf("%s: Segment timestamps memory allocation failed\n", pwaveform->name);
+                return -1;
+            }
+            break;
+
         default:
             return 0;
     }
@@ -199,53 +237,128 @@ static long init_record_waveform(struct waveformRecord * pwaveform)
     return 0;
 }
 
+/**
+ * Provides the scan list for waveform records with SCAN set to I/O Intr. The acquisition thread 
+ * requests a scan of a channel's waveform when a frame is queued, and of the segment records 
+ * after a rapid block capture. 
+ */
+static long get_ioint_info_waveform(int cmd, struct waveformRecord *pwaveform, IOSCANPVT *ppvt) {
+    struct PicoscopeWaveformData *vdp = (struct PicoscopeWaveformData *)pwaveform->dpvt;
+    int channel_index;
+
+    if (!vdp || !vdp->mp) {
+        return -1;
+    }
+    switch (vdp->ioType) {
+        case UPDATE_WAVEFORM:
+            channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
+            *ppvt = vdp->mp->waveform_scan[channel_index];
+            break;
+
+        case UPDATE_SEGMENTS:
+        case GET_SEGMENT_TIMESTAMPS:
+            *ppvt = vdp->mp->segments_scan;
+            break;
+
+        default:
+            errlogPrintf("%s: I/O Intr not supported for %s\n", pwaveform->name, vdp->paramLabel);
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Starts the acquisition with a snapshot of the current settings. Runs on the writer thread 
+ * with the configuration store write lock held, so the snapshot is taken between writes. 
+ */
+static long start_acquisition(struct waveformRecord *pwaveform) {
+    struct PicoscopeWaveformData *vdp = (struct PicoscopeWaveformData *)pwaveform->dpvt;
+
+    printf("Start Retrieving\n");
+    if (vdp->mp->status == 0){
+        //when picoscope disconnected/OFF
+        fprintf(stderr, "Picoscope is disconnected/OFF\n");
+        return -1;
+    }
+    if (acquisition_state(vdp->mp) == ACQ_DRAINING) {
+        // A stop is still finishing, start once it has 
+        wait_acquisition_idle(vdp->mp);
+    }
+    if (acquisition_state(vdp->mp) != ACQ_IDLE) {
+        fprintf(stderr, "Data acquisition already started\n");
+        return -1;
+    }
+    publish_config(vdp->mp);
+    request_acquisition_start(vdp->mp);
+    return 0;
+}
+
 static long read_waveform(struct waveformRecord *pwaveform) {
     struct PicoscopeWaveformData *vdp = (struct PicoscopeWaveformData *)pwaveform->dpvt;
+    int channel_index;
+    uint64_t segment_samples;
+    size_t log_length;
 
     switch (vdp->ioType) {
         case START_RETRIEVE_WAVEFORM:
-            printf("Start Retrieving\n");
-            epicsMutexLock(vdp->mp->epics_acquisition_flag_mutex);
-            if (vdp->mp->status == 0){
-                //when picoscope disconnected/OFF
-                fprintf(stderr, "Picoscope is disconnected/OFF\n");
-                epicsMutexUnlock(vdp->mp->epics_acquisition_flag_mutex);
-                return -1;
+            // Queued like the output record writes, waiting for a stop to finish is not done 
+            // in record processing 
+            return write_async(vdp->mp, (struct dbCommon *)pwaveform, &vdp->async, 
+                               (long (*)(struct dbCommon *))start_acquisition);
+
+        case UPDATE_WAVEFORM:
+            channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
+            // Publish the newest queued frame by making it the record's buffer. The previous frame 
+            // has been posted to CA and is handed back, monitors read bptr under the record lock. 
+            struct Frame* frame = take_newest_frame(vdp->mp->frame_queue[channel_index]); 
+            if (!frame) {
+                break; 
             }
-            if (*vdp->mp->dataAcquisitionFlag == 1) {
-                fprintf(stderr, "Data acquisition already started\n");
-                epicsMutexUnlock(vdp->mp->epics_acquisition_flag_mutex);
-                return -1;
+            if (vdp->frame) {
+                release_frame(vdp->mp->frame_queue[channel_index], vdp->frame); 
             }
-            *vdp->mp->dataAcquisitionFlag = 1;
-            epicsMutexUnlock(vdp->mp->epics_acquisition_flag_mutex);
+            vdp->frame = frame; 
+            pwaveform->bptr = frame->data;
+            pwaveform->nord = frame->samples;
+            vdp->mp->waveform_config_version[channel_index] = frame->config_version;
+            break;
 
-            epicsEventSignal((epicsEventId)vdp->mp->acquisitionStartEvent);
+        case UPDATE_SEGMENTS:
+            channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
+            // Scanned after the capture, the next ps6000aGetValuesBulk may already be running 
+            epicsMutexLock(vdp->mp->epics_segment_mutex);
+            segment_samples = *vdp->mp->segments_collected * vdp->mp->sample_config.num_samples;
+            if (segment_samples > vdp->mp->segment_waveform_size){
+                segment_samples = vdp->mp->segment_waveform_size;
+            }
+            memcpy(pwaveform->bptr, vdp->mp->segment_waveform[channel_index], segment_samples * sizeof(int16_t));
+            pwaveform->nord = segment_samples;
+            epicsMutexUnlock(vdp->mp->epics_segment_mutex);
+            break;
 
+        case GET_SEGMENT_TIMESTAMPS:
+            epicsMutexLock(vdp->mp->epics_segment_mutex);
+            memcpy(pwaveform->bptr, vdp->mp->segment_timestamps, *vdp->mp->segments_collected * sizeof(double));
+            pwaveform->nord = *vdp->mp->segments_collected;
+            epicsMutexUnlock(vdp->mp->epics_segment_mutex);
             break;
 
-        case UPDATE_WAVEFORM:
-            int channel_index = find_channel_index_from_record(pwaveform->name, vdp->mp->channel_configs); 
-            epicsMutexLock(vdp->mp->epics_acquisition_flag_mutex);
-            if (*vdp->mp->dataAcquisitionFlag == 1) {
-                if (*vdp->mp->sample_collected > vdp->mp->waveform_size){
-                    *vdp->mp->sample_collected = vdp->mp->waveform_size;
-                }
-                memcpy(pwaveform->bptr, vdp->mp->waveform[channel_index], *vdp->mp->sample_collected * sizeof(int16_t));
-                pwaveform->nord = *vdp->mp->sample_collected;
-            }
-            epicsMutexUnlock(vdp->mp->epics_acquisition_flag_mutex);
+        case GET_LOG:
+            // Queued by log_message, bptr holds NELM characters 
+            epicsMutexLock(vdp->mp->log_lock);
+            log_length = strnlen(vdp->mp->log_text, pwaveform->nelm - 1);
+            memcpy(pwaveform->bptr, vdp->mp->log_text, log_length);
+            ((char *)pwaveform->bptr)[log_length] = '\0';
+            pwaveform->nord = log_length ? log_length + 1 : 0;   // Empty log PV when there is no message 
+            epicsMutexUnlock(vdp->mp->log_lock);
             break;
 
         case STOP_RETRIEVE_WAVEFORM:
-            if (*vdp->mp->dataAcquisitionFlag == 0 || vdp->mp->status == 0)
+            if (!acquisition_active(vdp->mp) || vdp->mp->status == 0)
             {
                 break;
             }
-            epicsMutexLock(vdp->mp->epics_acquisition_flag_mutex);
-            *vdp->mp->dataAcquisitionFlag = 0;
-            epicsMutexUnlock(vdp->mp->epics_acquisition_flag_mutex);
-    		epicsEventSignal(vdp->mp->triggerReadyEvent);
+            request_acquisition_stop(vdp->mp);
             break;
 
         default:
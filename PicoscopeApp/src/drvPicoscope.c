@@ -34,21 +34,229 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
 #include "ps6000aApi.h"
 #include "PicoStatus.h"
 #include <sys/time.h>
 #include <epicsExport.h>
 #include <iocsh.h>
 #include <dbAccess.h>
+#include <epicsAtomic.h>
 
 #include "drvPicoscope.h"
 #include "devPicoscopeCommon.h"
-#define MAX_PICO 10
-static PS6000AModule *PS6000AModuleList[MAX_PICO] = {NULL};
+#include "drvPicoscopeRecorder.h"
+#include "drvPicoscopePostMortem.h"
+#include "drvPicoscopeDataServer.h"
+#include "picoscopeShm.h"
+
+#define STREAM_POLL_MIN_SECS 0.00005    // Shortest wait between streaming polls 
+#define STREAM_POLL_MAX_SECS 0.1        // Longest wait between streaming polls 
+#define STREAM_POLLS_PER_BUFFER 4       // Target number of polls to fill one streaming buffer 
+#define SDK_STATS_SMOOTHING 0.1         // Weight of the newest command in the SDK queue time averages 
+#define CANCEL_CHECK_SECS 0.05          // Longest wait for a trigger between checks for a stop request 
+#define SDK_RETRY_MAX 20                // Attempts at an SDK call refused while the device is capturing 
+#define SDK_RETRY_DELAY_SECS 0.005      // Wait between those attempts 
+#define CAPTURE_TIMEOUT_MARGIN_SECS 1.0 // Allowed on top of the expected capture time before a capture times out 
+static ELLLIST PS6000AModuleList = ELLLIST_INIT;
+static char* timebase_cache_dir = NULL;     // Set by PS6000ATimebaseCacheDir 
 void log_error(char* function_name, uint32_t status, const char* FILE, int LINE){ 
     printf("Error in %s (file: %s, line: %d). Status code: 0x%08X\n", function_name, FILE, LINE, status);
 }
 
+// A caller waiting in the SDK queue, lives on the waiting thread's stack 
+struct SdkRequest {
+    ELLNODE node;
+    epicsThreadId thread;
+    enum SdkCommandType type;
+    epicsTimeStamp queued;
+    epicsEventId granted;
+};
+
+static epicsThreadOnceId sdk_waiter_once = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId sdk_waiter_event_id;
+
+static void sdk_waiter_init(void* arg){
+    sdk_waiter_event_id = epicsThreadPrivateCreate();
+}
+
+// Each thread that has waited in an SDK queue keeps one event to be woken with 
+static epicsEventId sdk_waiter_event(void){
+    epicsThreadOnce(&sdk_waiter_once, sdk_waiter_init, NULL);
+    epicsEventId event = (epicsEventId)epicsThreadPrivateGet(sdk_waiter_event_id);
+    if (!event) {
+        event = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadPrivateSet(sdk_waiter_event_id, event);
+    }
+    return event;
+}
+
+static void update_sdk_average(double* average_ms, double sample_secs, uint64_t commands){
+    double sample_ms = sample_secs * 1e3;
+    *average_ms = commands == 0 ? sample_ms : *average_ms + SDK_STATS_SMOOTHING * (sample_ms - *average_ms);
+}
+
+// Hands the device to a command, called with the queue lock held 
+static void start_sdk_command(struct SdkQueue* queue, epicsThreadId thread, enum SdkCommandType type, 
+                              const epicsTimeStamp* queued, const epicsTimeStamp* now){
+    struct SdkCommandStats* stats = &queue->stats[type];
+
+    queue->owner = thread;
+    queue->depth = 1;
+    queue->active_type = type;
+    queue->active_since = *now;
+    update_sdk_average(&stats->wait_ms, epicsTimeDiffInSeconds(now, queued), stats->commands);
+}
+
+/**
+ * Creates an idle SDK command queue. 
+ * 
+ * @return SdkQueue Pointer Returns the queue, or NULL if it could not be allocated. 
+ */
+struct SdkQueue* create_sdk_queue(void){
+    struct SdkQueue* queue = calloc(1, sizeof(struct SdkQueue));
+    if (!queue) {
+        return NULL;
+    }
+    queue->lock = epicsMutexCreate();
+    if (!queue->lock) {
+        free(queue);
+        return NULL;
+    }
+    for (size_t type = 0; type < NUM_SDK_COMMAND_TYPES; type++) {
+        ellInit(&queue->waiting[type]);
+    }
+    return queue;
+}
+
+// Frees an SDK command queue nothing is waiting on 
+void destroy_sdk_queue(struct SdkQueue* queue){
+    epicsMutexDestroy(queue->lock);
+    free(queue);
+}
+
+/**
+ * Queues for the Picoscope device and returns once this thread holds it. Must be paired with 
+ * sdk_release once the SDK call is done. Waiting commands are granted the device in the order 
+ * of enum SdkCommandType, first come first served within a type. 
+ * 
+ * @param mp   PS6000AModule Pointer to the PS6000AModule structure containing the SDK queue. 
+ *        type SdkCommandType The kind of SDK call about to be made. 
+ */
+void sdk_acquire(struct PS6000AModule* mp, enum SdkCommandType type){
+    struct SdkQueue* queue = mp->sdk_queue;
+    epicsThreadId self = epicsThreadGetIdSelf();
+    struct SdkRequest request;
+
+    epicsMutexLock(queue->lock);
+    if (queue->depth > 0 && queue->owner == self) {
+        queue->depth++;
+        epicsMutexUnlock(queue->lock);
+        return;
+    }
+    epicsTimeGetCurrent(&request.queued);
+    if (queue->depth == 0) {
+        // Nothing waits while the device is free 
+        start_sdk_command(queue, self, type, &request.queued, &request.queued);
+        epicsMutexUnlock(queue->lock);
+        return;
+    }
+    request.thread = self;
+    request.type = type;
+    request.granted = sdk_waiter_event();
+    ellAdd(&queue->waiting[type], &request.node);
+    epicsMutexUnlock(queue->lock);
+
+    epicsEventMustWait(request.granted);
+}
+
+/**
+ * Releases the Picoscope device and grants it to the highest priority waiting command. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the SDK queue. 
+ */
+void sdk_release(struct PS6000AModule* mp){
+    struct SdkQueue* queue = mp->sdk_queue;
+    epicsTimeStamp now;
+
+    epicsMutexLock(queue->lock);
+    if (--queue->depth > 0) {
+        epicsMutexUnlock(queue->lock);
+        return;
+    }
+    epicsTimeGetCurrent(&now);
+    struct SdkCommandStats* stats = &queue->stats[queue->active_type];
+    double service_secs = epicsTimeDiffInSeconds(&now, &queue->active_since);
+    update_sdk_average(&stats->service_ms, service_secs, stats->commands);
+    if (service_secs * 1e3 > stats->max_service_ms) {
+        stats->max_service_ms = service_secs * 1e3;
+    }
+    stats->commands++;
+
+    queue->owner = NULL;
+    for (size_t type = 0; type < NUM_SDK_COMMAND_TYPES; type++) {
+        struct SdkRequest* request = (struct SdkRequest*)ellGet(&queue->waiting[type]);
+        if (request) {
+            start_sdk_command(queue, request->thread, request->type, &request->queued, &now);
+            epicsEventSignal(request->granted);
+            break;
+        }
+    }
+    epicsMutexUnlock(queue->lock);
+}
+
+/**
+ * Creates an empty device cache. 
+ * 
+ * @return DeviceCache Pointer Returns the cache, or NULL if it could not be allocated. 
+ */
+struct DeviceCache* create_device_cache(void){
+    struct DeviceCache* cache = calloc(1, sizeof(struct DeviceCache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->lock = epicsMutexCreate();
+    if (!cache->lock) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+// Frees a device cache and the device information it holds 
+void destroy_device_cache(struct DeviceCache* cache){
+    free(cache->device_info);
+    epicsMutexDestroy(cache->lock);
+    free(cache);
+}
+
+/**
+ * Forgets all cached device state, the next read of each value goes to the device. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the device cache. 
+ */
+void invalidate_device_cache(struct PS6000AModule* mp){
+    struct DeviceCache* cache = mp->device_cache;
+
+    epicsMutexLock(cache->lock);
+    cache->resolution_valid = 0;
+    cache->adc_limits_valid = 0;
+    cache->num_offset_limits = 0;
+    free(cache->device_info);
+    cache->device_info = NULL;
+    epicsMutexUnlock(cache->lock);
+}
+
+/**
+ * Forgets the settings last sent to the device, the next setup sends all of them again. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the applied configuration. 
+ */
+static void invalidate_applied_config(struct PS6000AModule* mp){
+    mp->applied_config->trigger_valid = 0;
+    mp->applied_config->segments_valid = 0;
+}
+
 /**
  * Opens the Picoscope with specified serial number with the requested resolution. 
  * 
@@ -60,7 +268,9 @@ void log_error(char* function_name, uint32_t status, const char* FILE, int LINE)
 PICO_STATUS open_picoscope(struct PS6000AModule* mp, int16_t* handle){
 
     int16_t handle_buffer; 
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     PICO_STATUS status = ps6000aOpenUnit(&handle_buffer, (int8_t*) mp->serial_num, mp->resolution);
+    sdk_release(mp);
     if (status != PICO_OK) 
     { 
         mp->status = 0;
@@ -69,6 +279,12 @@ PICO_STATUS open_picoscope(struct PS6000AModule* mp, int16_t* handle){
     }
     mp->status = 1;
     *handle = handle_buffer;
+    invalidate_device_cache(mp);
+    invalidate_applied_config(mp);
+    // The device may have been updated or replaced with new firmware 
+    epicsMutexLock(mp->timebase_lut->lock);
+    mp->timebase_lut->loaded = 0;
+    epicsMutexUnlock(mp->timebase_lut->lock);
     return PICO_OK;
 }
 
@@ -94,9 +310,11 @@ PICO_STATUS close_picoscope(struct PS6000AModule* mp){
             return status;  
         }
     }
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     status = ps6000aCloseUnit(mp->handle);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
+    invalidate_device_cache(mp);
+    invalidate_applied_config(mp);
     if (status != PICO_OK) 
     { 
         mp->status = 0;
@@ -116,9 +334,9 @@ PICO_STATUS close_picoscope(struct PS6000AModule* mp){
  * @return   PICO_STATUS Return 0 if device is connect, otherwise a non-zero error code.
 */
 PICO_STATUS ping_picoscope(struct PS6000AModule* mp){ 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_HEALTH);
     PICO_STATUS status = ps6000aPingUnit(mp->handle);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
     
     // If driver call in progress, return connected. 
     if (status == PICO_DRIVER_FUNCTION) {
@@ -147,15 +365,26 @@ PICO_STATUS ping_picoscope(struct PS6000AModule* mp){
  * @return           PICO_STATUS Return 0 if resolution successfully set, otherwise a non-zero error code.
 */
 PICO_STATUS set_resolution(struct PS6000AModule* mp, int16_t resolution){ 
+    struct DeviceCache* cache = mp->device_cache;
    
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    epicsMutexLock(cache->lock);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     PICO_STATUS status = ps6000aSetDeviceResolution(mp->handle, resolution); 
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
+    // Samples per segment depend on the resolution 
+    mp->applied_config->segments_valid = 0;
     
     if (status != PICO_OK){ 
+        cache->resolution_valid = 0;
+        cache->adc_limits_valid = 0;
+        epicsMutexUnlock(cache->lock);
         log_error("ps6000aSetDeviceResolution", status, __FILE__, __LINE__);
         return status;
     }
+    cache->resolution = resolution;
+    cache->resolution_valid = 1;
+    cache->adc_limits_valid = 0;
+    epicsMutexUnlock(cache->lock);
 
     return PICO_OK; 
 }
@@ -169,17 +398,31 @@ PICO_STATUS set_resolution(struct PS6000AModule* mp, int16_t resolution){
  * @return           PICO_STATUS Return 0 if resolution returned, otherwise a non-zero error code.
 */
 PICO_STATUS get_resolution(struct PS6000AModule* mp, int16_t* resolution) {
-
+    struct DeviceCache* cache = mp->device_cache;
     PICO_DEVICE_RESOLUTION device_resolution; 
     
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    epicsMutexLock(cache->lock);
+    if (cache->resolution_valid) {
+        cache->hits++;
+        *resolution = cache->resolution;
+        epicsMutexUnlock(cache->lock);
+        return PICO_OK;
+    }
+    cache->misses++;
+
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     PICO_STATUS status = ps6000aGetDeviceResolution(mp->handle, &device_resolution); 
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
     
     if(status != PICO_OK) {
+        epicsMutexUnlock(cache->lock);
         log_error("ps6000aGetDeviceResolution", status, __FILE__, __LINE__);
         return status;
     }
+    cache->resolution = (int16_t)device_resolution;
+    cache->resolution_valid = 1;
+    epicsMutexUnlock(cache->lock);
+
     *resolution = (int16_t)device_resolution; 
     return PICO_OK; 
 }
@@ -197,9 +440,9 @@ PICO_STATUS get_serial_num(struct PS6000AModule* mp, int8_t** serial_num) {
 
     int16_t required_size = 0; 
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_HEALTH);
     PICO_STATUS status = ps6000aGetUnitInfo(mp->handle, NULL, 0, &required_size, PICO_BATCH_AND_SERIAL);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aGetUnitInfo", status, __FILE__, __LINE__);
@@ -208,9 +451,9 @@ PICO_STATUS get_serial_num(struct PS6000AModule* mp, int8_t** serial_num) {
 
     int8_t* serial_num_buffer = calloc(required_size, sizeof(int8_t)); 
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_HEALTH);
     status = ps6000aGetUnitInfo(mp->handle, serial_num_buffer, required_size, &required_size, PICO_BATCH_AND_SERIAL);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aGetUnitInfo", status, __FILE__, __LINE__);
@@ -237,9 +480,9 @@ PICO_STATUS get_model_num(struct PS6000AModule* mp, int8_t** model_num) {
 
     int16_t required_size = 0; 
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_HEALTH);
     PICO_STATUS status = ps6000aGetUnitInfo(mp->handle, NULL, 0, &required_size, PICO_VARIANT_INFO);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aGetUnitInfo", status, __FILE__, __LINE__);
@@ -249,9 +492,9 @@ PICO_STATUS get_model_num(struct PS6000AModule* mp, int8_t** model_num) {
     int8_t* model_num_buffer = calloc(required_size, sizeof(int8_t));
 
     
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_HEALTH);
     status = ps6000aGetUnitInfo(mp->handle, model_num_buffer, required_size, &required_size, PICO_VARIANT_INFO);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aGetUnitInfo", status, __FILE__, __LINE__);
@@ -275,10 +518,19 @@ PICO_STATUS get_model_num(struct PS6000AModule* mp, int8_t** model_num) {
  * @return            PICO_STATUS Returns 0 if the device information is successfully retrieved, otherwise a non-zero error code.
  */
 PICO_STATUS get_device_info(struct PS6000AModule* mp, int8_t** device_info) {
-
+    struct DeviceCache* cache = mp->device_cache;
     int8_t* serial_num = NULL;
     int8_t* model_num = NULL; 
 
+    epicsMutexLock(cache->lock);
+    if (cache->device_info) {
+        cache->hits++;
+        *device_info = (int8_t*)strdup(cache->device_info);
+        epicsMutexUnlock(cache->lock);
+        return *device_info ? PICO_OK : PICO_MEMORY_FAIL;
+    }
+    cache->misses++;
+
     PICO_STATUS status = get_serial_num(mp, &serial_num);
     if (status == PICO_OK) {
         status = get_model_num(mp, &model_num); 
@@ -289,8 +541,10 @@ PICO_STATUS get_device_info(struct PS6000AModule* mp, int8_t** device_info) {
             int8_t* device_info_buffer = malloc(required_size);
             snprintf((char*)device_info_buffer, required_size, FORMAT_STR, model_num, serial_num);
             *device_info = device_info_buffer;
+            cache->device_info = strdup((char*)device_info_buffer);
         }
     }
+    epicsMutexUnlock(cache->lock);
 
     free(serial_num); 
     free(model_num);
@@ -313,9 +567,9 @@ PICO_STATUS get_device_info(struct PS6000AModule* mp, int8_t** device_info) {
 */
 PICO_STATUS set_channel_on(struct PS6000AModule* mp, struct ChannelConfigs channel, EnabledChannelFlags* channel_status) {
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     uint32_t status = ps6000aSetChannelOn(mp->handle, channel.channel, channel.coupling, channel.range, channel.analog_offset, channel.bandwidth);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
     if (status != PICO_OK) 
     {
         log_error("ps6000aSetChannelOn", status, __FILE__, __LINE__);
@@ -363,9 +617,9 @@ PICO_STATUS set_channel_on(struct PS6000AModule* mp, struct ChannelConfigs chann
 */
 PICO_STATUS set_channel_off(struct PS6000AModule* mp, int channel, EnabledChannelFlags* channel_status) {
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     uint32_t status = ps6000aSetChannelOff(mp->handle, channel);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
 
     if (status != PICO_OK)
     {
@@ -436,18 +690,41 @@ uint32_t get_channel_status(int16_t channel, EnabledChannelFlags channel_status)
  * @return                  PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
  */
 PICO_STATUS get_analog_offset_limits(struct PS6000AModule* mp, struct ChannelConfigs channel, double* max_analog_offset, double* min_analog_offset){
-
+    struct DeviceCache* cache = mp->device_cache;
     double maximum_voltage; 
     double minimum_voltage;
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    // The limits only depend on the model, so they are kept for each (range, coupling) until the device is reopened 
+    epicsMutexLock(cache->lock);
+    for (size_t i = 0; i < cache->num_offset_limits; i++) {
+        struct AnalogOffsetLimits* limits = &cache->offset_limits[i];
+        if (limits->range == channel.range && limits->coupling == channel.coupling) {
+            cache->hits++;
+            *max_analog_offset = limits->max_analog_offset;
+            *min_analog_offset = limits->min_analog_offset;
+            epicsMutexUnlock(cache->lock);
+            return PICO_OK;
+        }
+    }
+    cache->misses++;
+
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     PICO_STATUS status = ps6000aGetAnalogueOffsetLimits(mp->handle, channel.range, channel.coupling, &maximum_voltage, &minimum_voltage); 
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
     if (status != PICO_OK)
     {
+        epicsMutexUnlock(cache->lock);
         log_error("ps6000aGetAnalogueOffsetLimits", status, __FILE__, __LINE__);
         return status;
     }
+    if (cache->num_offset_limits < OFFSET_LIMITS_CACHE_SIZE) {
+        struct AnalogOffsetLimits* limits = &cache->offset_limits[cache->num_offset_limits++];
+        limits->range = channel.range;
+        limits->coupling = channel.coupling;
+        limits->max_analog_offset = maximum_voltage;
+        limits->min_analog_offset = minimum_voltage;
+    }
+    epicsMutexUnlock(cache->lock);
 
     *max_analog_offset = maximum_voltage;
     *min_analog_offset = minimum_voltage;
@@ -455,9 +732,268 @@ PICO_STATUS get_analog_offset_limits(struct PS6000AModule* mp, struct ChannelCon
     return PICO_OK; 
 }
 
+/**
+ * Allocates the timebase lookup table of a module. If a cache directory has been set the tables 
+ * are saved to, and loaded from, a file in it named after the serial number. 
+ * 
+ * @param serial_num char Pointer Serial number of the module. 
+ * 
+ * @return           Pointer to the new TimebaseLut, or NULL on allocation failure. 
+ */
+struct TimebaseLut* create_timebase_lut(const char* serial_num){
+    struct TimebaseLut* lut = calloc(1, sizeof(struct TimebaseLut));
+    if (!lut) {
+        return NULL;
+    }
+    lut->lock = epicsMutexCreate();
+    if (!lut->lock) {
+        free(lut);
+        return NULL;
+    }
+    if (timebase_cache_dir) {
+        size_t length = strlen(timebase_cache_dir) + strlen(serial_num) + sizeof("/.timebase");
+        lut->cache_path = malloc(length);
+        if (lut->cache_path) {
+            // Serial numbers contain '/', which cannot be used in a file name 
+            char* name = lut->cache_path + snprintf(lut->cache_path, length, "%s/", timebase_cache_dir);
+            snprintf(name, length - (name - lut->cache_path), "%s.timebase", serial_num);
+            for (; *name; name++) {
+                if (*name == '/') {
+                    *name = '_';
+                }
+            }
+        }
+    }
+    return lut;
+}
+
+// Frees a timebase lookup table, the cache file is left as it is 
+void destroy_timebase_lut(struct TimebaseLut* lut){
+    free(lut->cache_path);
+    epicsMutexDestroy(lut->lock);
+    free(lut);
+}
+
+/**
+ * Reads the driver and firmware versions of the open device, which decide the timebases it 
+ * offers. The version is left empty if any of them cannot be read. 
+ * 
+ * @param mp      PS6000AModule Pointer to the PS6000AModule structure. 
+ * @param version char Pointer On exit, the versions separated by ';'. 
+ * @param size    size_t Size of the version buffer. 
+ */
+static void get_timebase_lut_version(struct PS6000AModule* mp, char* version, size_t size){
+    const PICO_INFO infos[] = { PICO_DRIVER_VERSION, PICO_FIRMWARE_VERSION_1, PICO_FIRMWARE_VERSION_2 };
+    size_t length = 0;
+
+    version[0] = '\0';
+    for (size_t i = 0; i < sizeof(infos) / sizeof(infos[0]); i++) {
+        int8_t info[TIMEBASE_LUT_VERSION_LENGTH / 2];
+        int16_t required_size = 0;
+        sdk_acquire(mp, SDK_CMD_CONFIG);
+        PICO_STATUS status = ps6000aGetUnitInfo(mp->handle, info, sizeof(info), &required_size, infos[i]);
+        sdk_release(mp);
+        if (status != PICO_OK) {
+            log_error("ps6000aGetUnitInfo", status, __FILE__, __LINE__);
+            version[0] = '\0';
+            return;
+        }
+        info[sizeof(info) - 1] = '\0';
+        int written = snprintf(version + length, size - length, "%s%s", i ? ";" : "", (char*)info);
+        if (written < 0 || (size_t)written >= size - length) {
+            version[0] = '\0';
+            return;
+        }
+        length += written;
+    }
+    // The version is stored as one line of the cache file 
+    for (char* c = version; *c; c++) {
+        if (*c == '\n' || *c == '\r') {
+            *c = ' ';
+        }
+    }
+}
+
+/**
+ * Reads previously built timebase tables from the cache file. A file written for other driver or 
+ * firmware versions is ignored, it is replaced once a table is built. A missing or malformed file 
+ * leaves the tables that were read so far, the rest are built again from the device. 
+ * 
+ * @param lut TimebaseLut Pointer to the lookup table, with its lock held. 
+ */
+static void load_timebase_lut(struct TimebaseLut* lut){
+    FILE* file = fopen(lut->cache_path, "r");
+    if (!file) {
+        return;
+    }
+    int version = 0;
+    char device_version[TIMEBASE_LUT_VERSION_LENGTH];
+    if (fscanf(file, "ps6000a-timebase %d ", &version) != 1 || version != 2 ||
+        !fgets(device_version, sizeof(device_version), file)) {
+        fclose(file);
+        return;
+    }
+    device_version[strcspn(device_version, "\n")] = '\0';
+    if (strcmp(device_version, lut->version) != 0) {
+        printf("Timebase cache %s was built for %s, rebuilding\n", lut->cache_path, device_version);
+        fclose(file);
+        return;
+    }
+    while (lut->num_tables < TIMEBASE_LUT_MAX_TABLES) {
+        struct TimebaseTable* table = &lut->tables[lut->num_tables];
+        unsigned int mask;
+        short resolution;
+        size_t num_entries;
+        if (fscanf(file, "%x %hd %lg %zu", &mask, &resolution, &table->step, &num_entries) != 4 ||
+            num_entries == 0 || num_entries > TIMEBASE_TABLE_MAX_ENTRIES) {
+            break;
+        }
+        size_t i;
+        for (i = 0; i < num_entries; i++) {
+            if (fscanf(file, "%u %lg", &table->entries[i].timebase, &table->entries[i].interval) != 2) {
+                break;
+            }
+        }
+        if (i != num_entries) {
+            break;
+        }
+        table->channel_mask = mask;
+        table->resolution = resolution;
+        table->num_entries = num_entries;
+        lut->num_tables++;
+    }
+    fclose(file);
+}
+
+/**
+ * Writes all timebase tables to the cache file. The file is written beside the cache file and 
+ * renamed over it, so a crash never leaves a partial cache. 
+ * 
+ * @param lut TimebaseLut Pointer to the lookup table, with its lock held. 
+ */
+static void save_timebase_lut(struct TimebaseLut* lut){
+    char temp_path[PATH_MAX];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", lut->cache_path) >= (int)sizeof(temp_path)) {
+        return;
+    }
+    FILE* file = fopen(temp_path, "w");
+    if (!file) {
+        printf("Cannot write timebase cache %s: %s\n", temp_path, strerror(errno));
+        return;
+    }
+    fprintf(file, "ps6000a-timebase 2\n%s\n", lut->version);
+    for (size_t t = 0; t < lut->num_tables; t++) {
+        struct TimebaseTable* table = &lut->tables[t];
+        fprintf(file, "%x %hd %.17g %zu\n", table->channel_mask, table->resolution, table->step, table->num_entries);
+        for (size_t i = 0; i < table->num_entries; i++) {
+            fprintf(file, "%u %.17g\n", table->entries[i].timebase, table->entries[i].interval);
+        }
+    }
+    if (fclose(file) != 0 || rename(temp_path, lut->cache_path) != 0) {
+        printf("Cannot write timebase cache %s: %s\n", lut->cache_path, strerror(errno));
+        remove(temp_path);
+    }
+}
+
+/**
+ * Builds the timebase table of one (channel mask, resolution) pair from the device. Starting at 
+ * the fastest timebase, the interval is doubled until the returned timebases are no longer 
+ * consecutive. The intervals are then in the linear region, where every timebase adds the same step. 
+ * If the table fills, or the device stops returning faster timebases first, the step is taken 
+ * from the last two entries. Only the minimum timebase query is treated as an error, a failed 
+ * interval query ends the table. 
+ * 
+ * @param mp           PS6000AModule Pointer to the PS6000AModule structure. 
+ * @param channel_mask uint32_t Enabled channel flags the table is for. 
+ * @param resolution   int16_t Device resolution the table is for. 
+ * @param table        TimebaseTable Pointer On exit, the table. 
+ * 
+ * @return             PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+static PICO_STATUS build_timebase_table(struct PS6000AModule* mp, uint32_t channel_mask, int16_t resolution, struct TimebaseTable* table){
+    uint32_t timebase;
+    double interval;
+
+    table->channel_mask = channel_mask;
+    table->resolution = resolution;
+    table->num_entries = 0;
+    table->step = 0;
+
+    sdk_acquire(mp, SDK_CMD_CONFIG);
+    PICO_STATUS status = ps6000aGetMinimumTimebaseStateless(mp->handle, channel_mask, &timebase, &interval, resolution);
+    if (status != PICO_OK) {
+        sdk_release(mp);
+        return status;
+    }
+    table->entries[table->num_entries++] = (struct TimebaseEntry){ timebase, interval };
+
+    while (table->num_entries < TIMEBASE_TABLE_MAX_ENTRIES) {
+        struct TimebaseEntry last = table->entries[table->num_entries - 1];
+        if (ps6000aNearestSampleIntervalStateless(mp->handle, channel_mask, last.interval * 2, resolution, &timebase, &interval) != PICO_OK ||
+            timebase <= last.timebase) {
+            break;
+        }
+        if (timebase != last.timebase + 1) {
+            table->step = (interval - last.interval) / (timebase - last.timebase);
+            break;
+        }
+        table->entries[table->num_entries++] = (struct TimebaseEntry){ timebase, interval };
+    }
+    sdk_release(mp);
+
+    // Listed entries are consecutive timebases 
+    if (table->step <= 0 && table->num_entries > 1) {
+        table->step = table->entries[table->num_entries - 1].interval - table->entries[table->num_entries - 2].interval;
+    }
+
+    return PICO_OK;
+}
+
+/**
+ * Finds the timebase with the sample interval closest to the requested interval. Listed timebases 
+ * are binary searched, beyond them the timebase is calculated from the linear step. 
+ * 
+ * @param table     TimebaseTable Pointer to the table to search. 
+ * @param requested double The requested sample interval in seconds. 
+ * @param timebase  uint32_t Pointer On exit, the closest timebase. 
+ * @param interval  double Pointer On exit, the sample interval of that timebase. 
+ */
+static void lookup_timebase(const struct TimebaseTable* table, double requested, uint32_t* timebase, double* interval){
+    const struct TimebaseEntry* entries = table->entries;
+    size_t last = table->num_entries - 1;
+
+    if (table->step > 0 && requested > entries[last].interval) {
+        double steps = floor((requested - entries[last].interval) / table->step + 0.5);
+        if (steps > UINT32_MAX - entries[last].timebase) {
+            steps = UINT32_MAX - entries[last].timebase;
+        }
+        *timebase = entries[last].timebase + (uint32_t)steps;
+        *interval = entries[last].interval + steps * table->step;
+        return;
+    }
+
+    // First entry at least as slow as the request, or the slowest listed entry 
+    size_t low = 0, high = last;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (entries[mid].interval < requested) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low > 0 && requested - entries[low - 1].interval < entries[low].interval - requested) {
+        low--;
+    }
+    *timebase = entries[low].timebase;
+    *interval = entries[low].interval;
+}
+
 /**
  * Uses a requested sample interval to determine the closest timebase and sample interval that can 
  * be applied to the connected Picoscope given the resolution and number of channels enabled. 
+ * The timebase is looked up in the module's timebase table, which is only built from the device 
+ * the first time a channel mask and resolution are used. 
  * 
  * @param mp                      PS6000AModule Pointer to the PS6000AModule structure.
  * @param requested_time_interval double The requested sample interval in seconds. 
@@ -485,20 +1021,55 @@ PICO_STATUS validate_sample_interval(
 
     uint32_t timebase_return; 
     double time_interval_available;
-
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    status = ps6000aNearestSampleIntervalStateless(mp->handle, enabledChannels, requested_time_interval, resolution, &timebase_return, &time_interval_available); 
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
-    
-    if (status == PICO_NO_CHANNELS_OR_PORTS_ENABLED) {
-        log_error("ps6000aNearestSampleIntervalStateless. No channels enabled.", status, __FILE__, __LINE__);
-        return status;
+    struct TimebaseLut* lut = mp->timebase_lut;
+    struct TimebaseTable* table = NULL;
+
+    epicsMutexLock(lut->lock);
+    if (!lut->loaded) {
+        char version[TIMEBASE_LUT_VERSION_LENGTH];
+        get_timebase_lut_version(mp, version, sizeof(version));
+        // Other driver or firmware versions may offer other timebases 
+        if (strcmp(version, lut->version) != 0 || !version[0]) {
+            lut->num_tables = 0;
+            strcpy(lut->version, version);
+            if (lut->cache_path && version[0]) {
+                load_timebase_lut(lut);
+            }
+        }
+        lut->loaded = 1;
     }
-    if (status != PICO_OK)
-    {
-        log_error("ps6000aNearestSampleIntervalStateless", status, __FILE__, __LINE__);
-        return status;
+    for (size_t i = 0; i < lut->num_tables; i++) {
+        if (lut->tables[i].channel_mask == enabledChannels && lut->tables[i].resolution == resolution) {
+            table = &lut->tables[i];
+            break;
+        }
+    }
+    if (!table) {
+        struct TimebaseTable built;
+        status = build_timebase_table(mp, enabledChannels, resolution, &built);
+        if (status == PICO_NO_CHANNELS_OR_PORTS_ENABLED) {
+            epicsMutexUnlock(lut->lock);
+            log_error("ps6000aGetMinimumTimebaseStateless. No channels enabled.", status, __FILE__, __LINE__);
+            return status;
+        }
+        if (status != PICO_OK)
+        {
+            epicsMutexUnlock(lut->lock);
+            log_error("ps6000aGetMinimumTimebaseStateless", status, __FILE__, __LINE__);
+            return status;
+        }
+        if (lut->num_tables < TIMEBASE_LUT_MAX_TABLES) {
+            table = &lut->tables[lut->num_tables++];
+            *table = built;
+            if (lut->cache_path && lut->version[0]) {
+                save_timebase_lut(lut);
+            }
+        } else {
+            table = &built;
+        }
     }
+    lookup_timebase(table, requested_time_interval, &timebase_return, &time_interval_available);
+    epicsMutexUnlock(lut->lock);
 
     *timebase = timebase_return;
     *available_time_interval = time_interval_available; 
@@ -704,21 +1275,37 @@ PICO_STATUS calculate_scaled_value(struct PS6000AModule* mp, double volts, int16
  * @return        PICO_STATUS PICO_OK if successful, other a non-zero status code. 
  * */
 PICO_STATUS get_adc_limits(struct PS6000AModule* mp, int16_t* min_val, int16_t* max_val){ 
-
+    struct DeviceCache* cache = mp->device_cache;
     int16_t min, max, resolution;
 
+    epicsMutexLock(cache->lock);
+    if (cache->adc_limits_valid) {
+        cache->hits++;
+        *min_val = cache->adc_min;
+        *max_val = cache->adc_max;
+        epicsMutexUnlock(cache->lock);
+        return PICO_OK;
+    }
+    cache->misses++;
+
     uint32_t status = get_resolution(mp, &resolution); 
     if (status != PICO_OK) {
+        epicsMutexUnlock(cache->lock);
         return status; 
     }
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
     status = ps6000aGetAdcLimits(mp->handle, resolution, &min, &max);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
     if (status != PICO_OK){ 
+        epicsMutexUnlock(cache->lock);
         log_error("ps6000aGetAdcLimits", status, __FILE__, __LINE__); 
         return status; 
     }
+    cache->adc_min = min;
+    cache->adc_max = max;
+    cache->adc_limits_valid = 1;
+    epicsMutexUnlock(cache->lock);
 
     *min_val = min; 
     *max_val = max; 
@@ -728,24 +1315,30 @@ PICO_STATUS get_adc_limits(struct PS6000AModule* mp, int16_t* min_val, int16_t*
 
 
 
-typedef struct {
-    PICO_STATUS callbackStatus; // Status from the callback
-    int dataReady;
-    struct PS6000AModule* mp;
-} BlockReadyCallbackParams;
 PICO_STATUS setup_picoscope(struct PS6000AModule* mp);
 PICO_STATUS init_block_ready_callback_params(struct PS6000AModule* mp);
 PICO_STATUS run_block_capture(struct PS6000AModule* mp, double* time_indisposed_ms);
 PICO_STATUS set_data_buffer(struct PS6000AModule* mp);
 PICO_STATUS apply_trigger_configurations(struct PS6000AModule* mp);
+PICO_STATUS apply_config_update(struct PS6000AModule* mp);
 PICO_STATUS start_block_capture(struct PS6000AModule* mp, double* time_indisposed_ms);
 PICO_STATUS wait_for_capture_completion(struct PS6000AModule* mp);
 PICO_STATUS retrieve_waveform_data(struct PS6000AModule* mp);
 PICO_STATUS update_trigger_timing_info(struct PS6000AModule* mp, uint64_t segment_index);
-void free_subwaveforms(struct PS6000AModule* mp, uint16_t subwaveform_num);
-
+PICO_STATUS configure_memory_segments(struct PS6000AModule* mp);
+PICO_STATUS retrieve_segment_data(struct PS6000AModule* mp);
+double calculate_trigger_freqency(double sample_interval_secs, uint64_t prev_time_stamp, uint64_t cur_time_stamp, uint64_t missed_triggers);
+PICO_STATUS reserve_buffer_pool(struct PS6000AModule* mp);
+PICO_STATUS fit_frame(struct PS6000AModule* mp, struct Frame* frame);
+bool do_Blocking(struct PS6000AModule* mp);
+bool do_Rapid_Block(struct PS6000AModule* mp);
+bool do_Double_Buffered_Block(struct PS6000AModule* mp);
+int16_t* acquisition_buffer(struct PS6000AModule* mp, size_t channel_index);
+int16_t* filled_buffer(struct PS6000AModule* mp, size_t channel_index);
+void publish_frame(struct PS6000AModule* mp, size_t channel_index, uint64_t samples);
+PICO_STATUS register_block_buffers(struct PS6000AModule* mp, uint64_t segment_index);
+void request_waveform_scans(struct PS6000AModule* mp);
 
-BlockReadyCallbackParams* blockReadyCallbackParams;
 
 /**
  * Configures the data buffer for the specified channel on the Picoscope device.
@@ -760,25 +1353,21 @@ PICO_STATUS setup_picoscope(struct PS6000AModule* mp) {
         return status;
     }
 
-    if (mp->trigger_config.triggerType == NO_TRIGGER) {
-        // If no trigger set, clear previous triggers and do not set new one 
-        PICO_CONDITION condition;
-        epicsMutexLock(mp->epics_ps6000a_call_mutex);
-        status = ps6000aSetTriggerChannelConditions(mp->handle, &condition, 0, PICO_CLEAR_ALL);   
-        epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    status = apply_trigger_configurations(mp);
+    if (status != PICO_OK) {
+        log_error("apply_trigger_configurations", status, __FILE__, __LINE__);
+        return status;
+    }
 
-        if (status != PICO_OK) {
-            log_error("ps6000aSetTriggerChannelConditions", status, __FILE__, __LINE__);
-            return status;
-        }        
-    } 
-    else { 
-        status = apply_trigger_configurations(mp);
+    status = configure_memory_segments(mp);
+    if (status != PICO_OK) {
+        return status;
+    }
 
-        if (status != PICO_OK) {
-            log_error("apply_trigger_configurations", status, __FILE__, __LINE__);
-            return status;
-        }
+    status = reserve_buffer_pool(mp);
+    if (status != PICO_OK) {
+        log_error("reserve_buffer_pool", status, __FILE__, __LINE__);
+        return status;
     }
 
     status = set_data_buffer(mp);
@@ -789,24 +1378,95 @@ PICO_STATUS setup_picoscope(struct PS6000AModule* mp) {
     return status;
 }
 
+/**
+ * Splits the device memory into the number of segments required for the capture and sets the 
+ * number of captures taken per ps6000aRunBlock. Segments are left on the device between captures, 
+ * so a single segment is configured again when rapid block mode is not in use. Double buffered 
+ * block captures alternate between two segments, one capture each. The device is only 
+ * reconfigured when the segments, captures or enabled channels changed since the last setup. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing data acquisition settings. 
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+PICO_STATUS configure_memory_segments(struct PS6000AModule* mp) {
+    uint64_t num_segments = do_Rapid_Block(mp) ? mp->sample_config.num_segments : 1;
+    uint64_t num_captures = num_segments;
+    uint64_t max_samples_per_segment = 0;
+    uint32_t channel_mask = *(uint32_t*)&mp->channel_status;
+    struct AppliedConfig* applied = mp->applied_config;
+
+    if (do_Double_Buffered_Block(mp)) {
+        num_segments = 2;
+    }
+
+    if (num_segments > 1 && 
+        (num_segments > mp->segment_timestamps_size || 
+         num_segments * mp->sample_config.num_samples > mp->segment_waveform_size)) {
+        log_error("configure_memory_segments. Segments do not fit in segment waveform.", PICO_TOO_MANY_SEGMENTS, __FILE__, __LINE__);
+        return PICO_TOO_MANY_SEGMENTS;
+    }
+
+    if (applied->segments_valid && 
+        applied->num_segments == num_segments && 
+        applied->num_captures == num_captures && 
+        applied->channel_mask == channel_mask) {
+        if (mp->sample_config.num_samples > applied->max_samples_per_segment) {
+            log_error("ps6000aMemorySegments. Not enough memory per segment.", PICO_TOO_MANY_SEGMENTS, __FILE__, __LINE__);
+            return PICO_TOO_MANY_SEGMENTS;
+        }
+        return PICO_OK;
+    }
+    applied->segments_valid = 0;
+
+    sdk_acquire(mp, SDK_CMD_CONFIG);
+    PICO_STATUS status = ps6000aMemorySegments(mp->handle, num_segments, &max_samples_per_segment);
+    sdk_release(mp);
+    if (status != PICO_OK) {
+        log_error("ps6000aMemorySegments", status, __FILE__, __LINE__);
+        return status;
+    }
+
+    if (mp->sample_config.num_samples > max_samples_per_segment) {
+        log_error("ps6000aMemorySegments. Not enough memory per segment.", PICO_TOO_MANY_SEGMENTS, __FILE__, __LINE__);
+        return PICO_TOO_MANY_SEGMENTS;
+    }
+
+    sdk_acquire(mp, SDK_CMD_CONFIG);
+    status = ps6000aSetNoOfCaptures(mp->handle, num_captures);
+    sdk_release(mp);
+    if (status != PICO_OK) {
+        log_error("ps6000aSetNoOfCaptures", status, __FILE__, __LINE__);
+        return status;
+    }
+
+    applied->num_segments = num_segments;
+    applied->num_captures = num_captures;
+    applied->channel_mask = channel_mask;
+    applied->max_samples_per_segment = max_samples_per_segment;
+    applied->segments_valid = 1;
+
+    return PICO_OK;
+}
+
 
 /**
- * Apply the trigger condition configurations.
+ * Apply the trigger condition configurations. The previous conditions are replaced in one call, 
+ * with no trigger set the conditions are only cleared. 
  * @param mp PS6000AModule Pointer to the PS6000AModule structure containing Picoscope trigger configurations. 
  * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
  */
 PICO_STATUS set_trigger_conditions(struct PS6000AModule* mp) {
-    int16_t nConditions = 1;
+    int16_t nConditions = mp->trigger_config.triggerType == NO_TRIGGER ? 0 : 1;
     PICO_STATUS status = 0;
 
     PICO_CONDITION condition = {
         .source = mp->trigger_config.channel,
         .condition = PICO_CONDITION_TRUE
     };
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    ps6000aSetTriggerChannelConditions(mp->handle, &condition, nConditions, PICO_CLEAR_ALL);
-    ps6000aSetTriggerChannelConditions(mp->handle, &condition, nConditions, PICO_ADD);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
+    status = ps6000aSetTriggerChannelConditions(mp->handle, &condition, nConditions, 
+                                                nConditions ? PICO_CLEAR_ALL | PICO_ADD : PICO_CLEAR_ALL);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aSetTriggerChannelConditions", status, __FILE__, __LINE__);
@@ -832,9 +1492,9 @@ PICO_STATUS set_trigger_directions(struct PS6000AModule* mp) {
         .direction = mp->trigger_config.thresholdDirection,
         .thresholdMode = mp->trigger_config.thresholdMode
     };
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    ps6000aSetTriggerChannelDirections(mp->handle, &direction, nDirections);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
+    status = ps6000aSetTriggerChannelDirections(mp->handle, &direction, nDirections);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aSetTriggerChannelDirections", status, __FILE__, __LINE__);
@@ -861,9 +1521,10 @@ PICO_STATUS set_trigger_properties(struct PS6000AModule* mp) {
         .thresholdLower = mp->trigger_config.thresholdLower,
         .thresholdLowerHysteresis = hysteresis_lower
     };
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    PICO_STATUS status = ps6000aSetTriggerChannelProperties(mp->handle, &channelProperty, nChannelProperties, 0, 0);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_acquire(mp, SDK_CMD_CONFIG);
+    PICO_STATUS status = ps6000aSetTriggerChannelProperties(mp->handle, &channelProperty, nChannelProperties, 0, 
+                                                            mp->trigger_config.autoTriggerMicroSeconds);
+    sdk_release(mp);
 
     if (status != PICO_OK) {
         log_error("ps6000aSetTriggerChannelProperties", status, __FILE__, __LINE__);
@@ -874,27 +1535,211 @@ PICO_STATUS set_trigger_properties(struct PS6000AModule* mp) {
 }
 
 /**
- * Apply the trigger configurations.
+ * Apply the trigger configurations. Compared with the configuration last applied, only the 
+ * conditions, directions or properties whose inputs changed are sent to the device. 
  * @param mp PS6000AModule Pointer to the PS6000AModule structure containing Picoscope trigger configurations. 
  * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
  */
 PICO_STATUS apply_trigger_configurations(struct PS6000AModule* mp) {
     PICO_STATUS status;
-    printf("Trigger channel %d\n", mp->trigger_config.channel);
-    printf("Trigger type %d\n", mp->trigger_config.triggerType);
-    printf("Trigger direction %d, Trigger mode %d\n", mp->trigger_config.thresholdDirection, mp->trigger_config.thresholdMode);
-    printf("Trigger Upper Threshold %d, Trigger Lower Threshold %d\n", mp->trigger_config.thresholdUpper, mp->trigger_config.thresholdLower);
-    printf("Trigger Upper Hysteresis %d, Trigger Lower Hysteresis %d\n", mp->trigger_config.thresholdUpperHysteresis, mp->trigger_config.thresholdLowerHysteresis);
-    printf("Trigger Position Ratio %f\n", mp->sample_config.trigger_position_ratio);
-    status = set_trigger_conditions(mp);
-    if (status != PICO_OK) return status;
+    struct AppliedConfig* applied = mp->applied_config;
+    struct TriggerConfigs* next = &mp->trigger_config;
+    struct TriggerConfigs* last = &applied->trigger_config;
+    int all = !applied->trigger_valid;
+    int triggered = next->triggerType != NO_TRIGGER;
+
+    bool conditions_changed = all || 
+        (next->triggerType == NO_TRIGGER) != (last->triggerType == NO_TRIGGER) || 
+        next->channel != last->channel;
+    bool directions_changed = all || 
+        next->channel != last->channel || 
+        next->thresholdDirection != last->thresholdDirection || 
+        next->thresholdMode != last->thresholdMode;
+    bool properties_changed = all || 
+        next->channel != last->channel || 
+        next->thresholdUpper != last->thresholdUpper || 
+        next->thresholdUpperHysteresis != last->thresholdUpperHysteresis || 
+        next->thresholdLower != last->thresholdLower || 
+        next->thresholdLowerHysteresis != last->thresholdLowerHysteresis || 
+        next->autoTriggerMicroSeconds != last->autoTriggerMicroSeconds;
+
+    // Cleared first, a failed call leaves the device state unknown 
+    applied->trigger_valid = 0;
+
+    if (conditions_changed) {
+        status = set_trigger_conditions(mp);
+        if (status != PICO_OK) return status;
+    }
+
+    // Directions and properties are left on the device while no trigger is set 
+    if (triggered && directions_changed) {
+        status = set_trigger_directions(mp);
+        if (status != PICO_OK) return status;
+    }
+
+    if (triggered && properties_changed) {
+        status = set_trigger_properties(mp);
+        if (status != PICO_OK) return status;
+    }
+
+    if (triggered || all) {
+        *last = *next;
+    } else {
+        // Only the conditions were sent, keep the directions and properties the device has 
+        last->triggerType = next->triggerType;
+        last->channel = next->channel;
+    }
+    applied->trigger_valid = 1;
+
+    return PICO_OK;
+}
+
+/**
+ * Allocates the configuration store of a module. Nothing is published until the first start. 
+ * 
+ * @return Pointer to the new ConfigStore, or NULL on allocation failure. 
+ */
+struct ConfigStore* create_config_store(void){
+    struct ConfigStore* store = calloc(1, sizeof(struct ConfigStore));
+    if (!store) {
+        return NULL;
+    }
+    store->write_lock = epicsMutexCreate();
+    store->lock = epicsMutexCreate();
+    if (!store->write_lock || !store->lock) {
+        if (store->write_lock)
+            epicsMutexDestroy(store->write_lock);
+        if (store->lock)
+            epicsMutexDestroy(store->lock);
+        free(store);
+        return NULL;
+    }
+    return store;
+}
+
+// Frees a configuration store no write holds 
+void destroy_config_store(struct ConfigStore* store){
+    epicsMutexDestroy(store->write_lock);
+    epicsMutexDestroy(store->lock);
+    free(store);
+}
+
+/**
+ * Publishes the module's current settings as a new snapshot version. Called by device support 
+ * before starting an acquisition, with the store's write_lock held. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure with the settings to publish. 
+ */
+void publish_config(struct PS6000AModule* mp) {
+    struct ConfigStore* store = mp->config_store;
+
+    epicsMutexLock(store->lock);
+    store->latest.version++;
+    store->latest.resolution = mp->resolution;
+    store->latest.subwaveform_num = mp->subwaveform_num;
+    store->latest.sample_config = mp->sample_config;
+    memcpy(store->latest.channel_configs, mp->channel_configs, sizeof(store->latest.channel_configs));
+    store->latest.trigger_config = mp->trigger_config;
+    store->latest.channel_status = mp->channel_status;
+    epicsMutexUnlock(store->lock);
+}
+
+/**
+ * Publishes a new snapshot version that differs from the latest only in the trigger configuration. 
+ * The acquisition thread applies it before its next capture, a block capture still waiting for 
+ * its trigger is woken, stopped and armed again with it. Called by device support after a 
+ * trigger setting is written, with the store's write_lock held. Other settings written since the 
+ * last start wait for the restart. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure with the new trigger configuration. 
+ */
+void post_trigger_config(struct PS6000AModule* mp) {
+    struct ConfigStore* store = mp->config_store;
+
+    epicsMutexLock(store->lock);
+    store->latest.version++;
+    store->latest.trigger_config = mp->trigger_config;
+    epicsMutexUnlock(store->lock);
+    epicsEventSignal(mp->triggerReadyEvent);
+}
+
+/**
+ * Whether a snapshot has been published since the acquisition thread last took one. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's copy of the module. 
+ * @return   Non-zero if apply_config_update has a snapshot to take. 
+ */
+static int config_update_pending(struct PS6000AModule* mp) {
+    struct ConfigStore* store = mp->config_store;
+    int pending;
+
+    epicsMutexLock(store->lock);
+    pending = store->latest.version != mp->config_version;
+    epicsMutexUnlock(store->lock);
+    return pending;
+}
+
+/**
+ * Whether the latest snapshot, the one the acquisition runs with, streams. A streaming acquisition 
+ * only applies posted trigger configurations between run_stream_capture calls, and with the 
+ * recorder on collect_stream_data does not return, so trigger writes restart it instead. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure. 
+ * @return   Non-zero if the latest snapshot streams. 
+ */
+int config_streams(struct PS6000AModule* mp) {
+    struct ConfigStore* store = mp->config_store;
+    int streams;
+
+    epicsMutexLock(store->lock);
+    streams = store->latest.subwaveform_num != 0;
+    epicsMutexUnlock(store->lock);
+    return streams;
+}
+
+/**
+ * Replaces the settings of the acquisition thread's copy of the module with the latest snapshot. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's copy of the module. 
+ */
+static void load_config(struct PS6000AModule* mp) {
+    struct ConfigStore* store = mp->config_store;
+
+    epicsMutexLock(store->lock);
+    mp->config_version = store->latest.version;
+    mp->resolution = store->latest.resolution;
+    mp->subwaveform_num = store->latest.subwaveform_num;
+    mp->sample_config = store->latest.sample_config;
+    memcpy(mp->channel_configs, store->latest.channel_configs, sizeof(mp->channel_configs));
+    mp->trigger_config = store->latest.trigger_config;
+    mp->channel_status = store->latest.channel_status;
+    epicsMutexUnlock(store->lock);
+}
 
-    status = set_trigger_directions(mp);
-    if (status != PICO_OK) return status;
+/**
+ * Takes a snapshot published since the last capture. Snapshots published while acquiring only 
+ * change the trigger configuration, which is applied now. Called by the acquisition thread between 
+ * captures, while the device is not armed. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's copy of the module. 
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+PICO_STATUS apply_config_update(struct PS6000AModule* mp) {
+    struct ConfigStore* store = mp->config_store;
 
-    status = set_trigger_properties(mp);
-    if (status != PICO_OK) return status;
+    epicsMutexLock(store->lock);
+    if (store->latest.version == mp->config_version) {
+        epicsMutexUnlock(store->lock);
+        return PICO_OK;
+    }
+    mp->config_version = store->latest.version;
+    mp->trigger_config = store->latest.trigger_config;
+    epicsMutexUnlock(store->lock);
 
+    PICO_STATUS status = apply_trigger_configurations(mp);
+    if (status != PICO_OK) {
+        log_error("apply_config_update", status, __FILE__, __LINE__);
+    }
     return status;
 }
 
@@ -905,17 +1750,22 @@ PICO_STATUS apply_trigger_configurations(struct PS6000AModule* mp) {
  */
 PICO_STATUS set_data_buffer(struct PS6000AModule* mp) {
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    PICO_STATUS status = ps6000aSetDataBuffer(
+    if (mp->subwaveform_num == 0 && !do_Rapid_Block(mp)) {
+        // Block captures register their frame with register_block_buffers before each read 
+        return PICO_OK;
+    }
+
+    sdk_acquire(mp, SDK_CMD_CAPTURE);
+    PICO_STATUS status = ps6000aSetDataBuffer(
         mp->handle, (PICO_CHANNEL)NULL, NULL, 0, PICO_INT16_T, 0, 0, 
         PICO_CLEAR_ALL      // Clear buffer in Picoscope buffer list
     );
     if (status != PICO_OK) {
         log_error("ps6000aSetDataBuffer PICO_CLEAR_ALL", status, __FILE__, __LINE__);
-        epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+        sdk_release(mp);
         return status;
     }
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    sdk_release(mp);
 
     if (mp->subwaveform_num > 0)
     {
@@ -932,46 +1782,48 @@ PICO_STATUS set_data_buffer(struct PS6000AModule* mp) {
         }
 
         for (size_t i = 0; i < NUM_CHANNELS; i++){
-		    mp->streamWaveformBuffers[i] = (int16_t**)calloc(mp->subwaveform_num, sizeof(int16_t*));
-            for (int j = 0; j < mp->subwaveform_num; j++) {
-		        mp->streamWaveformBuffers[i][j] = (int16_t*)calloc(mp->sample_config.subwaveform_samples_num, sizeof(int16_t));
-	        }
             if (get_channel_status(i, mp->channel_status)){
-                epicsMutexLock(mp->epics_ps6000a_call_mutex);
+                sdk_acquire(mp, SDK_CMD_CAPTURE);
 	            status = ps6000aSetDataBuffer(
                     mp->handle,
                     mp->channel_configs[i].channel,
-                    mp->streamWaveformBuffers[i][0],
+                    acquisition_buffer(mp, i),
                     mp->sample_config.subwaveform_samples_num,
                     PICO_INT16_T,
                     0,
                     mp->sample_config.down_sample_ratio_mode, 
                     PICO_ADD
                 );
-                epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+                sdk_release(mp);
                 if (status != PICO_OK) {
                     log_error("ps6000aSetDataBuffer subwaveform_num > 0", status, __FILE__, __LINE__);
                 }
             }
         }
-    }else{
+    }else if (do_Rapid_Block(mp)){
+        // One buffer per segment, each segment is a row of the channel's bulk read waveform 
         for (size_t i = 0; i < NUM_CHANNELS; i++)
         {
-            if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status)){
-                epicsMutexLock(mp->epics_ps6000a_call_mutex);
+            if (!get_channel_status(mp->channel_configs[i].channel, mp->channel_status) || !mp->segment_read_waveform[i]){
+                continue;
+            }
+            for (uint64_t segment_index = 0; segment_index < mp->sample_config.num_segments; segment_index++)
+            {
+                sdk_acquire(mp, SDK_CMD_CAPTURE);
                 status = ps6000aSetDataBuffer(
                     mp->handle, 
                     mp->channel_configs[i].channel, 
-                    mp->waveform[i],
+                    &mp->segment_read_waveform[i][segment_index * mp->sample_config.num_samples],
                     mp->sample_config.num_samples, 
                     PICO_INT16_T, 
-                    0, 
+                    segment_index, 
                     mp->sample_config.down_sample_ratio_mode, 
                     PICO_ADD
                 );
-                epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+                sdk_release(mp);
                 if (status != PICO_OK) {
-                    log_error("ps6000aSetDataBuffer subwaveform_num = 0", status, __FILE__, __LINE__);
+                    log_error("ps6000aSetDataBuffer rapid block", status, __FILE__, __LINE__);
+                    return status;
                 }
             }
         }
@@ -982,124 +1834,303 @@ PICO_STATUS set_data_buffer(struct PS6000AModule* mp) {
     return status;
 }
 
-typedef struct ChannelStreamingArg 
-{
-    enum Channel channel;
-    struct PS6000AModule* mp;
-} ChannelStreamingArg;
-
-void channel_streaming_thread_function(void *arg){
-    ChannelStreamingArg* ap = (struct ChannelStreamingArg *)arg;
-    PS6000AModule* mp = ap->mp;
-    enum Channel channel_index = ap->channel;
-    int buffer_index = 0;
+/**
+ * Calculates the time for the Picoscope to fill one streaming buffer. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing sample settings. 
+ * @return   double Returns the buffer fill time in seconds. 
+ */
+double calculate_stream_fill_time(struct PS6000AModule* mp){
+    double raw_samples_per_buffer = (double) mp->sample_config.subwaveform_samples_num; 
+
+    if ((mp->sample_config.down_sample_ratio_mode == RATIO_MODE_AVERAGE || 
+         mp->sample_config.down_sample_ratio_mode == RATIO_MODE_DECIMATE) && 
+         mp->sample_config.down_sample_ratio > 1) {
+        raw_samples_per_buffer *= mp->sample_config.down_sample_ratio; 
+    }
+    return raw_samples_per_buffer * mp->sample_config.timebase_configs.sample_interval_secs; 
+}
+
+/**
+ * Clamps the streaming poll interval to the range the collector is allowed to sleep for. 
+ * 
+ * @param poll_interval_secs double The requested poll interval in seconds. 
+ * @return                   double Returns the poll interval limited to [STREAM_POLL_MIN_SECS, STREAM_POLL_MAX_SECS]. 
+ */
+double clamp_stream_poll_interval(double poll_interval_secs){
+    if (poll_interval_secs < STREAM_POLL_MIN_SECS) {
+        return STREAM_POLL_MIN_SECS; 
+    }
+    if (poll_interval_secs > STREAM_POLL_MAX_SECS) {
+        return STREAM_POLL_MAX_SECS; 
+    }
+    return poll_interval_secs; 
+}
+
+/**
+ * Retunes the streaming poll interval from the number of samples returned by the last poll, 
+ * aiming for STREAM_POLLS_PER_BUFFER polls per buffer. A poll that returned no samples doubles 
+ * the interval, otherwise the interval is scaled towards the target and smoothed with the 
+ * previous value to avoid oscillating on jitter. 
+ * 
+ * @param poll_interval_secs double   The current poll interval in seconds. 
+ *        new_samples uint64_t        The number of samples returned by the last poll. 
+ *        subwaveform_samples_num uint64_t The number of samples in one streaming buffer. 
+ * 
+ * @return double Returns the next poll interval in seconds. 
+ */
+double retune_stream_poll_interval(double poll_interval_secs, uint64_t new_samples, uint64_t subwaveform_samples_num){
+    if (new_samples == 0) {
+        return clamp_stream_poll_interval(poll_interval_secs * 2); 
+    }
+    double target_samples = (double) subwaveform_samples_num / STREAM_POLLS_PER_BUFFER; 
+    double ideal_interval_secs = poll_interval_secs * target_samples / (double) new_samples; 
+
+    return clamp_stream_poll_interval((poll_interval_secs + ideal_interval_secs) / 2); 
+}
+
+/**
+ * Checked at every point a capture can wait: trigger waits, streaming polls and SDK retries. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's module. 
+ * @return   Non-zero once a stop was requested or the acquisition is no longer running. 
+ */
+static int capture_cancelled(struct PS6000AModule* mp){
+    return acquisition_state(mp) != ACQ_RUNNING;
+}
+
+// Data socket subscribers come and go during an acquisition, so this is checked per capture 
+static int keeping_captures(struct PS6000AModule* mp){
+    return mp->recording || mp->post_mortem_active || data_server_active(mp->data_server) || mp->shm_ring != NULL;
+}
+
+/**
+ * Copies a capture into the shared memory ring, with the settings a reader needs to scale it and 
+ * the time its samples were read from the scope. 
+ * 
+ * @param mp            PS6000AModule Pointer to the acquisition thread's module. 
+ * @param channel_index size_t The index of the channel the samples belong to. 
+ * @param data          int16_t Pointer The captured samples. 
+ * @param samples       uint64_t The number of captured samples. 
+ * @param time          epicsTimeStamp Pointer The time the frame was captured. 
+ * @param flags         uint16_t SHM_RING_TRIGGERED and SHM_RING_AUTO_TRIGGERED flags. 
+ */
+static void write_shm_frame(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples, 
+                            const epicsTimeStamp* time, uint16_t flags){
+    struct ShmSlotHeader frame;
+    struct timespec time_ts;
+
+    memset(&frame, 0, sizeof(frame));
+    epicsTimeToTimespec(&time_ts, time);
+    frame.time_secs = time_ts.tv_sec;
+    frame.time_nsec = time_ts.tv_nsec;
+    frame.channel = channel_index;
+    frame.flags = flags;
+    frame.ready_ns = mp->values_ready_ns;
+    frame.config_version = mp->config_version;
+    frame.sample_interval_secs = mp->sample_config.timebase_configs.sample_interval_secs;
+    frame.analog_offset = mp->channel_configs[channel_index].analog_offset;
+    frame.range = mp->channel_configs[channel_index].range;
+    frame.resolution = mp->resolution;
+    frame.samples = samples;
+    shm_ring_write(mp->shm_ring, &frame, data);
+}
+
+/**
+ * Hands a captured frame, segment or streaming buffer to the disk recorder, the post-mortem 
+ * ring, the data server and the shared memory ring, whichever are active. Each copies the 
+ * samples, so the capture can be published afterwards. 
+ * 
+ * @param mp            PS6000AModule Pointer to the acquisition thread's module. 
+ * @param channel_index size_t The index of the channel the samples belong to. 
+ * @param data          int16_t Pointer The captured samples. 
+ * @param samples       uint64_t The number of captured samples. 
+ * @param time          epicsTimeStamp Pointer The time the chunk was captured. 
+ * @param flags         uint16_t ARCHIVE_TRIGGERED and ARCHIVE_AUTO_TRIGGERED flags. 
+ */
+static void keep_capture(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples, 
+                         const epicsTimeStamp* time, uint16_t flags){
+    if (mp->recording) {
+        recorder_submit(mp, channel_index, data, samples, time, flags);
+    }
+    if (mp->post_mortem_active) {
+        post_mortem_push(mp, channel_index, data, samples, time, flags);
+    }
+    if (data_server_active(mp->data_server)) {
+        data_server_publish(mp, channel_index, data, samples, time, flags);
+    }
+    if (mp->shm_ring) {
+        write_shm_frame(mp, channel_index, data, samples, time, flags);
+    }
+}
+
+/**
+ * Collects streaming data for every enabled channel with a single ps6000aGetStreamingLatestValues 
+ * call per poll. Each enabled channel has one entry in the PICO_STREAMING_DATA_INFO array, when 
+ * an entry's frame is full it is published to the channel waveform and the next frame is registered. 
+ * Full frames are also kept by the disk recorder and the post-mortem ring when they are active. 
+ * When recording, collection runs until the acquisition is stopped instead of ending after 
+ * subwaveform_num frames. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing data acquisition settings. 
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+PICO_STATUS collect_stream_data(struct PS6000AModule* mp){
+    PICO_STREAMING_DATA_INFO stream_data[NUM_CHANNELS];
+    PICO_STREAMING_DATA_TRIGGER_INFO stream_trigger;
+    size_t stream_channel[NUM_CHANNELS];      // Channel config index of each stream_data entry
+    uint16_t buffer_index[NUM_CHANNELS] = {0};
+    int trigger_pending[NUM_CHANNELS] = {0};  // Trigger seen, not yet in a recorded buffer 
+    size_t num_stream_channels = 0;
+    int recording = mp->recording;
+    size_t channels_finished = 0;
     int triggered_flag = 0;
     int set_buffer_retry = 0;
-	PICO_STREAMING_DATA_INFO streamData;
-    PICO_STREAMING_DATA_TRIGGER_INFO streamTrigger;
     PICO_STATUS status = PICO_OK;
-    streamData.bufferIndex_ = 0;
-    streamData.channel_ = channel_index;
-    streamData.mode_ = mp->sample_config.down_sample_ratio_mode;
-    streamData.noOfSamples_ = 0;
-    streamData.overflow_ = 0;
-    streamData.startIndex_ = 0;
-    streamData.type_ = PICO_INT16_T;
     uint16_t subwaveform_num = mp->subwaveform_num;
     uint64_t subwaveform_samples_num = mp->sample_config.subwaveform_samples_num;
+
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status)) {
+            stream_data[num_stream_channels].bufferIndex_ = 0;
+            stream_data[num_stream_channels].channel_ = mp->channel_configs[i].channel;
+            stream_data[num_stream_channels].mode_ = mp->sample_config.down_sample_ratio_mode;
+            stream_data[num_stream_channels].noOfSamples_ = 0;
+            stream_data[num_stream_channels].overflow_ = 0;
+            stream_data[num_stream_channels].startIndex_ = 0;
+            stream_data[num_stream_channels].type_ = PICO_INT16_T;
+            stream_channel[num_stream_channels] = i;
+            num_stream_channels++;
+        }
+    }
+    if (num_stream_channels == 0) {
+        return PICO_BUFFERS_NOT_SET;
+    }
+
+    // Start polling a few times per buffer and retune from the samples each poll returns 
+    struct StreamPollStats* poll_stats = mp->stream_poll_stats; 
+    poll_stats->poll_interval_secs = clamp_stream_poll_interval(calculate_stream_fill_time(mp) / STREAM_POLLS_PER_BUFFER); 
+    poll_stats->polls = 0; 
+    poll_stats->useful_polls = 0; 
+
     if (mp->trigger_config.triggerType == NO_TRIGGER){ 
         triggered_flag = 1;
     } 
-    while (buffer_index < subwaveform_num) {
-        epicsMutexLock(mp->epics_acquisition_flag_mutex);
-        if (*mp->dataAcquisitionFlag == 0)
+    while (channels_finished < num_stream_channels) {
+        if (capture_cancelled(mp))
         {
-            epicsEventSignal(mp->channelStreamingFinishedEvents[channel_index]);
-            epicsMutexUnlock(mp->epics_acquisition_flag_mutex);
-            return;
+            return PICO_OK;
         }
-        epicsMutexUnlock(mp->epics_acquisition_flag_mutex);
 
-        if (streamData.startIndex_ + streamData.noOfSamples_ == subwaveform_samples_num){
+        // Register the next buffer for each channel whose previous buffer was filled 
+        for (size_t j = 0; j < num_stream_channels; j++) {
+            size_t i = stream_channel[j];
+            if ((!recording && buffer_index[j] >= subwaveform_num) || 
+                stream_data[j].startIndex_ + stream_data[j].noOfSamples_ != subwaveform_samples_num) {
+                continue;
+            }
             do
             {
-                epicsMutexLock(mp->epics_ps6000a_call_mutex);
+                sdk_acquire(mp, SDK_CMD_DATA);
                 status = ps6000aSetDataBuffer(
                     mp->handle,
-                    channel_index,
-                    mp->streamWaveformBuffers[channel_index][buffer_index],
+                    mp->channel_configs[i].channel,
+                    acquisition_buffer(mp, i),
                     subwaveform_samples_num,
                     PICO_INT16_T,
                     0,
                     mp->sample_config.down_sample_ratio_mode,
                     PICO_ADD
                     );
-                epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+                sdk_release(mp);
                 set_buffer_retry ++;
-            } while (status == PICO_DRIVER_FUNCTION && set_buffer_retry < 100);
+            } while (status == PICO_DRIVER_FUNCTION && set_buffer_retry < SDK_RETRY_MAX && !capture_cancelled(mp));
             set_buffer_retry = 0;
             if(status != PICO_OK){
                 log_error("ps6000aSetDataBuffer", status, __FILE__, __LINE__);
-                return;
+                return status;
+            }
+        }
+
+        // Give the device time to collect data, a stop request ends the wait early 
+        if (epicsEventWaitWithTimeout(mp->acquisition->cancel_event, poll_stats->poll_interval_secs) == epicsEventWaitOK) {
+            return PICO_OK;
+        }
+        sdk_acquire(mp, SDK_CMD_DATA);
+        status = ps6000aGetStreamingLatestValues(mp->handle, stream_data, num_stream_channels, &stream_trigger); // Get the latest values
+        mp->values_ready_ns = shm_ring_now_ns();
+        sdk_release(mp);
+
+        uint64_t new_samples = 0; 
+        for (size_t j = 0; j < num_stream_channels; j++) {
+            if (stream_data[j].noOfSamples_ > new_samples) {
+                new_samples = stream_data[j].noOfSamples_; 
             }
         }
+        poll_stats->polls++; 
+        if (new_samples > 0) {
+            poll_stats->useful_polls++; 
+        }
+        poll_stats->poll_interval_secs = retune_stream_poll_interval(
+            poll_stats->poll_interval_secs, 
+            new_samples, 
+            subwaveform_samples_num
+        ); 
 
-        usleep(5000);       // Sleep to give Picoscope device time to collect data
-        epicsMutexLock(mp->epics_ps6000a_call_mutex);
-        status = ps6000aGetStreamingLatestValues(mp->handle, &streamData, 1, &streamTrigger); // Get the latest values
-        epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
-        //     /* code */
-        // printf("CH %d, valid buffer %d, status %d, numSamples %ld, startIdx %d, sampleCollected %d, total buffer %ld, triggered %d, subwaveform_num: %d\n",
-        //         channel_index, buffer_index, status,
-        //         subwaveform_samples_num, streamData.startIndex_, streamData.noOfSamples_,
-        //         streamData.bufferIndex_, triggered_flag, subwaveform_num);
+        if (status != PICO_OK && status != PICO_WAITING_FOR_DATA_BUFFERS){
+            log_error("ps6000aGetStreamingLatestValues", status, __FILE__, __LINE__);
+            return status;
+        }
 
-        if (triggered_flag == 0 && streamTrigger.triggered_ == 0 )
+        if (triggered_flag == 0 && stream_trigger.triggered_ == 0 )
         {
+            // Do not use the data if it is not triggered
             continue;
-        }else{
-            triggered_flag =  1;
         }
-        if (streamData.startIndex_ + streamData.noOfSamples_ == subwaveform_samples_num){
-        
-            if(triggered_flag== 0 && streamTrigger.triggered_== 0){
-                // Do not use the data if it is not triggered
+        triggered_flag = 1;
+        if (keeping_captures(mp) && stream_trigger.triggered_) {
+            for (size_t j = 0; j < num_stream_channels; j++) {
+                trigger_pending[j] = 1;
+            }
+        }
+
+        // Fan completed buffers out to their channels 
+        epicsTimeStamp completed_time;
+        epicsTimeGetCurrent(&completed_time);
+        for (size_t j = 0; j < num_stream_channels; j++) {
+            size_t i = stream_channel[j];
+            if ((!recording && buffer_index[j] >= subwaveform_num) || 
+                stream_data[j].startIndex_ + stream_data[j].noOfSamples_ != subwaveform_samples_num) {
                 continue;
             }
 
-            // If buffers full move to next buffer
             *mp->sample_collected = subwaveform_samples_num;
-            int16_t* src = mp->streamWaveformBuffers[channel_index][buffer_index];
-            int16_t* dst = mp->waveform[channel_index];
-
-            if (src && dst) {
-                memcpy(dst, src, *mp->sample_collected * sizeof(uint16_t));
+            if (keeping_captures(mp)) {
+                // Copied before publishing, once published the frame belongs to the record 
+                keep_capture(mp, i, filled_buffer(mp, i), subwaveform_samples_num, &completed_time, 
+                             trigger_pending[j] ? ARCHIVE_TRIGGERED : 0);
+                trigger_pending[j] = 0;
             }
-    
+            publish_frame(mp, i, subwaveform_samples_num);
 
-            dbProcess((struct dbCommon *)mp->pRecordUpdateWaveform[channel_index]);
-            buffer_index++;
-            continue;
-        // }else if (status == PICO_WAITING_FOR_DATA_BUFFERS && streamData.startIndex_ == 0 && streamData.noOfSamples_ == 0)
-        }else if (status == PICO_WAITING_FOR_DATA_BUFFERS){
-            // The Error that can be ignored
-            status = PICO_OK;
-            continue;
-        }else if (status != PICO_OK){
-            log_error("ps6000aGetStreamingLatestValues", status, __FILE__, __LINE__);
-            return;
+            scanIoRequest(mp->waveform_scan[i]);
+            if (recording) {
+                continue;
+            }
+            buffer_index[j]++;
+            if (buffer_index[j] == subwaveform_num) {
+                channels_finished++;
+            }
         }
-        
     }
-    epicsEventSignal(mp->channelStreamingFinishedEvents[channel_index]);
+    return PICO_OK;
 }
 
 PICO_STATUS run_stream_capture(struct PS6000AModule* mp){
     PICO_STATUS status;
     double time = mp->sample_config.timebase_configs.sample_interval_secs;
-    ChannelStreamingArg channel_streaming_args[NUM_CHANNELS];
 
-    int thread_count = 0;
+    sdk_acquire(mp, SDK_CMD_CAPTURE);
     status = ps6000aRunStreaming(
         mp->handle,
         &time,
@@ -1110,25 +2141,11 @@ PICO_STATUS run_stream_capture(struct PS6000AModule* mp){
         mp->sample_config.down_sample_ratio,
         mp->sample_config.down_sample_ratio_mode
         );	// Start continuous streaming
+    sdk_release(mp);
     if (status == PICO_OK) {
-        for (size_t i = 0; i < NUM_CHANNELS; i++) {
-            if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status)) {
-                channel_streaming_args[i].mp = mp;
-                channel_streaming_args[i].channel = mp->channel_configs[i].channel;
-                mp->channel_streaming_thread_function[i] = epicsThreadCreate("channel_streaming_thread", epicsThreadPriorityMedium,
-                    0, (EPICSTHREADFUNC)channel_streaming_thread_function, &channel_streaming_args[i]);
-                if (!mp->channel_streaming_thread_function[i]) {
-                    log_error("Thread channel_streaming_data_thread creation failed\n", -1, __FILE__, __LINE__);
-                    epicsMutexLock(mp->epics_acquisition_flag_mutex);
-                    *mp->dataAcquisitionFlag = 0;
-                    epicsMutexUnlock(mp->epics_acquisition_flag_mutex);
-                    return -1;
-                }
-                thread_count ++;
-            }
-        }
-
-	}else{
+        mp->capture_armed = 1;
+    }
+    if (status != PICO_OK) {
         log_error("run_stream_capture", status, __FILE__, __LINE__);
         if (status == PICO_BUFFERS_NOT_SET){
             printf("No Channel Opened\n");
@@ -1136,30 +2153,28 @@ PICO_STATUS run_stream_capture(struct PS6000AModule* mp){
         return status;
     }
 
-    for (size_t i = 0; i < thread_count; i++)
-    {
-        epicsEventWait(mp->channelStreamingFinishedEvents[i]);
-    }
+    status = collect_stream_data(mp);
     print_time("All Subwaveform Sent");
 
-    status = stop_capturing(mp);
-    return status;
+    PICO_STATUS stop_status = stop_capturing(mp);
+    return status != PICO_OK ? status : stop_status;
 }
 
 /**
- * Initialize the blocking mode callback function.
+ * Initialize the blocking mode callback function. The callback parameters belong to the module, 
+ * so several modules can capture at once without signalling each other's threads. 
  * @param  mp PS6000AModule Pointer to the PS6000AModule structure containing data ready flag. 
  * @return    PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
  */
 PICO_STATUS init_block_ready_callback_params(struct PS6000AModule* mp){
-    free(blockReadyCallbackParams);
-    blockReadyCallbackParams = (BlockReadyCallbackParams*)malloc(sizeof(BlockReadyCallbackParams));
-    if (blockReadyCallbackParams == NULL) {
-        log_error("BlockReadyCallbackParams malloc", PICO_MEMORY_FAIL, __FILE__, __LINE__);
+    struct BlockReadyCallbackParams* params = mp->block_ready_callback_params;
+    if (params == NULL) {
+        log_error("BlockReadyCallbackParams", PICO_MEMORY_FAIL, __FILE__, __LINE__);
         return PICO_MEMORY_FAIL;
     }
-    memset(blockReadyCallbackParams, 0, sizeof(BlockReadyCallbackParams));
-    blockReadyCallbackParams->mp = mp;
+    params->callbackStatus = PICO_OK;
+    params->dataReady = 0;
+    params->triggerReadyEvent = mp->triggerReadyEvent;
     return PICO_OK;
 }
 
@@ -1174,12 +2189,18 @@ inline PICO_STATUS run_block_capture(struct PS6000AModule* mp, double* time_indi
     PICO_STATUS status = 0;
 
     status = start_block_capture(mp, time_indisposed_ms);
+    if (status == PICO_CANCELLED) {
+        return PICO_OK;
+    }
     if (status != PICO_OK) {
         log_error("start_block_capture", status, __FILE__, __LINE__);
         return status;
     }
 
     status = wait_for_capture_completion(mp);
+    if (status == PICO_TIMEOUT) {
+        return status;
+    }
     if (status != PICO_OK && status != PICO_CANCELLED) {
         log_error("wait_for_capture_completion", status, __FILE__, __LINE__);
         return status;
@@ -1198,8 +2219,9 @@ inline PICO_STATUS run_block_capture(struct PS6000AModule* mp, double* time_indi
  */
 void ps6000aBlockReadyCallback(int16_t handle, PICO_STATUS status, PICO_POINTER pParameter)
 {
-    BlockReadyCallbackParams *state = (BlockReadyCallbackParams *)pParameter;
+    struct BlockReadyCallbackParams *state = (struct BlockReadyCallbackParams *)pParameter;
     state->callbackStatus = status;
+    epicsTimeGetCurrent(&state->ready_time);
 
     // print_time("ps6000aBlockReadyCallback Trigger Captured");
     // printf("-------------------\n");
@@ -1210,10 +2232,11 @@ void ps6000aBlockReadyCallback(int16_t handle, PICO_STATUS status, PICO_POINTER
     }else if (status == PICO_OK)
     {
         state->dataReady = 1;
-        epicsEventSignal(state->mp->triggerReadyEvent);
     }else{
         log_error("ps6000aBlockReadyCallback", status, __FILE__, __LINE__);
     }
+    // Wake the waiting thread on errors too, it would otherwise wait until stopped 
+    epicsEventSignal(state->triggerReadyEvent);
 }
 
 /**
@@ -1230,35 +2253,58 @@ inline PICO_STATUS start_block_capture(struct PS6000AModule* mp, double* time_in
     uint64_t pre_trigger_samples = ((uint64_t)sample_config.num_samples * sample_config.trigger_position_ratio)/100;
     uint64_t post_trigger_samples = sample_config.num_samples - pre_trigger_samples;
 
-    blockReadyCallbackParams->dataReady = 0;
+    mp->block_ready_callback_params->dataReady = 0;
+    mp->block_ready_callback_params->callbackStatus = PICO_OK;
     int8_t runBlockCaptureRetryFlag = 0;
+    int stop_sent = 0;
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
+    // The device is released between attempts, so other commands run while a retry waits 
     do {
+        sdk_acquire(mp, SDK_CMD_CAPTURE);
         ps6000aRunBlockStatus = ps6000aRunBlock(
             mp->handle,
             pre_trigger_samples,    
             post_trigger_samples,
             sample_config.timebase_configs.timebase,
             time_indisposed_ms,
-            0,
+            mp->block_segment_index,
             ps6000aBlockReadyCallback, 
-            (void*) blockReadyCallbackParams
+            (void*) mp->block_ready_callback_params
         );
+        sdk_release(mp);
 
         if (ps6000aRunBlockStatus == PICO_HARDWARE_CAPTURING_CALL_STOP) {
             runBlockCaptureRetryFlag ++;
             printf("ps6000aRunBlock Retry attempt: %d\n", runBlockCaptureRetryFlag);
-            ps6000aStopStatus = ps6000aStop(mp->handle);
-            if (ps6000aStopStatus != PICO_OK) {
-                printf("Error: Failed to stop capture in ps6000aRunBlock, status: %d\n", ps6000aStopStatus);
-                return ps6000aStopStatus;
+            if (capture_cancelled(mp)) {
+                ps6000aRunBlockStatus = PICO_CANCELLED;
+                break;
+            }
+            if (runBlockCaptureRetryFlag >= SDK_RETRY_MAX) {
+                break;
+            }
+            if (!stop_sent) {
+                // The device still holds an earlier capture, stop it once like any armed capture 
+                mp->capture_armed = 1;
+                ps6000aStopStatus = stop_capturing(mp);
+                if (ps6000aStopStatus != PICO_OK) {
+                    printf("Error: Failed to stop capture in ps6000aRunBlock, status: %d\n", ps6000aStopStatus);
+                    return ps6000aStopStatus;
+                }
+                stop_sent = 1;
             }
+            epicsThreadSleep(SDK_RETRY_DELAY_SECS);
         }
     } while (ps6000aRunBlockStatus == PICO_HARDWARE_CAPTURING_CALL_STOP);
     // print_time("ps6000aRunBlock Trigger Captured");
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
+    if (ps6000aRunBlockStatus == PICO_OK) {
+        mp->capture_armed = 1;
+        epicsTimeGetCurrent(&mp->block_ready_callback_params->armed_time);
+    }
 
+    if (ps6000aRunBlockStatus == PICO_CANCELLED) {
+        return PICO_CANCELLED;
+    }
     if (ps6000aRunBlockStatus != PICO_OK) {
         log_error("ps6000aRunBlock", ps6000aRunBlockStatus, __FILE__, __LINE__);
         return ps6000aRunBlockStatus;
@@ -1268,28 +2314,100 @@ inline PICO_STATUS start_block_capture(struct PS6000AModule* mp, double* time_in
 }
 
 /**
- * Waits for the block capture to complete by polling the Picoscope device.
+ * The longest a block capture may take from ps6000aRunBlock to the callback. Without a trigger, 
+ * or with the auto trigger set, the device triggers itself, so the capture must complete within 
+ * the auto trigger time plus the capture time of each segment. Waiting on a real trigger has 
+ * no limit, a stop request ends that wait instead. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's module. 
+ * @return   Timeout in seconds, or 0 for no timeout. 
+ */
+static double capture_timeout_secs(struct PS6000AModule* mp){
+    struct TriggerConfigs* trigger = &mp->trigger_config;
+    double segments = do_Rapid_Block(mp) ? (double)mp->sample_config.num_segments : 1.0;
+    double capture_secs = mp->sample_config.num_samples * mp->sample_config.timebase_configs.sample_interval_secs;
+    double auto_trigger_secs = trigger->autoTriggerMicroSeconds * 1e-6;
+
+    if (trigger->triggerType != NO_TRIGGER && trigger->autoTriggerMicroSeconds == 0) {
+        return 0;
+    }
+    if (trigger->triggerType == NO_TRIGGER) {
+        auto_trigger_secs = 0;
+    }
+    return segments * (auto_trigger_secs + capture_secs) + CAPTURE_TIMEOUT_MARGIN_SECS;
+}
+
+/**
+ * Tells whether a block frame or segment was auto triggered, from the trigger info the device 
+ * returned for it. The trigger time can only be found when a trigger event started the capture, 
+ * any status other than a time stamp counter reset or an unrequested trigger time means the 
+ * device triggered itself. 
+ * 
+ * @param mp   PS6000AModule Pointer to the acquisition thread's module. 
+ *        info PICO_TRIGGER_INFO Pointer The trigger info of the frame or segment. 
+ * @return     Non-zero if the frame was captured by the auto trigger. 
+ */
+static int auto_triggered_frame(struct PS6000AModule* mp, const PICO_TRIGGER_INFO* info){
+    PICO_STATUS status = info->status & ~PICO_DEVICE_TIME_STAMP_RESET;
+
+    if (mp->trigger_config.triggerType == NO_TRIGGER || mp->trigger_config.autoTriggerMicroSeconds == 0) {
+        return 0;
+    }
+    return status != PICO_OK && status != PICO_TRIGGER_TIME_NOT_REQUESTED;
+}
+
+/**
+ * Waits for the block capture to complete, then retrieves the data. The wait is cut into 
+ * CANCEL_CHECK_SECS slices, so a stop request is seen within one slice even if its wake up 
+ * was consumed by an earlier wait. A trigger configuration posted during the wait stops the 
+ * capture, which may otherwise wait forever on a trigger that the new settings fix. 
  * 
  * @param mp PS6000AModule Pointer The PS6000AModule structure containing sample-collection settings and EPICS Event id.
- * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, PICO_CANCELLED if stopped, PICO_TIMEOUT if 
+ *           the capture was stopped without data and the next one should be armed, or a non-zero 
+ *           error code on failure.
  */
 inline PICO_STATUS wait_for_capture_completion(struct PS6000AModule* mp)
 {
     PICO_STATUS status = PICO_OK;
-    while (1)
+    struct BlockReadyCallbackParams* params = mp->block_ready_callback_params;
+    double timeout_secs = capture_timeout_secs(mp);
+    epicsTimeStamp now;
+
+    while (!params->dataReady)
     {
-        int returnStatus = epicsEventWait((epicsEventId)mp->triggerReadyEvent);
-        if (returnStatus == epicsEventWaitOK){
-            break;
+        if (capture_cancelled(mp)) {
+            *mp->sample_collected = 0;
+            *mp->segments_collected = 0;
+            return PICO_CANCELLED;
+        }
+        if (params->callbackStatus != PICO_OK && params->callbackStatus != PICO_CANCELLED) {
+            return params->callbackStatus;
+        }
+        epicsTimeGetCurrent(&now);
+        if (timeout_secs > 0 && epicsTimeDiffInSeconds(&now, &params->armed_time) > timeout_secs) {
+            // Free the device, the caller arms the next capture 
+            mp->trigger_timing_info->capture_timeouts++;
+            stop_capturing(mp);
+            *mp->sample_collected = 0;
+            *mp->segments_collected = 0;
+            return PICO_TIMEOUT;
         }
+        if (config_update_pending(mp)) {
+            // Armed again by the caller, after apply_config_update has sent the new trigger 
+            stop_capturing(mp);
+            *mp->sample_collected = 0;
+            *mp->segments_collected = 0;
+            return PICO_TIMEOUT;
+        }
+        epicsEventWaitWithTimeout(mp->triggerReadyEvent, CANCEL_CHECK_SECS);
     }
 
-    if (!blockReadyCallbackParams->dataReady) {
-        *mp->sample_collected = 0;
-        return PICO_CANCELLED;
+    if (do_Rapid_Block(mp)) {
+        status = retrieve_segment_data(mp);
+    } else {
+        status = retrieve_waveform_data(mp);
     }
-
-    status = retrieve_waveform_data(mp);
     if (status != PICO_OK) {
         return status;
     }  
@@ -1298,22 +2416,29 @@ inline PICO_STATUS wait_for_capture_completion(struct PS6000AModule* mp)
 }
 
 /**
- * Retrieves the captured waveform data from the Picoscope device and stores it in the provided buffer.
+ * Retrieves the captured waveform data from the Picoscope device straight into each channel's 
+ * frame and publishes the frames to the channel waveform records.
  * 
  * @param mp PS6000AModule Pointer The PS6000AModule structure containing sample-collection settings.
  * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
  */
 inline PICO_STATUS retrieve_waveform_data(struct PS6000AModule* mp) {
     uint64_t start_index = 0;
-    uint64_t segment_index = 0;
+    uint64_t segment_index = mp->block_segment_index;
     int16_t overflow = 0;
     uint64_t getValueRetryFlag = 0;
     PICO_STATUS ps6000aStopStatus;
     PICO_STATUS ps6000aGetValuesStatus;
 
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    do {
+    // Buffers only need to be registered when the values are read, so the frames can change per capture 
+    ps6000aGetValuesStatus = register_block_buffers(mp, segment_index);
+    if (ps6000aGetValuesStatus != PICO_OK) {
+        return ps6000aGetValuesStatus;
+    }
 
+    // The device is released between attempts, so other commands run while a retry waits 
+    do {
+        sdk_acquire(mp, SDK_CMD_DATA);
         ps6000aGetValuesStatus = ps6000aGetValues(
             mp->handle,
             start_index,
@@ -1323,28 +2448,37 @@ inline PICO_STATUS retrieve_waveform_data(struct PS6000AModule* mp) {
             segment_index,
             &overflow
         );   
+        mp->values_ready_ns = shm_ring_now_ns();
+        sdk_release(mp);
 
         if (ps6000aGetValuesStatus == PICO_HARDWARE_CAPTURING_CALL_STOP) {
             getValueRetryFlag++;
-            printf("dataReady %d\n",blockReadyCallbackParams->dataReady);
+            printf("dataReady %d\n",mp->block_ready_callback_params->dataReady);
             printf("ps6000aGetValues Retry attempt: %ld\n", getValueRetryFlag);
-            ps6000aStopStatus = ps6000aStop(mp->handle);
+            if (capture_cancelled(mp)) {
+                return PICO_CANCELLED;
+            }
+            if (getValueRetryFlag >= SDK_RETRY_MAX) {
+                break;
+            }
+            // Only the first retry stops the capture, stop_capturing does nothing once it is stopped 
+            ps6000aStopStatus = stop_capturing(mp);
             if (ps6000aStopStatus != PICO_OK) {
                 printf("Error: Failed to stop capture, status: %d\n", ps6000aStopStatus);
-                epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
                 return ps6000aStopStatus;
             }
+            epicsThreadSleep(SDK_RETRY_DELAY_SECS);
         }
     } while (ps6000aGetValuesStatus == PICO_HARDWARE_CAPTURING_CALL_STOP);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
     
+    mp->trigger_timing_info->auto_triggered = 0; 
     if (mp->trigger_config.triggerType != NO_TRIGGER){
         update_trigger_timing_info(mp, segment_index); 
     } 
     else {
-        mp->trigger_timing_info.missed_triggers = 0; 
-        mp->trigger_timing_info.trigger_freq_secs = 0; 
-        mp->trigger_timing_info.prev_trigger_time = 0; 
+        mp->trigger_timing_info->missed_triggers = 0; 
+        mp->trigger_timing_info->trigger_freq_secs = 0; 
+        mp->trigger_timing_info->prev_trigger_time = 0; 
     }
 
     if (ps6000aGetValuesStatus != PICO_OK) {
@@ -1352,11 +2486,178 @@ inline PICO_STATUS retrieve_waveform_data(struct PS6000AModule* mp) {
         return ps6000aGetValuesStatus;
     }
 
+    if (mp->trigger_timing_info->auto_triggered) {
+        mp->trigger_timing_info->auto_triggered_frames++;
+    }
+    uint16_t archive_flags = 0;
+    if (keeping_captures(mp) && mp->trigger_config.triggerType != NO_TRIGGER) {
+        archive_flags = mp->trigger_timing_info->auto_triggered ? ARCHIVE_AUTO_TRIGGERED : ARCHIVE_TRIGGERED;
+    }
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status)) {
+            if (keeping_captures(mp)) {
+                keep_capture(mp, i, filled_buffer(mp, i), *mp->sample_collected, 
+                             &mp->block_ready_callback_params->ready_time, archive_flags);
+            }
+            publish_frame(mp, i, *mp->sample_collected);
+        }
+    }
 
     return PICO_OK;
 }
 
 
+/**
+ * Keeps every segment of a rapid block capture. The callback time is taken as the end of the 
+ * last segment, earlier segments are dated back from it by their trigger time stamps. Reads 
+ * the bulk read waveforms, which only the acquisition thread uses. 
+ * 
+ * @param mp           PS6000AModule Pointer The PS6000AModule structure containing the segment buffers. 
+ *        trigger_info PICO_TRIGGER_INFO Pointer The trigger information of each segment. 
+ *        num_segments uint64_t The number of segments captured. 
+ */
+static void keep_segments(struct PS6000AModule* mp, const PICO_TRIGGER_INFO* trigger_info, uint64_t num_segments){
+    uint64_t last_time_stamp = trigger_info[num_segments - 1].timeStampCounter;
+
+    for (uint64_t segment_index = 0; segment_index < num_segments; segment_index++) {
+        uint16_t flags = 0;
+        if (mp->trigger_config.triggerType != NO_TRIGGER) {
+            flags = auto_triggered_frame(mp, &trigger_info[segment_index]) ? ARCHIVE_AUTO_TRIGGERED : ARCHIVE_TRIGGERED;
+        }
+        epicsTimeStamp time = mp->block_ready_callback_params->ready_time;
+        epicsTimeAddSeconds(&time, -(double)(last_time_stamp - trigger_info[segment_index].timeStampCounter) 
+                                   * mp->sample_config.timebase_configs.sample_interval_secs);
+        for (size_t i = 0; i < NUM_CHANNELS; i++) {
+            if (!get_channel_status(mp->channel_configs[i].channel, mp->channel_status) || !mp->segment_read_waveform[i]) {
+                continue;
+            }
+            keep_capture(mp, i, &mp->segment_read_waveform[i][segment_index * mp->sample_config.num_samples], 
+                         *mp->sample_collected, &time, flags);
+        }
+    }
+}
+
+// Per segment arrays filled by the bulk read of a rapid block capture 
+struct SegmentReadBuffers {
+    int16_t* overflow;
+    PICO_TRIGGER_INFO* trigger_info;
+};
+
+/**
+ * Allocates the per segment arrays of the bulk read once, for the largest number of segments the 
+ * segment records hold, so each rapid block read reuses them. 
+ * 
+ * @param max_segments uint64_t The number of segments the arrays hold. 
+ * 
+ * @return SegmentReadBuffers Pointer Returns the arrays, or NULL if they could not be allocated. 
+ */
+struct SegmentReadBuffers* create_segment_read_buffers(uint64_t max_segments){
+    struct SegmentReadBuffers* buffers = calloc(1, sizeof(struct SegmentReadBuffers));
+    if (!buffers) {
+        return NULL;
+    }
+    buffers->overflow = calloc(max_segments, sizeof(int16_t));
+    buffers->trigger_info = calloc(max_segments, sizeof(PICO_TRIGGER_INFO));
+    if (!buffers->overflow || !buffers->trigger_info) {
+        free(buffers->overflow);
+        free(buffers->trigger_info);
+        free(buffers);
+        return NULL;
+    }
+    return buffers;
+}
+
+/**
+ * Retrieves every segment of a rapid block capture with a single bulk call, then records the 
+ * trigger time of each segment relative to the first. The segments are read into the bulk read 
+ * waveforms without the segment mutex, the segment records only wait for the copy to the 
+ * segment waveforms. 
+ * 
+ * @param mp PS6000AModule Pointer The PS6000AModule structure containing sample-collection settings.
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+inline PICO_STATUS retrieve_segment_data(struct PS6000AModule* mp) {
+    uint64_t num_segments = mp->sample_config.num_segments;
+    uint64_t start_index = 0;
+    // configure_memory_segments keeps num_segments within the segment records 
+    int16_t* overflow = mp->segment_read_buffers->overflow;
+    PICO_TRIGGER_INFO* trigger_info = mp->segment_read_buffers->trigger_info;
+
+    sdk_acquire(mp, SDK_CMD_DATA);
+    PICO_STATUS status = ps6000aGetValuesBulk(
+        mp->handle,
+        start_index,
+        mp->sample_collected,
+        0,
+        num_segments - 1,
+        mp->sample_config.down_sample_ratio,
+        mp->sample_config.down_sample_ratio_mode,
+        overflow
+    );
+    mp->values_ready_ns = shm_ring_now_ns();
+    if (status != PICO_OK) {
+        sdk_release(mp);
+        log_error("ps6000aGetValuesBulk", status, __FILE__, __LINE__);
+        epicsMutexLock(mp->epics_segment_mutex);
+        *mp->segments_collected = 0;
+        epicsMutexUnlock(mp->epics_segment_mutex);
+        return status;
+    }
+
+    status = ps6000aGetTriggerInfo(mp->handle, trigger_info, 0, num_segments);
+    sdk_release(mp);
+    if (status != PICO_OK) {
+        log_error("ps6000aGetTriggerInfo", status, __FILE__, __LINE__);
+        epicsMutexLock(mp->epics_segment_mutex);
+        *mp->segments_collected = 0;
+        epicsMutexUnlock(mp->epics_segment_mutex);
+        return status;
+    }
+
+    // Segment records are scanned asynchronously, they copy the segment waveforms under the segment mutex 
+    uint64_t segment_samples = num_segments * mp->sample_config.num_samples;
+    if (segment_samples > mp->segment_waveform_size) {
+        segment_samples = mp->segment_waveform_size;
+    }
+    uint64_t missed_triggers = 0;
+    epicsMutexLock(mp->epics_segment_mutex);
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status) && mp->segment_read_waveform[i]) {
+            memcpy(mp->segment_waveform[i], mp->segment_read_waveform[i], segment_samples * sizeof(int16_t));
+        }
+    }
+    for (uint64_t segment_index = 0; segment_index < num_segments; segment_index++) {
+        mp->segment_timestamps[segment_index] = 
+            (double)(trigger_info[segment_index].timeStampCounter - trigger_info[0].timeStampCounter) 
+            * mp->sample_config.timebase_configs.sample_interval_secs;
+        if (segment_index > 0) {
+            missed_triggers += trigger_info[segment_index].missedTriggers;
+        }
+        if (auto_triggered_frame(mp, &trigger_info[segment_index])) {
+            mp->trigger_timing_info->auto_triggered_frames++;
+        }
+    }
+    *mp->segments_collected = num_segments;
+    epicsMutexUnlock(mp->epics_segment_mutex);
+
+    if (keeping_captures(mp)) {
+        keep_segments(mp, trigger_info, num_segments);
+    }
+
+    if (mp->trigger_config.triggerType != NO_TRIGGER && num_segments > 1) {
+        mp->trigger_timing_info->trigger_freq_secs = calculate_trigger_freqency(
+            mp->sample_config.timebase_configs.sample_interval_secs,
+            trigger_info[0].timeStampCounter,
+            trigger_info[num_segments - 1].timeStampCounter,
+            (num_segments - 1) + missed_triggers
+        );
+        mp->trigger_timing_info->missed_triggers = missed_triggers + 1; 
+        mp->trigger_timing_info->prev_trigger_time = trigger_info[num_segments - 1].timeStampCounter;
+    }
+
+    return PICO_OK;
+}
+
 /** 
  * Calculates the time between triggers in seconds using the timestamp counter, missed triggers, and current sample interval. 
  * 
@@ -1377,7 +2678,7 @@ double calculate_trigger_freqency(double sample_interval_secs, uint64_t prev_tim
 
 /** 
  * Update trigger timing information, such as the trigger frequency, number of missed triggers, 
- * and count of previous trigger. 
+ * count of previous trigger, and whether the frame was auto triggered. 
  * 
  * @param mp PS6000AModule Pointer The PS6000AModule structure containing trigger information to be updated.
  *        segment_index uint64_t The memory segment containing the data to retrieve trigger timing from. 
@@ -1387,24 +2688,27 @@ double calculate_trigger_freqency(double sample_interval_secs, uint64_t prev_tim
 inline PICO_STATUS update_trigger_timing_info(struct PS6000AModule* mp, uint64_t segment_index) {
     
     PICO_TRIGGER_INFO triggerInfo[1];        
+    sdk_acquire(mp, SDK_CMD_DATA);
     uint32_t status = ps6000aGetTriggerInfo(mp->handle, triggerInfo, segment_index, 1);
+    sdk_release(mp);
     if (status != PICO_OK) {
         log_error("ps6000aGetTriggerInfo", status, __FILE__, __LINE__);    
         return status; 
     }
 
     // Ensure previous trigger time is from current capture before calculating trigger frequency
-    if (mp->trigger_timing_info.prev_trigger_time != 0 ){
-        mp->trigger_timing_info.trigger_freq_secs = calculate_trigger_freqency(
+    if (mp->trigger_timing_info->prev_trigger_time != 0 ){
+        mp->trigger_timing_info->trigger_freq_secs = calculate_trigger_freqency(
             mp->sample_config.timebase_configs.sample_interval_secs,
-            mp->trigger_timing_info.prev_trigger_time,
+            mp->trigger_timing_info->prev_trigger_time,
             triggerInfo[0].timeStampCounter,
             triggerInfo[0].missedTriggers
         );     
     }
     
-    mp->trigger_timing_info.missed_triggers = triggerInfo[0].missedTriggers;
-    mp->trigger_timing_info.prev_trigger_time = triggerInfo[0].timeStampCounter; 
+    mp->trigger_timing_info->missed_triggers = triggerInfo[0].missedTriggers;
+    mp->trigger_timing_info->prev_trigger_time = triggerInfo[0].timeStampCounter; 
+    mp->trigger_timing_info->auto_triggered = auto_triggered_frame(mp, &triggerInfo[0]);
 
     return status; 
 }
@@ -1412,70 +2716,653 @@ inline PICO_STATUS update_trigger_timing_info(struct PS6000AModule* mp, uint64_t
 
 
 /**
- * Stop picoscope data acquisition.
+ * Creates the frame queue for one channel, with every frame starting on the free queue. Frame 
+ * memory is allocated by reserve_buffer_pool the first time the channel is captured, and resized 
+ * by fit_frame when the number of samples changes. 
  * 
- * @param handle int16_t The handle of picoscope.
- * @return       PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ * @return FrameQueue Pointer Returns the queue, or NULL if it could not be allocated. 
  */
-PICO_STATUS stop_capturing(struct PS6000AModule* mp) {
-    PICO_STATUS status;
-    epicsMutexLock(mp->epics_ps6000a_call_mutex);
-    status = ps6000aStop(mp->handle);
-    epicsMutexUnlock(mp->epics_ps6000a_call_mutex);
-    if (status != PICO_OK) {
-        log_error("wait_for_capture_completion ps6000aStop", status, __FILE__, __LINE__);
+struct FrameQueue* create_frame_queue(void){
+    struct FrameQueue* queue = calloc(1, sizeof(struct FrameQueue)); 
+    if (!queue) {
+        return NULL; 
     }
-    return status;
+    // One spare slot so a ring can hold every frame 
+    queue->ready = epicsRingPointerCreate(FRAME_QUEUE_DEPTH + 1); 
+    queue->free = epicsRingPointerCreate(FRAME_QUEUE_DEPTH + 1); 
+    if (!queue->ready || !queue->free) {
+        if (queue->ready)
+            epicsRingPointerDelete(queue->ready); 
+        if (queue->free)
+            epicsRingPointerDelete(queue->free); 
+        free(queue); 
+        return NULL; 
+    }
+    for (size_t frame_index = 0; frame_index < FRAME_QUEUE_DEPTH; frame_index++) {
+        epicsRingPointerPush(queue->free, &queue->frames[frame_index]); 
+    }
+    return queue; 
 }
 
-void free_subwaveforms(struct PS6000AModule* mp, uint16_t subwaveform_num){
-    for (size_t channel_index = 0; channel_index < NUM_CHANNELS; channel_index++)
-    {
-        if (mp->streamWaveformBuffers[channel_index])
-        {
-            for (uint16_t buffer_index = 0; buffer_index < subwaveform_num; buffer_index++)
-            {
-                free(mp->streamWaveformBuffers[channel_index][buffer_index]);
-            }
-            free(mp->streamWaveformBuffers[channel_index]);
+/**
+ * Returns the buffer the SDK should write the channel's next capture into, which is the frame the 
+ * acquisition thread is filling. A frame is taken from the free queue when the acquisition thread 
+ * has none, if the record still owns every frame the channel waveform is used as a scratch buffer 
+ * and the capture will be dropped. Called from the acquisition thread only. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the frame queues. 
+ *        channel_index size_t The index of the channel to capture. 
+ * 
+ * @return int16_t Pointer Returns the buffer to register with ps6000aSetDataBuffer. 
+ */
+int16_t* acquisition_buffer(struct PS6000AModule* mp, size_t channel_index){
+    struct FrameQueue* queue = mp->frame_queue[channel_index]; 
+    if (!queue) {
+        return mp->waveform[channel_index]; 
+    }
+    if (!queue->filling) {
+        queue->filling = epicsRingPointerPop(queue->free); 
+        if (queue->filling && fit_frame(mp, queue->filling) != PICO_OK) {
+            epicsRingPointerPush(queue->free, queue->filling); 
+            queue->filling = NULL; 
         }
     }
+    return queue->filling ? queue->filling->data : mp->waveform[channel_index]; 
 }
 
-inline bool do_Blocking(struct PS6000AModule* mp){
-    return mp->subwaveform_num == 0;
+/**
+ * Returns the buffer the SDK has just written the channel's capture into, the frame being filled 
+ * or the channel waveform if acquisition_buffer found no free frame. Called from the acquisition 
+ * thread only, before the frame is published. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the frame queues. 
+ *        channel_index size_t The index of the captured channel. 
+ * 
+ * @return int16_t Pointer Returns the captured samples. 
+ */
+int16_t* filled_buffer(struct PS6000AModule* mp, size_t channel_index){
+    struct FrameQueue* queue = mp->frame_queue[channel_index]; 
+    return queue && queue->filling ? queue->filling->data : mp->waveform[channel_index]; 
 }
 
 /**
- * Thread function to handle the data acquisition and process data to epics PV.
+ * Publishes the frame the SDK has just filled to the channel waveform record without copying it. 
+ * The frame is only published when a free frame can take its place, otherwise the capture is 
+ * dropped, counted as an overrun and the frame is filled again. Never blocks. Called from the 
+ * acquisition thread only. 
  * 
- * @param arg Void Pointer Passed in from EPICS thread create, a PS6000A Module pointer.
- * @return    PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the frame queues. 
+ *        channel_index size_t The index of the channel the frame belongs to. 
+ *        samples uint64_t The number of captured samples. 
  */
-void
-acquisition_thread_function(void *arg) {
-    PS6000AModule* mp = malloc(sizeof(PS6000AModule));
-    *mp = *(struct PS6000AModule *)arg;
-    while (1) // keep thread alive
-    {
-        epicsEventWait((epicsEventId)mp->acquisitionStartEvent);
-        *mp = *(struct PS6000AModule *)arg;
-        epicsMutexLock(mp->epics_acquisition_thread_mutex);
-        mp->trigger_timing_info.prev_trigger_time = 0; // wipe previous trigger data  
-        epicsThreadId id = epicsThreadGetIdSelf();
-        printf("Start ID is %ld\n", id->tid);
-        // Setup Picoscope
-        printf("------------ Capture Configurations -----------------\n");
-        printf("Resolution %d\n", mp->resolution);
-        printf("Num samples %ld\n", mp->sample_config.num_samples);
-        printf("timebase %d\n", mp->sample_config.timebase_configs.timebase);
-        printf("pRecordUpdateWaveform aft %p\n", mp->pRecordUpdateWaveform[0]);
+void publish_frame(struct PS6000AModule* mp, size_t channel_index, uint64_t samples){
+    struct FrameQueue* queue = mp->frame_queue[channel_index]; 
+    if (!queue) {
+        return; 
+    }
+    if (!queue->filling) {
+        // Captured into the scratch buffer 
+        queue->overruns++; 
+        return; 
+    }
+    struct Frame* next = epicsRingPointerPop(queue->free); 
+    if (!next) {
+        queue->overruns++; 
+        return; 
+    }
+    if (fit_frame(mp, next) != PICO_OK) {
+        epicsRingPointerPush(queue->free, next); 
+        queue->overruns++; 
+        return; 
+    }
+    if (samples > queue->filling->capacity) {
+        samples = queue->filling->capacity; 
+    }
+    queue->filling->samples = samples; 
+    queue->filling->config_version = mp->config_version; 
+    epicsRingPointerPush(queue->ready, queue->filling); 
+    queue->filling = next; 
+}
 
-        for (size_t i = 0; i < NUM_CHANNELS; i++) {
-            if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status) && mp->pRecordUpdateWaveform[i]) {
-                printf("Updating waveform for Channel: %d, Coupling: %d, Range: %d, Analog Offest: %.10f, Bandwidth: %d\n",
-                 mp->channel_configs[i].channel,
-                 mp->channel_configs[i].coupling,
+/**
+ * Registers each enabled channel's acquisition buffer for a block capture memory segment, 
+ * replacing any buffers registered before. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the frame queues. 
+ *        segment_index uint64_t The memory segment the buffers will be read from. 
+ * 
+ * @return PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+PICO_STATUS register_block_buffers(struct PS6000AModule* mp, uint64_t segment_index){
+    PICO_ACTION action = PICO_CLEAR_ALL | PICO_ADD; 
+    PICO_STATUS status = PICO_OK; 
+
+    for (size_t i = 0; i < NUM_CHANNELS; i++)
+    {
+        if (!get_channel_status(mp->channel_configs[i].channel, mp->channel_status)){
+            continue; 
+        }
+        sdk_acquire(mp, SDK_CMD_DATA);
+        status = ps6000aSetDataBuffer(
+            mp->handle, 
+            mp->channel_configs[i].channel, 
+            acquisition_buffer(mp, i),
+            mp->sample_config.num_samples, 
+            PICO_INT16_T, 
+            segment_index, 
+            mp->sample_config.down_sample_ratio_mode, 
+            action
+        );
+        sdk_release(mp);
+        if (status != PICO_OK) {
+            log_error("ps6000aSetDataBuffer subwaveform_num = 0", status, __FILE__, __LINE__);
+            return status; 
+        }
+        action = PICO_ADD; 
+    }
+    return status; 
+}
+
+/**
+ * Takes the newest ready frame, returning any older ready frames to the free queue. Called from 
+ * the channel waveform record only, the frame must be handed back with release_frame. 
+ * 
+ * @param queue FrameQueue Pointer The channel's frame queue. 
+ * @return      Frame Pointer Returns the newest frame, or NULL if no frame is ready. 
+ */
+struct Frame* take_newest_frame(struct FrameQueue* queue){
+    struct Frame* newest = NULL; 
+    struct Frame* frame; 
+
+    while ((frame = epicsRingPointerPop(queue->ready)) != NULL) {
+        if (newest) {
+            epicsRingPointerPush(queue->free, newest); 
+        }
+        newest = frame; 
+    }
+    return newest; 
+}
+
+void release_frame(struct FrameQueue* queue, struct Frame* frame){
+    epicsRingPointerPush(queue->free, frame); 
+}
+
+/**
+ * Stop picoscope data acquisition. Only the first call after a capture was started stops the 
+ * device, so the capture modes and the acquisition thread can each call it on their way out. 
+ * 
+ * @param mp PS6000AModule Pointer The acquisition thread's module.
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+PICO_STATUS stop_capturing(struct PS6000AModule* mp) {
+    PICO_STATUS status;
+    if (!mp->capture_armed) {
+        return PICO_OK;
+    }
+    mp->capture_armed = 0;
+    sdk_acquire(mp, SDK_CMD_CAPTURE);
+    status = ps6000aStop(mp->handle);
+    sdk_release(mp);
+    if (status != PICO_OK) {
+        log_error("wait_for_capture_completion ps6000aStop", status, __FILE__, __LINE__);
+    }
+    return status;
+}
+
+/**
+ * Resizes a frame to the buffer pool frame size if the number of samples changed since the frame 
+ * was last sized. The frame must be owned by the acquisition thread, either the frame being 
+ * filled or one just popped from the free queue. 
+ * 
+ * @param mp    PS6000AModule Pointer to the PS6000AModule structure containing the buffer pool. 
+ *        frame Frame Pointer The frame to resize. 
+ * 
+ * @return PICO_STATUS Returns PICO_OK (0) on success, or PICO_MEMORY_FAIL if the frame could not be allocated.
+ */
+PICO_STATUS fit_frame(struct PS6000AModule* mp, struct Frame* frame){
+    struct BufferPool* pool = mp->buffer_pool; 
+
+    if (frame->data && frame->capacity == pool->buffer_samples) {
+        return PICO_OK; 
+    }
+    free(frame->data); 
+    pool->allocated_bytes -= frame->capacity * sizeof(int16_t); 
+    frame->capacity = 0; 
+    frame->samples = 0; 
+    frame->data = (int16_t*)calloc(pool->buffer_samples, sizeof(int16_t)); 
+    if (!frame->data) {
+        return PICO_MEMORY_FAIL; 
+    }
+    frame->capacity = pool->buffer_samples; 
+    pool->allocated_bytes += frame->capacity * sizeof(int16_t); 
+    if (pool->allocated_bytes > pool->peak_bytes) {
+        pool->peak_bytes = pool->allocated_bytes; 
+    }
+    return PICO_OK; 
+}
+
+/**
+ * Sizes the frames of each enabled channel to the configured number of samples, capped at the 
+ * channel waveform NELM. Called between captures. Frames that were never captured into are only 
+ * on the free queue and are allocated here, as is the frame being filled. Frames queued for or 
+ * held by a waveform record keep their size until they come back through the free queue, where 
+ * fit_frame resizes them before the SDK captures into them again. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the buffer pool. 
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or PICO_MEMORY_FAIL if a frame could not be allocated.
+ */
+PICO_STATUS reserve_buffer_pool(struct PS6000AModule* mp){
+    struct BufferPool* pool = mp->buffer_pool; 
+    uint64_t buffer_samples = mp->sample_config.num_samples; 
+    PICO_STATUS status; 
+
+    // Longer captures are streamed in waveform sized pieces 
+    if (buffer_samples > mp->waveform_size) {
+        buffer_samples = mp->waveform_size; 
+    }
+    if (mp->sample_config.subwaveform_samples_num > buffer_samples) {
+        return PICO_MEMORY_FAIL; 
+    }
+    pool->buffer_samples = buffer_samples; 
+
+    for (size_t channel_index = 0; channel_index < NUM_CHANNELS; channel_index++)
+    {
+        struct FrameQueue* queue = mp->frame_queue[channel_index]; 
+        if (!queue || !get_channel_status(mp->channel_configs[channel_index].channel, mp->channel_status)) {
+            continue; 
+        }
+        if (queue->filling) {
+            status = fit_frame(mp, queue->filling); 
+            if (status != PICO_OK) {
+                return status; 
+            }
+        }
+        // Frames without memory are only ever on the free queue, which the record does not read 
+        for (size_t frame_index = 0; frame_index < FRAME_QUEUE_DEPTH; frame_index++)
+        {
+            if (queue->frames[frame_index].data) {
+                continue; 
+            }
+            status = fit_frame(mp, &queue->frames[frame_index]); 
+            if (status != PICO_OK) {
+                return status; 
+            }
+        }
+    }
+    return PICO_OK; 
+}
+
+inline bool do_Blocking(struct PS6000AModule* mp){
+    return mp->subwaveform_num == 0;
+}
+
+inline bool do_Rapid_Block(struct PS6000AModule* mp){
+    return do_Blocking(mp) && mp->sample_config.num_segments > 1;
+}
+
+inline bool do_Double_Buffered_Block(struct PS6000AModule* mp){
+    return do_Blocking(mp) && !do_Rapid_Block(mp) && mp->sample_config.double_buffer;
+}
+
+/**
+ * Runs block captures back to back using two memory segments. As soon as ps6000aGetValues has 
+ * read one segment into the channel frames, the next capture is armed into the other segment, 
+ * then the records are scanned on the EPICS callback threads while the device captures, so record 
+ * processing does not add to the trigger dead time. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing data acquisition settings. 
+ * @return   PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+PICO_STATUS run_double_buffered_block_capture(struct PS6000AModule* mp){
+    double time_indisposed_ms = 0;
+    PICO_STATUS status; 
+
+    mp->block_segment_index = 0; 
+    *mp->sample_collected = mp->sample_config.num_samples;
+    status = start_block_capture(mp, &time_indisposed_ms);
+    if (status == PICO_CANCELLED) {
+        return PICO_OK;
+    }
+    if (status != PICO_OK) {
+        log_error("start_block_capture", status, __FILE__, __LINE__);
+        return status;
+    }
+
+    while (acquisition_state(mp) == ACQ_RUNNING) {
+        status = wait_for_capture_completion(mp);
+        if (status == PICO_CANCELLED) {
+            status = PICO_OK; 
+            break; 
+        }
+        // A timed out or re-armed capture has been stopped, arm the next one without publishing 
+        int timed_out = status == PICO_TIMEOUT;
+        if (status != PICO_OK && !timed_out) {
+            log_error("wait_for_capture_completion", status, __FILE__, __LINE__);
+            break;
+        }
+        // Rearm into the other memory segment before the records publish this frame, 
+        // with any trigger change written during the capture 
+        apply_config_update(mp);
+        mp->block_segment_index = 1 - mp->block_segment_index; 
+        *mp->sample_collected = mp->sample_config.num_samples;
+        status = start_block_capture(mp, &time_indisposed_ms);
+        if (status == PICO_CANCELLED) {
+            status = PICO_OK; 
+            break; 
+        }
+        if (status != PICO_OK) {
+            log_error("start_block_capture", status, __FILE__, __LINE__);
+            break;
+        }
+
+        if (timed_out) {
+            scanIoRequest(mp->trigger_timing_scan);
+        } else {
+            request_waveform_scans(mp); 
+        }
+    }
+    return status; 
+}
+
+/**
+ * Requests I/O Intr scans of the waveform records of every enabled channel and of the trigger 
+ * timing records. The records are processed on the EPICS callback threads. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure containing the scan lists. 
+ */
+void request_waveform_scans(struct PS6000AModule* mp){
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status)) {
+            scanIoRequest(mp->waveform_scan[i]);
+        }
+    }
+    if (do_Rapid_Block(mp)) {
+        scanIoRequest(mp->segments_scan);
+    }
+    scanIoRequest(mp->trigger_timing_scan);
+}
+
+/**
+ * Allocates an acquisition state machine in the IDLE state. 
+ * 
+ * @return Pointer to the new AcquisitionStateMachine, or NULL on failure. 
+ */
+struct AcquisitionStateMachine* create_acquisition_state_machine(void){
+    struct AcquisitionStateMachine* sm = calloc(1, sizeof(struct AcquisitionStateMachine));
+    if (!sm) {
+        return NULL;
+    }
+    sm->lock = epicsMutexCreate();
+    sm->start_event = epicsEventCreate(epicsEventEmpty);
+    sm->idle_event = epicsEventCreate(epicsEventEmpty);
+    sm->cancel_event = epicsEventCreate(epicsEventEmpty);
+    if (!sm->lock || !sm->start_event || !sm->idle_event || !sm->cancel_event) {
+        if (sm->lock)
+            epicsMutexDestroy(sm->lock);
+        if (sm->start_event)
+            epicsEventDestroy(sm->start_event);
+        if (sm->idle_event)
+            epicsEventDestroy(sm->idle_event);
+        if (sm->cancel_event)
+            epicsEventDestroy(sm->cancel_event);
+        free(sm);
+        return NULL;
+    }
+    epicsAtomicSetIntT(&sm->state, ACQ_IDLE);
+    epicsTimeGetCurrent(&sm->entered[ACQ_IDLE]);
+    scanIoInit(&sm->state_scan);
+    return sm;
+}
+
+// Frees an acquisition state machine whose acquisition thread is not running 
+void destroy_acquisition_state_machine(struct AcquisitionStateMachine* sm){
+    epicsMutexDestroy(sm->lock);
+    epicsEventDestroy(sm->start_event);
+    epicsEventDestroy(sm->idle_event);
+    epicsEventDestroy(sm->cancel_event);
+    free(sm);
+}
+
+/**
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure. 
+ * @return   The current acquisition state, read without locking. 
+ */
+enum AcquisitionState acquisition_state(struct PS6000AModule* mp){
+    return (enum AcquisitionState)epicsAtomicGetIntT(&mp->acquisition->state);
+}
+
+/**
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure. 
+ * @return   Non-zero while the acquisition is starting or running and has not been asked to stop. 
+ */
+int acquisition_active(struct PS6000AModule* mp){
+    enum AcquisitionState state = acquisition_state(mp);
+    return state == ACQ_ARMING || state == ACQ_RUNNING;
+}
+
+/**
+ * Moves the state machine from one state to another if it is in the expected state, and 
+ * timestamps the new state. Called with the state machine lock held. 
+ * 
+ * @param sm   AcquisitionStateMachine Pointer to the state machine. 
+ * @param from AcquisitionState The state the transition starts from. 
+ * @param to   AcquisitionState The new state. 
+ * 
+ * @return     Non-zero if the transition was made. 
+ */
+static int transition_acquisition(struct AcquisitionStateMachine* sm, enum AcquisitionState from, enum AcquisitionState to){
+    if (epicsAtomicCmpAndSwapIntT(&sm->state, from, to) != (int)from) {
+        return 0;
+    }
+    epicsTimeGetCurrent(&sm->entered[to]);
+    scanIoRequest(sm->state_scan);
+    return 1;
+}
+
+/**
+ * Requests an acquisition start, IDLE -> ARMING, and wakes the acquisition thread. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure. 
+ * @return   0 on success, -1 if the acquisition is not idle. 
+ */
+int request_acquisition_start(struct PS6000AModule* mp){
+    struct AcquisitionStateMachine* sm = mp->acquisition;
+
+    epicsMutexLock(sm->lock);
+    int started = transition_acquisition(sm, ACQ_IDLE, ACQ_ARMING);
+    epicsMutexUnlock(sm->lock);
+    if (!started) {
+        return -1;
+    }
+    epicsEventSignal(sm->start_event);
+    return 0;
+}
+
+/**
+ * Requests the acquisition to stop, ARMING or RUNNING -> DRAINING, and cancels a capture 
+ * waiting for its trigger. Returns without waiting, see wait_acquisition_idle. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure. 
+ */
+void request_acquisition_stop(struct PS6000AModule* mp){
+    struct AcquisitionStateMachine* sm = mp->acquisition;
+
+    epicsMutexLock(sm->lock);
+    if (!transition_acquisition(sm, ACQ_RUNNING, ACQ_DRAINING)) {
+        transition_acquisition(sm, ACQ_ARMING, ACQ_DRAINING);
+    }
+    epicsMutexUnlock(sm->lock);
+    epicsEventSignal(sm->cancel_event);
+    epicsEventSignal(mp->triggerReadyEvent);
+}
+
+/**
+ * The longest a stop request can take to reach IDLE: a missed wake up costs one trigger wait 
+ * slice, a refused SDK call is retried at most SDK_RETRY_MAX times before the capture gives up, 
+ * an SDK call already in progress, such as a bulk read or a timebase table build, runs to the 
+ * end, and ps6000aStop is called. SDK calls cannot be interrupted, so the last two are the 
+ * longest calls seen so far, and the bound only holds while no call takes longer than those. 
+ * 
+ * @param mp PS6000AModule Pointer to the module, for its SDK command statistics. 
+ * @return   Worst case stop latency in seconds. 
+ */
+double stop_latency_bound(struct PS6000AModule* mp){
+    struct SdkQueue* queue = mp->sdk_queue;
+    double longest_ms = 0;
+
+    epicsMutexLock(queue->lock);
+    for (size_t type = 0; type < NUM_SDK_COMMAND_TYPES; type++) {
+        if (queue->stats[type].max_service_ms > longest_ms) {
+            longest_ms = queue->stats[type].max_service_ms;
+        }
+    }
+    double stop_ms = queue->stats[SDK_CMD_CAPTURE].max_service_ms;
+    epicsMutexUnlock(queue->lock);
+
+    return CANCEL_CHECK_SECS + SDK_RETRY_MAX * SDK_RETRY_DELAY_SECS + (longest_ms + stop_ms) * 1e-3;
+}
+
+/**
+ * Blocks until the acquisition thread has stopped and the state machine is IDLE. 
+ * 
+ * @param mp PS6000AModule Pointer to the PS6000AModule structure. 
+ */
+void wait_acquisition_idle(struct PS6000AModule* mp){
+    struct AcquisitionStateMachine* sm = mp->acquisition;
+
+    while (acquisition_state(mp) != ACQ_IDLE) {
+        epicsEventWaitWithTimeout(sm->idle_event, 0.1);
+    }
+    // Pass the wake up on to any other waiter 
+    epicsEventSignal(sm->idle_event);
+}
+
+/**
+ * Acquisition thread side of a start: ARMING -> RUNNING once the device is set up. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's copy of the module. 
+ * @return   Non-zero if running, zero if a stop was requested while arming. 
+ */
+static int enter_acquisition_running(struct PS6000AModule* mp){
+    struct AcquisitionStateMachine* sm = mp->acquisition;
+
+    epicsMutexLock(sm->lock);
+    int running = transition_acquisition(sm, ACQ_ARMING, ACQ_RUNNING);
+    if (running) {
+        sm->last_start_latency = epicsTimeDiffInSeconds(&sm->entered[ACQ_RUNNING], &sm->entered[ACQ_ARMING]);
+    }
+    epicsMutexUnlock(sm->lock);
+    return running;
+}
+
+/**
+ * Acquisition thread side of a stop: whatever the state, through DRAINING to IDLE, and wakes the 
+ * threads waiting for the stop. The stop latency is only recorded for requested stops. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's copy of the module. 
+ */
+static void enter_acquisition_idle(struct PS6000AModule* mp){
+    struct AcquisitionStateMachine* sm = mp->acquisition;
+
+    epicsMutexLock(sm->lock);
+    int requested = acquisition_state(mp) == ACQ_DRAINING;
+    transition_acquisition(sm, ACQ_ARMING, ACQ_DRAINING);
+    transition_acquisition(sm, ACQ_RUNNING, ACQ_DRAINING);
+    transition_acquisition(sm, ACQ_DRAINING, ACQ_IDLE);
+    if (requested) {
+        sm->last_stop_latency = epicsTimeDiffInSeconds(&sm->entered[ACQ_IDLE], &sm->entered[ACQ_DRAINING]);
+        if (sm->last_stop_latency > sm->max_stop_latency) {
+            sm->max_stop_latency = sm->last_stop_latency;
+        }
+    }
+    epicsMutexUnlock(sm->lock);
+    epicsEventSignal(sm->idle_event);
+}
+
+/**
+ * Opens a capture archive for the acquisition about to run if recording is enabled, and sizes 
+ * the post-mortem ring if it is enabled. The acquisition runs without either if it cannot be 
+ * started. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's module. 
+ */
+static void start_recording(struct PS6000AModule* mp){
+    enum ArchiveCaptureMode mode = ARCHIVE_STREAMING;
+
+    if (do_Rapid_Block(mp)) {
+        mode = ARCHIVE_RAPID_BLOCK;
+    } else if (do_Blocking(mp)) {
+        mode = ARCHIVE_BLOCK;
+    }
+    mp->recording = 0;
+    if (mp->sample_config.record_to_disk) {
+        mp->recording = recorder_start(mp, mode) == 0;
+        if (!mp->recording) {
+            update_log_pvs(mp, "Error starting the capture archive, acquiring without recording.", PICO_MEMORY_FAIL);
+        }
+    }
+    mp->post_mortem_active = post_mortem_start(mp, mode) == 0;
+    if (!mp->post_mortem_active && mp->sample_config.post_mortem_frames > 0) {
+        update_log_pvs(mp, "Error allocating the post-mortem ring, acquiring without it.", PICO_MEMORY_FAIL);
+    }
+}
+
+/**
+ * Ends the capture archive and stops filling the post-mortem ring. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's module. 
+ */
+static void stop_recording(struct PS6000AModule* mp){
+    if (mp->recording) {
+        recorder_stop(mp);
+        mp->recording = 0;
+    }
+    if (mp->post_mortem_active) {
+        post_mortem_stop(mp);
+        mp->post_mortem_active = 0;
+    }
+}
+
+/**
+ * Thread function to handle the data acquisition and process data to epics PV.
+ * 
+ * @param arg Void Pointer Passed in from EPICS thread create, a PS6000A Module pointer.
+ * @return    PICO_STATUS Returns PICO_OK (0) on success, or a non-zero error code on failure.
+ */
+void
+acquisition_thread_function(void *arg) {
+    PS6000AModule* mp = malloc(sizeof(PS6000AModule));
+    *mp = *(struct PS6000AModule *)arg;
+    while (1) // keep thread alive
+    {
+        epicsEventWait(mp->acquisition->start_event);
+        if (acquisition_state(mp) != ACQ_ARMING) {
+            // Stopped before the thread woke 
+            enter_acquisition_idle(mp);
+            continue;
+        }
+        // Handles, records and shared state come from the module, the settings from the 
+        // snapshot published at the start or restart, never from fields CA may be writing 
+        *mp = *(struct PS6000AModule *)arg;
+        load_config(mp);
+        mp->capture_armed = 0;
+        epicsEventTryWait(mp->acquisition->cancel_event);   // Drop a stop request left from the last run 
+
+        mp->trigger_timing_info->prev_trigger_time = 0; // wipe previous trigger data  
+        epicsThreadId id = epicsThreadGetIdSelf();
+        printf("Start ID is %ld\n", id->tid);
+        // Setup Picoscope
+        printf("------------ Capture Configurations -----------------\n");
+        printf("Resolution %d\n", mp->resolution);
+        printf("Num samples %ld\n", mp->sample_config.num_samples);
+        printf("timebase %d\n", mp->sample_config.timebase_configs.timebase);
+        printf("pRecordUpdateWaveform aft %p\n", mp->pRecordUpdateWaveform[0]);
+
+        for (size_t i = 0; i < NUM_CHANNELS; i++) {
+            if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status) && mp->pRecordUpdateWaveform[i]) {
+                printf("Updating waveform for Channel: %d, Coupling: %d, Range: %d, Analog Offest: %.10f, Bandwidth: %d\n",
+                 mp->channel_configs[i].channel,
+                 mp->channel_configs[i].coupling,
                  mp->channel_configs[i].range,
                  mp->channel_configs[i].analog_offset,
                  mp->channel_configs[i].bandwidth);
@@ -1485,38 +3372,51 @@ acquisition_thread_function(void *arg) {
         printf("Time per divisions %f\n", mp->sample_config.timebase_configs.time_per_division);
         printf("Time per divisions unit %d\n", mp->sample_config.timebase_configs.time_per_division_unit);
         printf("Sample Interval (secs) %.10f\n", mp->sample_config.timebase_configs.sample_interval_secs);
+        printf("Trigger channel %d\n", mp->trigger_config.channel);
+        printf("Trigger type %d\n", mp->trigger_config.triggerType);
+        printf("Trigger direction %d, Trigger mode %d\n", mp->trigger_config.thresholdDirection, mp->trigger_config.thresholdMode);
+        printf("Trigger Upper Threshold %d, Trigger Lower Threshold %d\n", mp->trigger_config.thresholdUpper, mp->trigger_config.thresholdLower);
+        printf("Trigger Upper Hysteresis %d, Trigger Lower Hysteresis %d\n", mp->trigger_config.thresholdUpperHysteresis, mp->trigger_config.thresholdLowerHysteresis);
+        printf("Trigger Position Ratio %f\n", mp->sample_config.trigger_position_ratio);
         PICO_STATUS status = setup_picoscope(mp);
         if (status != 0) {
             log_error("Error configuring picoscope for data capture.", status, __FILE__, __LINE__);
             update_log_pvs(mp, "Error configuring picoscope for data capture.", status);
-            epicsMutexLock(mp->epics_acquisition_flag_mutex);
-            *mp->dataAcquisitionFlag = 0;
-            epicsMutexUnlock(mp->epics_acquisition_flag_mutex);
-            epicsMutexUnlock(mp->epics_acquisition_thread_mutex);
-            // free(mp);
+            enter_acquisition_idle(mp);
             continue;
         }
         uint16_t subwaveform_num = mp->subwaveform_num;
         printf("subwaveform_num %d, subwaveform_samples_num %ld\n\n", subwaveform_num, mp->sample_config.subwaveform_samples_num);
         printf("------------ Capture Configurations OVER--------------\n");
 
-        while (*mp->dataAcquisitionFlag == 1) {
+        start_recording(mp);
+        enter_acquisition_running(mp);
+        while (acquisition_state(mp) == ACQ_RUNNING) {
             double time_indisposed_ms = 0;
-            if (do_Blocking(mp)){
+            apply_config_update(mp);
+            if (do_Double_Buffered_Block(mp)){
+                // Runs until acquisition stops, records are scanned after each capture 
+                status = run_double_buffered_block_capture(mp);
+                if (status != PICO_OK) {
+                    log_error("Error capturing block data.", status, __FILE__, __LINE__);
+                    update_log_pvs(mp, "Error capturing block data.", status);
+                }
+                break;
+            }else if (do_Blocking(mp)){
+                mp->block_segment_index = 0;
                 *mp->sample_collected = mp->sample_config.num_samples;
                 status = run_block_capture(mp, &time_indisposed_ms);
+                if (status == PICO_TIMEOUT) {
+                    // Nothing captured, keep acquiring 
+                    scanIoRequest(mp->trigger_timing_scan);
+                    continue;
+                }
                 if (status != PICO_OK) {
                     log_error("Error capturing block data.", status, __FILE__, __LINE__);
                     update_log_pvs(mp, "Error capturing block data.", status);
                     break;
                 }
-                // Process the UPDATE_WAVEFORM subroutine to update waveform
-                for (size_t i = 0; i < NUM_CHANNELS; i++) {
-                    if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status) && mp->pRecordUpdateWaveform[i]) {
-                        dbProcess((struct dbCommon *)mp->pRecordUpdateWaveform[i]);
-                    }
-                }
-
+                request_waveform_scans(mp);
             }else{
                 set_data_buffer(mp);
                 status = run_stream_capture(mp);
@@ -1525,19 +3425,14 @@ acquisition_thread_function(void *arg) {
                     update_log_pvs(mp, "Error capturing stream data.", status);
                     break;
                 }
+                scanIoRequest(mp->trigger_timing_scan);
             }
-
-            dbProcess((dbCommon*) mp->pTriggerFrequency);
-            dbProcess((dbCommon*) mp->pTriggersMissed); 
         }
-        free_subwaveforms(mp, subwaveform_num);
 
         stop_capturing(mp);
+        stop_recording(mp);
         printf("Cleanup ID is %ld\n", id->tid);
-        epicsMutexLock(mp->epics_acquisition_flag_mutex);
-        *mp->dataAcquisitionFlag = 0;
-        epicsMutexUnlock(mp->epics_acquisition_flag_mutex);
-        epicsMutexUnlock(mp->epics_acquisition_thread_mutex);
+        enter_acquisition_idle(mp);
 
     }
         free(mp);
@@ -1548,60 +3443,140 @@ acquisition_thread_function(void *arg) {
  ***********************************************/
 struct PS6000AModule*
 PS6000AGetModule(char* serial_num){
-    for (size_t i = 0; i < MAX_PICO; i++) {
-        if (PS6000AModuleList[i] != NULL && strcmp(serial_num, PS6000AModuleList[i]->serial_num) == 0) {
-            return PS6000AModuleList[i];
+    for (ELLNODE* node = ellFirst(&PS6000AModuleList); node != NULL; node = ellNext(node)) {
+        struct PS6000AModule* mp = (struct PS6000AModule*)node;
+        if (strcmp(serial_num, mp->serial_num) == 0) {
+            return mp;
         }
     }
     // log_error("PS6000AGetModule. Device does not exist.", PICO_NOT_FOUND, __FILE__, __LINE__);
     return NULL;
 }
 
-static int init_module(char* serial_num) { 
+/**
+ * Stops the threads init_module started, in the reverse order. The acquisition thread is 
+ * started last, so it is never running when this is needed. 
+ * 
+ * @param mp PS6000AModule Pointer to the module being torn down. 
+ */
+static void stop_module_threads(struct PS6000AModule* mp) { 
+    if (mp->post_mortem->thread)
+        stop_post_mortem(mp->post_mortem);
+    if (mp->recorder->thread)
+        stop_recorder(mp->recorder);
+    if (mp->async_writer->thread)
+        stop_async_writer(mp->async_writer);
+    if (mp->restart_coalescer->thread)
+        stop_restart_coalescer(mp->restart_coalescer);
+}
+
+/**
+ * Frees what init_module created, in the reverse order. Every thread of the module has been 
+ * stopped, or was never started. Members that were not created are NULL. 
+ * 
+ * @param mp PS6000AModule Pointer to the module being torn down. 
+ */
+static void destroy_module_objects(struct PS6000AModule* mp) { 
+    if (mp->post_mortem)
+        destroy_post_mortem(mp->post_mortem);
+    if (mp->recorder)
+        destroy_recorder(mp->recorder);
+    if (mp->async_writer)
+        destroy_async_writer(mp->async_writer);
+    if (mp->restart_coalescer)
+        destroy_restart_coalescer(mp->restart_coalescer);
+    if (mp->timebase_lut)
+        destroy_timebase_lut(mp->timebase_lut);
+    if (mp->device_cache)
+        destroy_device_cache(mp->device_cache);
+    if (mp->sdk_queue)
+        destroy_sdk_queue(mp->sdk_queue);
+    if (mp->config_store)
+        destroy_config_store(mp->config_store);
+    if (mp->epics_segment_mutex)
+        epicsMutexDestroy(mp->epics_segment_mutex);
+    if (mp->acquisition)
+        destroy_acquisition_state_machine(mp->acquisition);
+    if (mp->log_lock)
+        epicsMutexDestroy(mp->log_lock);
+    free(mp->applied_config);
+    free(mp->trigger_timing_info);
+    free(mp->buffer_pool);
+    free(mp->stream_poll_stats);
+    free(mp->segments_collected);
+    free(mp->sample_collected);
+    free(mp->block_ready_callback_params);
+    if (mp->triggerReadyEvent)
+        epicsEventDestroy(mp->triggerReadyEvent);
+}
+
+static int init_module(struct PS6000AModule* mp) { 
+    char thread_name[32];
 
-	PS6000AModule *mp = PS6000AGetModule(serial_num);
     mp->triggerReadyEvent = epicsEventCreate(0);
-    mp->acquisitionStartEvent = epicsEventCreate(0);
-    for (size_t i = 0; i < NUM_CHANNELS; i++){
-        mp->channelStreamingFinishedEvents[i] = epicsEventCreate(0);
-    }
-    mp->dataAcquisitionFlag = calloc(1 ,sizeof(int8_t));
+    mp->block_ready_callback_params = calloc(1 ,sizeof(struct BlockReadyCallbackParams));
     mp->sample_collected = calloc(1 ,sizeof(uint64_t));
-
-    mp->epics_acquisition_restart_mutex = epicsMutexCreate();
-    mp->epics_acquisition_flag_mutex = epicsMutexCreate();
-    mp->epics_acquisition_thread_mutex = epicsMutexCreate();
-    mp->epics_ps6000a_call_mutex = epicsMutexCreate();
-
-    if (!mp->epics_acquisition_flag_mutex ||
-        !mp->epics_acquisition_thread_mutex ||
-        !mp->epics_acquisition_restart_mutex ||
-        !mp->epics_ps6000a_call_mutex) {
+    mp->segments_collected = calloc(1 ,sizeof(uint64_t));
+    mp->stream_poll_stats = calloc(1 ,sizeof(struct StreamPollStats));
+    mp->buffer_pool = calloc(1 ,sizeof(struct BufferPool));
+    mp->trigger_timing_info = calloc(1 ,sizeof(struct TriggerTimingInfo));
+    mp->applied_config = calloc(1 ,sizeof(struct AppliedConfig));
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        scanIoInit(&mp->waveform_scan[i]);
+    }
+    scanIoInit(&mp->segments_scan);
+    scanIoInit(&mp->trigger_timing_scan);
+
+    mp->log_lock = epicsMutexCreate();
+    mp->acquisition = create_acquisition_state_machine();
+    mp->epics_segment_mutex = epicsMutexCreate();
+    mp->config_store = create_config_store();
+    mp->sdk_queue = create_sdk_queue();
+    mp->device_cache = create_device_cache();
+    mp->timebase_lut = create_timebase_lut(mp->serial_num);
+    mp->restart_coalescer = create_restart_coalescer();
+    mp->async_writer = create_async_writer();
+    mp->recorder = create_recorder();
+    mp->post_mortem = create_post_mortem();
+
+    if (!mp->triggerReadyEvent ||
+        !mp->block_ready_callback_params ||
+        !mp->sample_collected ||
+        !mp->segments_collected ||
+        !mp->stream_poll_stats ||
+        !mp->buffer_pool ||
+        !mp->trigger_timing_info ||
+        !mp->applied_config ||
+        !mp->log_lock ||
+        !mp->acquisition ||
+        !mp->epics_segment_mutex ||
+        !mp->config_store ||
+        !mp->sdk_queue ||
+        !mp->device_cache ||
+        !mp->timebase_lut ||
+        !mp->restart_coalescer ||
+        !mp->async_writer ||
+        !mp->recorder ||
+        !mp->post_mortem) {
         
-        // Clean up any mutexes that were successfully created
-        if (mp->epics_acquisition_flag_mutex)
-            epicsMutexDestroy(mp->epics_acquisition_flag_mutex);
-        if (mp->epics_acquisition_thread_mutex)
-            epicsMutexDestroy(mp->epics_acquisition_thread_mutex);
-        if (mp->epics_acquisition_restart_mutex)
-            epicsMutexDestroy(mp->epics_acquisition_restart_mutex);
-        if (mp->epics_ps6000a_call_mutex)
-            epicsMutexDestroy(mp->epics_ps6000a_call_mutex);
-
-        free(mp);
-        log_error("Mutex creation failed\n", -1, __FILE__, __LINE__);
+        destroy_module_objects(mp);
+        log_error("Module allocation failed\n", PICO_MEMORY_FAIL, __FILE__, __LINE__);
         return -1;
     }
 
     mp->subwaveform_num = 0;
-    // Create capture thread
-    mp->acquisition_thread_function = epicsThreadCreate("captureThread", epicsThreadPriorityMedium,
-                                                     0, (EPICSTHREADFUNC)acquisition_thread_function, mp);
-    if (!mp->acquisition_thread_function) {
+    // Capture thread is named after the module so each scope's thread can be told apart 
+    snprintf(thread_name, sizeof(thread_name), "capture%s", mp->serial_num);
+    // Threads only start once everything they use exists, a failed start stops the ones before it 
+    if (start_restart_coalescer(mp) != 0 ||
+        start_async_writer(mp) != 0 ||
+        start_recorder(mp) != 0 ||
+        start_post_mortem(mp) != 0 ||
+        !(mp->acquisition_thread_function = epicsThreadCreate(thread_name, epicsThreadPriorityMedium,
+                                                     0, (EPICSTHREADFUNC)acquisition_thread_function, mp))) {
+        stop_module_threads(mp);
+        destroy_module_objects(mp);
         log_error("Thread creation failed\n", -1, __FILE__, __LINE__);
-        epicsMutexLock(mp->epics_acquisition_flag_mutex);
-        *mp->dataAcquisitionFlag = 0;
-        epicsMutexUnlock(mp->epics_acquisition_flag_mutex);
         return -1;
     }
 
@@ -1623,20 +3598,16 @@ PS6000ACreateModule(char* serial_num){
         log_error("PS6000ACreateModule strdup", PICO_MEMORY_FAIL, __FILE__, __LINE__);
         return NULL;
     }
-    
-    for (size_t i = 0; i < MAX_PICO; i++) {
-        if (PS6000AModuleList[i] == NULL) {
-            PS6000AModuleList[i] = mp;
-        }
-    }   
 
-    if (init_module(serial_num) < 0 ){ 
+    if (init_module(mp) < 0 ){ 
         free(mp->serial_num);
         free(mp);
         log_error("PS6000ACreateModule", PICO_NO_APPS_AVAILABLE, __FILE__, __LINE__);
         return NULL; 
     }
 
+    // Only fully initialised modules are registered 
+    ellAdd(&PS6000AModuleList, &mp->node);
     return mp; 
 }
 
@@ -1664,9 +3635,302 @@ static iocshArg setPS6000AArg0 = { "Serial Number", iocshArgString };
 static const iocshArg * setPS6000AArgs[1] = {&setPS6000AArg0};
 static iocshFuncDef PS6000ASetupDef = {"PS6000ASetup", 1, &setPS6000AArgs[0]};
 
+static void
+PS6000ATimebaseCacheDirCB( const iocshArgBuf *arglist)
+{
+	free(timebase_cache_dir);
+	timebase_cache_dir = arglist[0].sval ? strdup(arglist[0].sval) : NULL;
+}
+
+static iocshArg timebaseCacheDirArg0 = { "Directory", iocshArgString };
+static const iocshArg * timebaseCacheDirArgs[1] = {&timebaseCacheDirArg0};
+static iocshFuncDef PS6000ATimebaseCacheDirDef = {"PS6000ATimebaseCacheDir", 1, &timebaseCacheDirArgs[0]};
+
+static void
+PS6000ARecorderDirCB( const iocshArgBuf *arglist)
+{
+	set_recorder_dir(arglist[0].sval);
+}
+
+static iocshArg recorderDirArg0 = { "Directory", iocshArgString };
+static const iocshArg * recorderDirArgs[1] = {&recorderDirArg0};
+static iocshFuncDef PS6000ARecorderDirDef = {"PS6000ARecorderDir", 1, &recorderDirArgs[0]};
+
+/**
+ * Opens the data socket of a module, after PS6000ASetup. Each module needs its own endpoint. 
+ * 
+ * @param serial_num Serial number of the module. 
+ * @param endpoint   Unix domain socket path, TCP port on the loopback interface, or address:port. 
+ */
+static void start_data_server(const char* serial_num, const char* endpoint){
+    struct PS6000AModule* mp = PS6000AGetModule((char*)serial_num);
+
+    if (!mp) {
+        printf("PS6000ADataServer: no module with serial number %s\n", serial_num ? serial_num : "");
+        return;
+    }
+    if (!endpoint || !endpoint[0]) {
+        printf("PS6000ADataServer: no endpoint given\n");
+        return;
+    }
+    if (mp->data_server) {
+        printf("PS6000ADataServer: %s already has a data server\n", mp->serial_num);
+        return;
+    }
+    mp->data_server = create_data_server(mp, endpoint);
+    if (!mp->data_server) {
+        printf("PS6000ADataServer: failed to start the data server of %s\n", mp->serial_num);
+    }
+}
+
+static void
+PS6000ADataServerCB( const iocshArgBuf *arglist)
+{
+	start_data_server(arglist[0].sval, arglist[1].sval);
+}
+
+static iocshArg dataServerArg0 = { "Serial Number", iocshArgString };
+static iocshArg dataServerArg1 = { "Endpoint", iocshArgString };
+static const iocshArg * dataServerArgs[2] = {&dataServerArg0, &dataServerArg1};
+static iocshFuncDef PS6000ADataServerDef = {"PS6000ADataServer", 2, &dataServerArgs[0]};
+
+static void
+PS6000ADataServerBenchmarkCB( const iocshArgBuf *arglist)
+{
+	struct PS6000AModule* mp = PS6000AGetModule(arglist[0].sval);
+	int samples = arglist[1].ival > 0 ? arglist[1].ival : 100000;
+	double seconds = arglist[2].dval > 0 ? arglist[2].dval : 5.0;
+	if (!mp) {
+		printf("PS6000ADataServerBenchmark: no module with serial number %s\n", arglist[0].sval ? arglist[0].sval : "");
+		return;
+	}
+	data_server_benchmark(mp, samples, seconds);
+}
+
+static iocshArg dataServerBenchmarkArg0 = { "Serial Number", iocshArgString };
+static iocshArg dataServerBenchmarkArg1 = { "Samples", iocshArgInt };
+static iocshArg dataServerBenchmarkArg2 = { "Seconds", iocshArgDouble };
+static const iocshArg * dataServerBenchmarkArgs[3] = {&dataServerBenchmarkArg0, &dataServerBenchmarkArg1, &dataServerBenchmarkArg2};
+static iocshFuncDef PS6000ADataServerBenchmarkDef = {"PS6000ADataServerBenchmark", 3, &dataServerBenchmarkArgs[0]};
+
+/**
+ * Creates the shared memory frame ring of a module, after PS6000ASetup. Captures with more 
+ * samples than a slot holds are not written to the ring. 
+ * 
+ * @param serial_num Serial number of the module. 
+ * @param name       shm_open name, e.g. /ps6000a-XXXX. 
+ * @param slots      Frames the ring holds, SHM_RING_DEFAULT_SLOTS if not positive. 
+ * @param samples    Samples per slot, SHM_RING_DEFAULT_SAMPLES if not positive. 
+ */
+static void create_shm_ring(const char* serial_num, const char* name, int slots, int samples){
+    struct PS6000AModule* mp = PS6000AGetModule((char*)serial_num);
+
+    if (!mp) {
+        printf("PS6000AShmRing: no module with serial number %s\n", serial_num ? serial_num : "");
+        return;
+    }
+    if (!name || name[0] != '/') {
+        printf("PS6000AShmRing: the name must start with /\n");
+        return;
+    }
+    if (mp->shm_ring) {
+        printf("PS6000AShmRing: %s already has a shared memory ring\n", mp->serial_num);
+        return;
+    }
+    struct ShmRingWriter* writer = calloc(1, sizeof(struct ShmRingWriter));
+    if (!writer) {
+        printf("PS6000AShmRing: out of memory\n");
+        return;
+    }
+    int status = shm_ring_create(writer, name, mp->serial_num, slots > 0 ? slots : SHM_RING_DEFAULT_SLOTS, 
+                                 samples > 0 ? samples : SHM_RING_DEFAULT_SAMPLES);
+    if (status != SHM_RING_OK) {
+        printf("PS6000AShmRing: %s: %s\n", name, shm_ring_strerror(status));
+        free(writer);
+        return;
+    }
+    mp->shm_ring = writer;
+    printf("Shared memory ring for %s at %s, %u slots of %llu samples\n", mp->serial_num, name, 
+        writer->header->num_slots, (unsigned long long)writer->header->slot_samples);
+}
+
+static void
+PS6000AShmRingCB( const iocshArgBuf *arglist)
+{
+	create_shm_ring(arglist[0].sval, arglist[1].sval, arglist[2].ival, arglist[3].ival);
+}
+
+static iocshArg shmRingArg0 = { "Serial Number", iocshArgString };
+static iocshArg shmRingArg1 = { "Name", iocshArgString };
+static iocshArg shmRingArg2 = { "Slots", iocshArgInt };
+static iocshArg shmRingArg3 = { "Samples", iocshArgInt };
+static const iocshArg * shmRingArgs[4] = {&shmRingArg0, &shmRingArg1, &shmRingArg2, &shmRingArg3};
+static iocshFuncDef PS6000AShmRingDef = {"PS6000AShmRing", 4, &shmRingArgs[0]};
+
+/**
+ * Writes synthetic frames to the shared memory ring at a fixed rate, each stamped as read from 
+ * the scope just before it is written, as the acquisition thread does after ps6000aGetValues. 
+ * A picoscopeShmReader started beforehand reports the latency readers see. The acquisition 
+ * must be stopped, the benchmark stands in for the acquisition thread. 
+ * 
+ * @param serial_num Serial number of the module. 
+ * @param samples    Samples per frame. 
+ * @param rate_hz    Frames per second, as fast as possible if not positive. 
+ * @param seconds    Time to write for. 
+ */
+static void run_shm_benchmark(const char* serial_num, int samples, double rate_hz, double seconds){
+    struct PS6000AModule* mp = PS6000AGetModule((char*)serial_num);
+    struct ShmSlotHeader frame;
+    uint64_t frames = 0;
+
+    if (!mp || !mp->shm_ring) {
+        printf("PS6000AShmBenchmark: no shared memory ring for %s, run PS6000AShmRing first\n", serial_num ? serial_num : "");
+        return;
+    }
+    if (acquisition_state(mp) != ACQ_IDLE) {
+        printf("PS6000AShmBenchmark: stop the acquisition first\n");
+        return;
+    }
+    int16_t* data = malloc(samples * sizeof(int16_t));
+    if (!data) {
+        printf("PS6000AShmBenchmark: cannot allocate %d samples\n", samples);
+        return;
+    }
+    for (int i = 0; i < samples; i++) {
+        data[i] = (int16_t)i;
+    }
+
+    uint64_t start = shm_ring_now_ns();
+    uint64_t end = start + (uint64_t)(seconds * 1e9);
+    uint64_t write_ns = 0;
+    for (uint64_t now = start; now < end; now = shm_ring_now_ns()) {
+        memset(&frame, 0, sizeof(frame));
+        frame.channel = frames % NUM_CHANNELS;
+        frame.samples = samples;
+        frame.ready_ns = shm_ring_now_ns();
+        if (shm_ring_write(mp->shm_ring, &frame, data) != SHM_RING_OK) {
+            printf("PS6000AShmBenchmark: %d samples do not fit a slot\n", samples);
+            break;
+        }
+        write_ns += shm_ring_now_ns() - frame.ready_ns;
+        frames++;
+        if (rate_hz > 0) {
+            // Pace against the start, so the sleep granularity does not lower the rate 
+            double ahead = (start + frames * 1e9 / rate_hz - (double)shm_ring_now_ns()) / 1e9;
+            if (ahead > 0) {
+                epicsThreadSleep(ahead);
+            }
+        }
+    }
+    free(data);
+
+    double elapsed = (shm_ring_now_ns() - start) / 1e9;
+    printf("PS6000AShmBenchmark: %llu frames of %d samples in %.2f s, %.1f frames/s, %.1f MB/s, write %.1f us per frame\n", 
+        (unsigned long long)frames, samples, elapsed, frames / elapsed, frames * samples * sizeof(int16_t) / elapsed / 1e6, 
+        frames ? write_ns / 1e3 / frames : 0);
+}
+
+static void
+PS6000AShmBenchmarkCB( const iocshArgBuf *arglist)
+{
+	int samples = arglist[1].ival > 0 ? arglist[1].ival : 100000;
+	double seconds = arglist[3].dval > 0 ? arglist[3].dval : 5.0;
+	run_shm_benchmark(arglist[0].sval, samples, arglist[2].dval, seconds);
+}
+
+static iocshArg shmBenchmarkArg0 = { "Serial Number", iocshArgString };
+static iocshArg shmBenchmarkArg1 = { "Samples", iocshArgInt };
+static iocshArg shmBenchmarkArg2 = { "Rate Hz", iocshArgDouble };
+static iocshArg shmBenchmarkArg3 = { "Seconds", iocshArgDouble };
+static const iocshArg * shmBenchmarkArgs[4] = {&shmBenchmarkArg0, &shmBenchmarkArg1, &shmBenchmarkArg2, &shmBenchmarkArg3};
+static iocshFuncDef PS6000AShmBenchmarkDef = {"PS6000AShmBenchmark", 4, &shmBenchmarkArgs[0]};
+
+/**
+ * Processes a START or STOP record under its record lock, as a CA put would. 
+ */
+static void benchmark_process(struct waveformRecord* precord){
+    dbScanLock((struct dbCommon *)precord);
+    dbProcess((struct dbCommon *)precord);
+    dbScanUnlock((struct dbCommon *)precord);
+}
+
+/**
+ * Starts and stops the acquisition of a module with its current configuration a number of 
+ * times, and prints the measured stop latencies against stop_latency_bound(). 
+ * 
+ * @param serial_num   Serial number of the module. 
+ * @param cycles       Number of start/stop cycles. 
+ * @param capture_secs Time to let each acquisition run before stopping it. 
+ */
+static void run_stop_benchmark(const char* serial_num, int cycles, double capture_secs){
+    struct PS6000AModule* mp = PS6000AGetModule((char*)serial_num);
+    double sum = 0, max = 0;
+    int completed = 0;
+
+    if (!mp || !mp->pWaveformStartPtr || !mp->pWaveformStopPtr) {
+        printf("PS6000AStopBenchmark: no module with serial number %s\n", serial_num ? serial_num : "");
+        return;
+    }
+    if (acquisition_state(mp) != ACQ_IDLE) {
+        printf("PS6000AStopBenchmark: stop the acquisition first\n");
+        return;
+    }
+    for (int i = 0; i < cycles; i++) {
+        benchmark_process(mp->pWaveformStartPtr);
+        // The start runs on the writer thread, the record completes once it has 
+        while (mp->pWaveformStartPtr->pact) {
+            epicsThreadSleep(0.001);
+        }
+        while (acquisition_state(mp) == ACQ_ARMING) {
+            epicsThreadSleep(0.001);
+        }
+        if (acquisition_state(mp) != ACQ_RUNNING) {
+            printf("PS6000AStopBenchmark: acquisition did not start, cycle %d\n", i);
+            break;
+        }
+        epicsThreadSleep(capture_secs);
+        benchmark_process(mp->pWaveformStopPtr);
+        wait_acquisition_idle(mp);
+
+        double latency = mp->acquisition->last_stop_latency;
+        sum += latency;
+        if (latency > max) {
+            max = latency;
+        }
+        completed++;
+    }
+    if (completed == 0) {
+        return;
+    }
+    printf("PS6000AStopBenchmark: %d cycles, stop latency mean %.3f ms, max %.3f ms, bound %.3f ms%s\n",
+        completed, sum / completed * 1e3, max * 1e3, stop_latency_bound(mp) * 1e3,
+        max > stop_latency_bound(mp) ? " (EXCEEDED)" : "");
+}
+
+static void
+PS6000AStopBenchmarkCB( const iocshArgBuf *arglist)
+{
+	int cycles = arglist[1].ival > 0 ? arglist[1].ival : 10;
+	double capture_secs = arglist[2].dval > 0 ? arglist[2].dval : 0.5;
+	run_stop_benchmark(arglist[0].sval, cycles, capture_secs);
+}
+
+static iocshArg stopBenchmarkArg0 = { "Serial Number", iocshArgString };
+static iocshArg stopBenchmarkArg1 = { "Cycles", iocshArgInt };
+static iocshArg stopBenchmarkArg2 = { "Capture Seconds", iocshArgDouble };
+static const iocshArg * stopBenchmarkArgs[3] = {&stopBenchmarkArg0, &stopBenchmarkArg1, &stopBenchmarkArg2};
+static iocshFuncDef PS6000AStopBenchmarkDef = {"PS6000AStopBenchmark", 3, &stopBenchmarkArgs[0]};
+
 void registerPS6000A(void)
 {
 	iocshRegister( &PS6000ASetupDef, PS6000ASetupCB);
+	iocshRegister( &PS6000ATimebaseCacheDirDef, PS6000ATimebaseCacheDirCB);
+	iocshRegister( &PS6000ARecorderDirDef, PS6000ARecorderDirCB);
+	iocshRegister( &PS6000ADataServerDef, PS6000ADataServerCB);
+	iocshRegister( &PS6000ADataServerBenchmarkDef, PS6000ADataServerBenchmarkCB);
+	iocshRegister( &PS6000AShmRingDef, PS6000AShmRingCB);
+	iocshRegister( &PS6000AShmBenchmarkDef, PS6000AShmBenchmarkCB);
+	iocshRegister( &PS6000AStopBenchmarkDef, PS6000AStopBenchmarkCB);
 }
 
 epicsExportRegistrar(registerPS6000A);
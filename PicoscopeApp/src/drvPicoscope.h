@@ -30,39 +30,274 @@
 #include <epicsEvent.h>
 #include <epicsMutex.h>
 #include <epicsThread.h>
-
+#include <epicsRingPointer.h>
+#include <dbScan.h>
+#include <ellLib.h>
+#include <epicsTime.h>
+#include <epicsMessageQueue.h>
+
+
+// Accounts for the frame memory of the channel frame queues. Frames are sized to the configured 
+// number of samples. A frame is only resized once the acquisition thread owns it again, as a 
+// waveform record may still be publishing it. 
+struct BufferPool { 
+    uint64_t buffer_samples;        // Capacity frames are resized to, in samples 
+    uint64_t allocated_bytes; 
+    uint64_t peak_bytes; 
+};
+
+// Waveform frame handed from the acquisition thread to a channel waveform record. The SDK writes 
+// captures straight into data, which then becomes the record's bptr until its next frame arrives. 
+struct Frame { 
+    int16_t* data; 
+    uint64_t capacity;              // Samples data can hold 
+    uint64_t samples; 
+    uint64_t config_version;        // Version of the ConfigSnapshot the frame was captured with 
+};
+
+// Single producer, single consumer frame queue for one channel. A frame belongs to whichever side 
+// last popped it: the acquisition thread pops from free and pushes to ready, the waveform record 
+// pops from ready and pushes back to free. The acquisition thread never waits on the record, 
+// if no free frame is available the frame is dropped and counted as an overrun. 
+struct FrameQueue { 
+    struct Frame frames[FRAME_QUEUE_DEPTH]; 
+    epicsRingPointerId ready; 
+    epicsRingPointerId free; 
+    struct Frame* filling;          // Frame registered with the SDK, owned by the acquisition thread 
+    uint64_t overruns; 
+};
+
+// SDK command types in priority order, waiting commands with a lower value are served first. 
+enum SdkCommandType { 
+    SDK_CMD_DATA,                   // Reading captured data 
+    SDK_CMD_CAPTURE,                // Starting and stopping captures 
+    SDK_CMD_CONFIG,                 // Device, channel and trigger configuration 
+    SDK_CMD_HEALTH,                 // Ping and unit information 
+    NUM_SDK_COMMAND_TYPES 
+};
+
+struct SdkCommandStats { 
+    double wait_ms;                 // Smoothed time spent queued for the device 
+    double service_ms;              // Smoothed time holding the device 
+    double max_service_ms;          // Longest time holding the device 
+    uint64_t commands; 
+};
+
+// Per-device SDK command queue. Every SDK call queues for the device and is granted it one at a 
+// time, highest priority first, so data-path calls are never held behind configuration or health 
+// checks. The thread holding the device may queue again without waiting. 
+struct SdkQueue { 
+    epicsMutexId lock; 
+    ELLLIST waiting[NUM_SDK_COMMAND_TYPES]; 
+    epicsThreadId owner; 
+    int depth;                      // Grants held by owner, 0 when the device is free 
+    enum SdkCommandType active_type; 
+    epicsTimeStamp active_since; 
+    struct SdkCommandStats stats[NUM_SDK_COMMAND_TYPES]; 
+};
+
+struct AnalogOffsetLimits { 
+    int16_t range; 
+    int16_t coupling; 
+    double max_analog_offset; 
+    double min_analog_offset; 
+};
+
+// Mirror of device state that only changes when the driver changes it, so reads do not need a 
+// USB round trip. Filled on first use, cleared when the device is opened or closed, and updated 
+// by the setters that change it. 
+struct DeviceCache { 
+    epicsMutexId lock; 
+    int resolution_valid; 
+    int16_t resolution; 
+    int adc_limits_valid;           // ADC limits are only valid for the cached resolution 
+    int16_t adc_min; 
+    int16_t adc_max; 
+    struct AnalogOffsetLimits offset_limits[OFFSET_LIMITS_CACHE_SIZE]; 
+    size_t num_offset_limits; 
+    char* device_info; 
+    uint64_t hits; 
+    uint64_t misses; 
+};
+
+struct TimebaseEntry { 
+    uint32_t timebase; 
+    double interval;                // Sample interval in seconds 
+};
+
+// Timebases available for one (enabled channel mask, resolution) pair. The fast timebases are 
+// listed in order, from the last entry on the interval grows by step seconds per timebase. 
+struct TimebaseTable { 
+    uint32_t channel_mask; 
+    int16_t resolution; 
+    struct TimebaseEntry entries[TIMEBASE_TABLE_MAX_ENTRIES]; 
+    size_t num_entries; 
+    double step;                    // 0 if only the minimum timebase is listed 
+};
+
+// Timebase tables built on first use of each (channel mask, resolution) pair, so timebase 
+// selection is a local search. Saved to cache_path, if set, and reloaded on the next start 
+// when the driver and firmware versions still match. 
+struct TimebaseLut { 
+    epicsMutexId lock; 
+    struct TimebaseTable tables[TIMEBASE_LUT_MAX_TABLES]; 
+    size_t num_tables; 
+    int loaded;                     // Versions of the open device have been checked, cleared on open 
+    char version[TIMEBASE_LUT_VERSION_LENGTH];  // Driver and firmware versions, empty if unknown 
+    char* cache_path; 
+};
+
+// Device settings as last sent by the acquisition thread, so setup only makes the SDK calls 
+// whose inputs changed. Cleared when the device is opened or closed. 
+struct AppliedConfig { 
+    int trigger_valid; 
+    struct TriggerConfigs trigger_config; 
+    int segments_valid;             // Also cleared by a resolution change 
+    uint64_t num_segments; 
+    uint64_t num_captures; 
+    uint32_t channel_mask;          // Enabled channels share the segment memory 
+    uint64_t max_samples_per_segment; 
+};
+
+enum AcquisitionState { 
+    ACQ_IDLE,                       // Waiting for a start request 
+    ACQ_ARMING,                     // Start requested, acquisition thread setting up the device 
+    ACQ_RUNNING,                    // Capturing 
+    ACQ_DRAINING,                   // Stop requested or capture failed, thread cleaning up 
+    NUM_ACQUISITION_STATES 
+};
+
+// Acquisition lifecycle, IDLE -> ARMING -> RUNNING -> DRAINING -> IDLE. The state is read 
+// without locking by the capture loops, transitions are made under lock and timestamped. 
+struct AcquisitionStateMachine { 
+    int state;                      // enum AcquisitionState, accessed with epicsAtomic 
+    epicsMutexId lock; 
+    epicsEventId start_event;       // Signalled on IDLE -> ARMING, wakes the acquisition thread 
+    epicsEventId idle_event;        // Signalled on DRAINING -> IDLE, wakes threads waiting for a stop 
+    epicsEventId cancel_event;      // Signalled on a stop request, cuts short streaming poll waits 
+    epicsTimeStamp entered[NUM_ACQUISITION_STATES]; 
+    double last_start_latency;      // Seconds from the start request to RUNNING 
+    double last_stop_latency;       // Seconds from the stop request to IDLE 
+    double max_stop_latency;        // Longest stop since the IOC started 
+    IOSCANPVT state_scan;           // Scanned on every transition 
+};
+
+// Capture settings as published by device support. A published snapshot is never modified, 
+// every change publishes a new version. 
+struct ConfigSnapshot { 
+    uint64_t version;               // 0 until the first snapshot is published 
+    int16_t resolution; 
+    uint16_t subwaveform_num; 
+    struct SampleConfigs sample_config; 
+    struct ChannelConfigs channel_configs[NUM_CHANNELS]; 
+    struct TriggerConfigs trigger_config; 
+    EnabledChannelFlags channel_status; 
+};
+
+// Latest published snapshot of a module's settings. Device support holds write_lock for a whole 
+// write, and while publishing, so a snapshot never holds half of a write. The acquisition thread 
+// only takes lock, to copy the latest snapshot at a frame boundary. 
+struct ConfigStore { 
+    epicsMutexId write_lock; 
+    epicsMutexId lock; 
+    struct ConfigSnapshot latest; 
+};
+
+// Acquisition restarts requested by configuration writes. A burst of writes, each within 
+// window_secs of the last, restarts the acquisition once from the restart thread. 
+struct RestartCoalescer { 
+    epicsMutexId lock;              // Guards requested, writes come from several threads 
+    epicsEventId request_event; 
+    double window_secs;             // 0 restarts on every write, on the writer thread 
+    uint64_t requested; 
+    uint64_t executed;              // Guarded by the config store write lock 
+    epicsThreadId thread;           // Restart thread, joinable 
+    int stopping;                   // Set to end the restart thread 
+};
+
+// Output record writes handed off by device support, so the SDK calls they make run on the 
+// writer thread instead of in record processing. The statistics are diagnostics, not locked. 
+struct AsyncWriter { 
+    epicsMessageQueueId queue;      // struct AsyncWrite pointers 
+    uint64_t completed;             // Writes run on the writer thread 
+    uint64_t synchronous;           // Writes that waited in record processing because the queue was full 
+    double last_write_secs;         // Time the last write took, including its SDK calls 
+    double max_write_secs; 
+    epicsThreadId thread;           // Writer thread, joinable, ended by queueing a NULL write 
+};
+
+// Context passed to ps6000aRunBlock, one per module so each module's callback wakes its own thread. 
+struct BlockReadyCallbackParams { 
+    uint32_t callbackStatus;        // Status from the callback 
+    int dataReady; 
+    epicsEventId triggerReadyEvent; 
+    epicsTimeStamp armed_time;      // ps6000aRunBlock returned 
+    epicsTimeStamp ready_time;      // The callback reported the capture complete 
+};
 
 typedef struct PS6000AModule 
 {
+    ELLNODE node;                   // Module registry entry, must stay first 
     char* serial_num;
     int16_t handle;
     int8_t status;
     int16_t resolution; 
 
 
-    int8_t *dataAcquisitionFlag;
     struct waveformRecord* pWaveformStartPtr;
     struct waveformRecord* pWaveformStopPtr;
     struct waveformRecord* pRecordUpdateWaveform[NUM_CHANNELS];
+    struct waveformRecord* pRecordUpdateSegments[NUM_CHANNELS];
+    struct waveformRecord* pSegmentTimestamps;
     
     struct waveformRecord* pLog;
     struct aiRecord* pStatusCode; 
+    // Latest log message and status code, copied into pLog and pStatusCode when they process 
+    epicsMutexId log_lock; 
+    char log_text[LOG_TEXT_LENGTH]; 
+    uint32_t log_status_code; 
     
     uint16_t subwaveform_num;
     uint64_t waveform_size;
 
     epicsEventId triggerReadyEvent;
-    epicsEventId acquisitionStartEvent;
-    epicsEventId channelStreamingFinishedEvents[NUM_CHANNELS];
-    epicsMutexId epics_acquisition_flag_mutex;
-    epicsMutexId epics_acquisition_thread_mutex;
-    epicsMutexId epics_acquisition_restart_mutex;
-    epicsMutexId epics_ps6000a_call_mutex;
+    struct BlockReadyCallbackParams *block_ready_callback_params;
+    struct AcquisitionStateMachine *acquisition; 
+    epicsMutexId epics_segment_mutex;       // Guards the rapid block segment buffers 
+    struct SdkQueue *sdk_queue;
+    struct DeviceCache *device_cache;
+    struct TimebaseLut *timebase_lut;
+    struct RestartCoalescer *restart_coalescer;
+    struct AsyncWriter *async_writer;
+    struct Recorder *recorder;
+    struct PostMortem *post_mortem;
+    struct DataServer *data_server; // NULL unless PS6000ADataServer was run 
+    struct ShmRingWriter *shm_ring; // NULL unless PS6000AShmRing was run 
+    struct AppliedConfig *applied_config;
+    struct ConfigStore *config_store;
+    uint64_t config_version;        // Acquisition thread: snapshot version of its settings 
+    uint64_t waveform_config_version[NUM_CHANNELS];    // Snapshot version of each published waveform 
 
     epicsThreadId acquisition_thread_function;
-    epicsThreadId channel_streaming_thread_function[4];
     int16_t* waveform[NUM_CHANNELS];
-    int16_t** streamWaveformBuffers[NUM_CHANNELS];
+    struct BufferPool *buffer_pool;
+    struct FrameQueue *frame_queue[NUM_CHANNELS];
+    uint64_t block_segment_index;   // Memory segment the next block capture is taken into 
+    int capture_armed;              // Acquisition thread: a capture was started and not yet stopped 
+    int recording;                  // Acquisition thread: captures are queued to the disk recorder 
+    int post_mortem_active;         // Acquisition thread: captures are kept in the post-mortem ring 
+    uint64_t values_ready_ns;       // Acquisition thread: CLOCK_MONOTONIC when samples were last read from the scope 
+
+    // Rapid block buffers, segment-major: segment_waveform[ch][segment * num_samples + sample]
+    int16_t* segment_waveform[NUM_CHANNELS];
+    int16_t* segment_read_waveform[NUM_CHANNELS];   // Bulk read target, copied to segment_waveform under the segment mutex 
+    uint64_t segment_waveform_size;
+    double* segment_timestamps;
+    uint64_t segment_timestamps_size;
+    struct SegmentReadBuffers *segment_read_buffers;    // Bulk read arrays, segment_timestamps_size segments 
+    uint64_t *segments_collected;
+
+    struct StreamPollStats *stream_poll_stats;
 
 
     struct SampleConfigs sample_config;
@@ -79,6 +314,11 @@ typedef struct PS6000AModule
     struct aiRecord* pTriggerFrequency; 
     struct aiRecord* pTriggersMissed; 
 
+    // I/O Intr scan lists, the acquisition thread requests a scan instead of processing records 
+    IOSCANPVT waveform_scan[NUM_CHANNELS];
+    IOSCANPVT segments_scan;        // Segment waveforms and segment timestamps 
+    IOSCANPVT trigger_timing_scan;  // Trigger frequency and missed triggers 
+
     struct mbboRecord* pTriggerDirection;
     struct mbbiRecord* pTriggerDirectionFbk;
     struct mbbiRecord* pTriggerType;
@@ -88,7 +328,7 @@ typedef struct PS6000AModule
     struct mbbiRecord* pTimePerDivisionFbk;
     uint64_t *sample_collected;
 
-    struct TriggerTimingInfo trigger_timing_info; 
+    struct TriggerTimingInfo *trigger_timing_info; 
 
 } PS6000AModule;
 
@@ -155,5 +395,57 @@ uint32_t validate_sample_interval(
 
 uint32_t stop_capturing(struct PS6000AModule* mp);
 
+struct SdkQueue* create_sdk_queue(void);
+
+void destroy_sdk_queue(struct SdkQueue* queue);
+
+void sdk_acquire(struct PS6000AModule* mp, enum SdkCommandType type);
+
+void sdk_release(struct PS6000AModule* mp);
+
+struct DeviceCache* create_device_cache(void);
+
+void destroy_device_cache(struct DeviceCache* cache);
+
+void invalidate_device_cache(struct PS6000AModule* mp);
+
+struct TimebaseLut* create_timebase_lut(const char* serial_num);
+
+void destroy_timebase_lut(struct TimebaseLut* lut);
+
+struct AcquisitionStateMachine* create_acquisition_state_machine(void);
+
+void destroy_acquisition_state_machine(struct AcquisitionStateMachine* sm);
+
+enum AcquisitionState acquisition_state(struct PS6000AModule* mp);
+
+int acquisition_active(struct PS6000AModule* mp);
+
+int request_acquisition_start(struct PS6000AModule* mp);
+
+void request_acquisition_stop(struct PS6000AModule* mp);
+
+void wait_acquisition_idle(struct PS6000AModule* mp);
+
+double stop_latency_bound(struct PS6000AModule* mp);
+
+struct ConfigStore* create_config_store(void);
+
+void destroy_config_store(struct ConfigStore* store);
+
+void publish_config(struct PS6000AModule* mp);
+
+void post_trigger_config(struct PS6000AModule* mp);
+
+int config_streams(struct PS6000AModule* mp);
+
+struct FrameQueue* create_frame_queue(void);
+
+struct SegmentReadBuffers* create_segment_read_buffers(uint64_t max_segments);
+
+struct Frame* take_newest_frame(struct FrameQueue* queue);
+
+void release_frame(struct FrameQueue* queue, struct Frame* frame);
+
 
 #endif
@@ -0,0 +1,622 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     drvPicoscopeDataServer.c
+ * Description:
+ *     Data socket server for the Picoscope PS6000A driver. The
+ *     acquisition thread copies each capture once into a shared frame
+ *     slot, a per module server thread sends the slot to every subscriber
+ *     with scatter-gather writes and applies each subscriber's drop policy
+ *     when it falls behind.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+
+#include "drvPicoscope.h"
+#include "drvPicoscopeDataServer.h"
+
+#define DATA_SERVER_RATE_SECS 1.0       // Interval the send rate is averaged over 
+#define DATA_SERVER_SEND_BATCH 8        // Queued frames gathered into one sendmsg 
+#define DATA_SERVER_BACKLOG 8
+
+/**
+ * Reports whether any client is subscribed, so the acquisition thread only copies captures 
+ * when someone will receive them. 
+ * 
+ * @param server DataServer Pointer of the module, may be NULL. 
+ * 
+ * @return       Non-zero if at least one client is subscribed. 
+ */
+int data_server_active(struct DataServer* server){
+    return server && epicsAtomicGetIntT(&server->num_subscribers) > 0;
+}
+
+/****************************************************************************************
+ * Server thread 
+ ****************************************************************************************/
+
+static void update_server_rate(struct DataServer* server){
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &server->rate_time);
+    if (elapsed < DATA_SERVER_RATE_SECS) {
+        return;
+    }
+    server->rate_mbps = (server->bytes_sent - server->rate_bytes) / elapsed / 1e6;
+    server->rate_bytes = server->bytes_sent;
+    server->rate_time = now;
+}
+
+static void release_slot(struct DataServer* server, struct DataSlot* slot){
+    if (--slot->refs > 0) {
+        return;
+    }
+    epicsRingPointerPush(server->free, slot);
+    epicsEventSignal(server->free_event);
+}
+
+static size_t frame_bytes(const struct DataSlot* slot){
+    return sizeof(slot->header) + slot->header.samples * sizeof(int16_t);
+}
+
+static void close_subscriber(struct DataServer* server, struct DataSubscriber* subscriber){
+    while (subscriber->count > 0) {
+        release_slot(server, subscriber->queue[subscriber->head]);
+        subscriber->head = (subscriber->head + 1) % DATA_SERVER_SUBSCRIBER_DEPTH;
+        subscriber->count--;
+    }
+    if (subscriber->subscribed) {
+        epicsAtomicDecrIntT(&server->num_subscribers);
+    }
+    close(subscriber->fd);
+    memset(subscriber, 0, sizeof(*subscriber));
+    subscriber->fd = -1;
+}
+
+/**
+ * Adds a frame to a subscriber's queue. A full queue is handled by the subscriber's drop 
+ * policy. A frame partly sent is never dropped, the stream would lose its framing. 
+ * 
+ * @param server     DataServer Pointer of the module. 
+ * @param subscriber DataSubscriber Pointer with a StreamRequest received. 
+ * @param slot       DataSlot Pointer of the frame. 
+ */
+static void queue_frame(struct DataServer* server, struct DataSubscriber* subscriber, struct DataSlot* slot){
+    if (subscriber->count == DATA_SERVER_SUBSCRIBER_DEPTH) {
+        epicsAtomicIncrSizeT(&server->dropped);
+        switch (subscriber->request.policy) {
+            case STREAM_DROP_NEWEST:
+                return;
+
+            case STREAM_DISCONNECT:
+                close_subscriber(server, subscriber);
+                return;
+
+            default:
+                // Drop the oldest unsent frame. If the head is partly sent, move it into the 
+                // place of the frame after it and drop that one instead. 
+                if (subscriber->sent > 0) {
+                    size_t next = (subscriber->head + 1) % DATA_SERVER_SUBSCRIBER_DEPTH;
+                    release_slot(server, subscriber->queue[next]);
+                    subscriber->queue[next] = subscriber->queue[subscriber->head];
+                } else {
+                    release_slot(server, subscriber->queue[subscriber->head]);
+                }
+                subscriber->head = (subscriber->head + 1) % DATA_SERVER_SUBSCRIBER_DEPTH;
+                subscriber->count--;
+                break;
+        }
+    }
+    subscriber->queue[(subscriber->head + subscriber->count) % DATA_SERVER_SUBSCRIBER_DEPTH] = slot;
+    subscriber->count++;
+    slot->refs++;
+}
+
+/**
+ * Hands the frames queued by the acquisition thread to every subscriber that asked for their 
+ * channel. Frames nobody asked for go straight back to the free queue. 
+ * 
+ * @param server DataServer Pointer of the module. 
+ */
+static void distribute_frames(struct DataServer* server){
+    struct DataSlot* slot;
+
+    while ((slot = epicsRingPointerPop(server->ready)) != NULL) {
+        slot->refs = 1;     // Held until every subscriber has queued it 
+        for (size_t i = 0; i < DATA_SERVER_MAX_SUBSCRIBERS; i++) {
+            struct DataSubscriber* subscriber = &server->subscribers[i];
+            uint32_t mask = subscriber->request.channel_mask;
+            if (subscriber->fd < 0 || !subscriber->subscribed || (mask && !(mask & (1u << slot->header.channel)))) {
+                continue;
+            }
+            queue_frame(server, subscriber, slot);
+        }
+        release_slot(server, slot);
+    }
+}
+
+/**
+ * Sends as much of a subscriber's queue as the socket takes without blocking. Headers and 
+ * samples are gathered straight from the slots, several frames per call. 
+ * 
+ * @param server     DataServer Pointer of the module. 
+ * @param subscriber DataSubscriber Pointer with frames queued. 
+ */
+static void send_frames(struct DataServer* server, struct DataSubscriber* subscriber){
+    while (subscriber->count > 0) {
+        struct iovec iov[2 * DATA_SERVER_SEND_BATCH];
+        struct msghdr msg;
+        size_t num_iov = 0;
+        size_t skip = subscriber->sent;
+        size_t total = 0;
+
+        for (size_t k = 0; k < subscriber->count && k < DATA_SERVER_SEND_BATCH; k++) {
+            struct DataSlot* slot = subscriber->queue[(subscriber->head + k) % DATA_SERVER_SUBSCRIBER_DEPTH];
+            size_t header_bytes = sizeof(slot->header);
+            size_t payload_bytes = slot->header.samples * sizeof(int16_t);
+            if (skip < header_bytes) {
+                iov[num_iov].iov_base = (char*)&slot->header + skip;
+                iov[num_iov].iov_len = header_bytes - skip;
+                total += iov[num_iov++].iov_len;
+                skip = 0;
+            } else {
+                skip -= header_bytes;
+            }
+            if (payload_bytes > skip) {
+                iov[num_iov].iov_base = (char*)slot->data + skip;
+                iov[num_iov].iov_len = payload_bytes - skip;
+                total += iov[num_iov++].iov_len;
+            }
+            skip = 0;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = num_iov;
+        ssize_t written = sendmsg(subscriber->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_subscriber(server, subscriber);
+            }
+            return;
+        }
+        server->bytes_sent += written;
+
+        for (size_t left = written; left > 0; ) {
+            struct DataSlot* slot = subscriber->queue[subscriber->head];
+            size_t remaining = frame_bytes(slot) - subscriber->sent;
+            if (left < remaining) {
+                subscriber->sent += left;
+                break;
+            }
+            left -= remaining;
+            subscriber->sent = 0;
+            subscriber->head = (subscriber->head + 1) % DATA_SERVER_SUBSCRIBER_DEPTH;
+            subscriber->count--;
+            release_slot(server, slot);
+        }
+        if ((size_t)written < total) {
+            return;     // The socket buffer is full, wait for POLLOUT 
+        }
+    }
+}
+
+/**
+ * Reads a subscriber's StreamRequest, then watches for the client closing. Anything else the 
+ * client sends is ignored. 
+ * 
+ * @param server     DataServer Pointer of the module. 
+ * @param subscriber DataSubscriber Pointer with data to read. 
+ */
+static void read_subscriber(struct DataServer* server, struct DataSubscriber* subscriber){
+    char discard[256];
+    ssize_t received;
+
+    if (subscriber->subscribed) {
+        received = recv(subscriber->fd, discard, sizeof(discard), MSG_DONTWAIT);
+    } else {
+        received = recv(subscriber->fd, (char*)&subscriber->request + subscriber->request_bytes,
+                        sizeof(subscriber->request) - subscriber->request_bytes, MSG_DONTWAIT);
+    }
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        close_subscriber(server, subscriber);
+        return;
+    }
+    if (received < 0 || subscriber->subscribed) {
+        return;
+    }
+    subscriber->request_bytes += received;
+    if (subscriber->request_bytes < sizeof(subscriber->request)) {
+        return;
+    }
+    if (subscriber->request.magic != STREAM_REQUEST_MAGIC || subscriber->request.version != STREAM_VERSION ||
+        subscriber->request.policy > STREAM_DISCONNECT) {
+        printf("Data server %s: rejected a client with an invalid request\n", server->endpoint);
+        close_subscriber(server, subscriber);
+        return;
+    }
+    subscriber->subscribed = 1;
+    epicsAtomicIncrIntT(&server->num_subscribers);
+}
+
+static void accept_subscribers(struct DataServer* server){
+    while (1) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        struct DataSubscriber* subscriber = NULL;
+        for (size_t i = 0; i < DATA_SERVER_MAX_SUBSCRIBERS && !subscriber; i++) {
+            if (server->subscribers[i].fd < 0) {
+                subscriber = &server->subscribers[i];
+            }
+        }
+        if (!subscriber) {
+            printf("Data server %s: refused a client, %d subscribers already connected\n",
+                   server->endpoint, DATA_SERVER_MAX_SUBSCRIBERS);
+            close(fd);
+            continue;
+        }
+        subscriber->fd = fd;
+    }
+}
+
+/**
+ * Thread function of a module's data server. Waits on the listening socket, the subscribers and 
+ * the wake pipe, accepts clients, distributes the frames the acquisition thread queued and sends 
+ * them. 
+ * 
+ * @param arg Void Pointer Passed in from EPICS thread create, the module's DataServer pointer. 
+ */
+static void server_thread_function(void *arg){
+    struct DataServer* server = (struct DataServer*)arg;
+    struct pollfd fds[2 + DATA_SERVER_MAX_SUBSCRIBERS];
+    char wake[64];
+
+    while (1) {
+        fds[0].fd = server->wake_fds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = server->listen_fd;
+        fds[1].events = POLLIN;
+        for (size_t i = 0; i < DATA_SERVER_MAX_SUBSCRIBERS; i++) {
+            struct DataSubscriber* subscriber = &server->subscribers[i];
+            fds[2 + i].fd = subscriber->fd;     // Ignored by poll when negative 
+            fds[2 + i].events = POLLIN | (subscriber->count > 0 ? POLLOUT : 0);
+            fds[2 + i].revents = 0;
+        }
+        // Wake up at least once per interval so the rate falls to zero when idle 
+        if (poll(fds, 2 + DATA_SERVER_MAX_SUBSCRIBERS, DATA_SERVER_RATE_SECS * 1000) < 0 && errno != EINTR) {
+            epicsThreadSleep(DATA_SERVER_RATE_SECS);
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            while (read(server->wake_fds[0], wake, sizeof(wake)) > 0) {
+            }
+        }
+        distribute_frames(server);
+        if (fds[1].revents & POLLIN) {
+            accept_subscribers(server);
+        }
+        for (size_t i = 0; i < DATA_SERVER_MAX_SUBSCRIBERS; i++) {
+            struct DataSubscriber* subscriber = &server->subscribers[i];
+            if (subscriber->fd < 0 || fds[2 + i].fd != subscriber->fd) {
+                continue;
+            }
+            if (fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_subscriber(server, subscriber);
+            }
+            if (subscriber->fd >= 0 && subscriber->count > 0) {
+                send_frames(server, subscriber);
+            }
+        }
+        update_server_rate(server);
+    }
+}
+
+/**
+ * Creates the listening socket. An endpoint starting with '/' is a Unix domain socket path, a 
+ * stale socket left there is replaced. Otherwise it is a TCP port, on the loopback interface 
+ * unless given as address:port. 
+ * 
+ * @return The listening socket, or -1 on failure. 
+ */
+static int open_listen_socket(struct DataServer* server){
+    int fd;
+    int one = 1;
+
+    if (server->is_unix) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(server->endpoint) >= sizeof(address.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(address.sun_path, server->endpoint);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        unlink(server->endpoint);
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in address;
+        char host[64] = "127.0.0.1";
+        const char* port = strrchr(server->endpoint, ':');
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        if (port) {
+            snprintf(host, sizeof(host), "%.*s", (int)(port - server->endpoint), server->endpoint);
+            port++;
+        } else {
+            port = server->endpoint;
+        }
+        address.sin_port = htons((uint16_t)atoi(port));
+        if (inet_pton(AF_INET, host, &address.sin_addr) != 1 || address.sin_port == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, DATA_SERVER_BACKLOG) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// Frees a data server create_data_server could not finish, its thread is not running 
+static void free_data_server(struct DataServer* server){
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        if (server->is_unix) {
+            unlink(server->endpoint);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (server->wake_fds[i] >= 0)
+            close(server->wake_fds[i]);
+    }
+    if (server->ready)
+        epicsRingPointerDelete(server->ready);
+    if (server->free)
+        epicsRingPointerDelete(server->free);
+    if (server->free_event)
+        epicsEventDestroy(server->free_event);
+    free(server->endpoint);
+    free(server);
+}
+
+/**
+ * Opens the data socket of a module and starts its server thread. Frame memory is allocated 
+ * by the first frames published. 
+ * 
+ * @param mp       PS6000AModule Pointer to the module whose captures are published. 
+ * @param endpoint Unix domain socket path, TCP port, or address:port. 
+ * 
+ * @return         Pointer to the new DataServer, or NULL on failure. 
+ */
+struct DataServer* create_data_server(struct PS6000AModule* mp, const char* endpoint){
+    char thread_name[32];
+    struct DataServer* server = calloc(1, sizeof(struct DataServer));
+    if (!server) {
+        return NULL;
+    }
+    server->endpoint = strdup(endpoint);
+    server->is_unix = endpoint[0] == '/';
+    server->listen_fd = server->wake_fds[0] = server->wake_fds[1] = -1;
+    // One spare slot so a ring can hold every frame 
+    server->ready = epicsRingPointerCreate(DATA_SERVER_QUEUE_DEPTH + 1);
+    server->free = epicsRingPointerCreate(DATA_SERVER_QUEUE_DEPTH + 1);
+    server->free_event = epicsEventCreate(epicsEventEmpty);
+    if (!server->endpoint || !server->ready || !server->free || !server->free_event || pipe(server->wake_fds) != 0) {
+        free_data_server(server);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(server->wake_fds[i], F_SETFL, fcntl(server->wake_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(server->wake_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    for (size_t slot_index = 0; slot_index < DATA_SERVER_QUEUE_DEPTH; slot_index++) {
+        epicsRingPointerPush(server->free, &server->slots[slot_index]);
+    }
+    for (size_t i = 0; i < DATA_SERVER_MAX_SUBSCRIBERS; i++) {
+        server->subscribers[i].fd = -1;
+    }
+    epicsTimeGetCurrent(&server->rate_time);
+
+    server->listen_fd = open_listen_socket(server);
+    if (server->listen_fd < 0) {
+        printf("Data server %s: %s\n", endpoint, strerror(errno));
+        free_data_server(server);
+        return NULL;
+    }
+
+    // Below the capture thread, falling behind costs subscribers frames not missed captures 
+    snprintf(thread_name, sizeof(thread_name), "serve%s", mp->serial_num);
+    if (!epicsThreadCreate(thread_name, epicsThreadPriorityMedium - 5,
+                           epicsThreadGetStackSize(epicsThreadStackMedium), server_thread_function, server)) {
+        free_data_server(server);
+        return NULL;
+    }
+    printf("Data server for %s listening on %s\n", mp->serial_num, endpoint);
+    return server;
+}
+
+/****************************************************************************************
+ * Acquisition thread side 
+ ****************************************************************************************/
+
+static void publish(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples,
+                    const epicsTimeStamp* time, uint16_t flags, int wait){
+    struct DataServer* server = mp->data_server;
+    size_t bytes = samples * sizeof(int16_t);
+    uint64_t frame = server->channel_frames[channel_index]++;
+    struct DataSlot* slot;
+    struct timespec time_ts;
+    char wake = 0;
+
+    while (!(slot = epicsRingPointerPop(server->free)) && wait) {
+        epicsEventWait(server->free_event);
+    }
+    if (!slot) {
+        epicsAtomicIncrSizeT(&server->dropped);
+        return;
+    }
+    if (slot->capacity < bytes) {
+        // A slot popped from the free queue belongs to this thread, it can be grown in place 
+        free(slot->data);
+        slot->data = malloc(bytes);
+        slot->capacity = slot->data ? bytes : 0;
+        if (!slot->data) {
+            epicsRingPointerPush(server->free, slot);
+            epicsAtomicIncrSizeT(&server->dropped);
+            return;
+        }
+    }
+    memcpy(slot->data, data, bytes);
+
+    struct StreamFrameHeader* header = &slot->header;
+    epicsTimeToTimespec(&time_ts, time);
+    memset(header, 0, sizeof(*header));
+    header->magic = STREAM_FRAME_MAGIC;
+    header->version = STREAM_VERSION;
+    header->header_bytes = sizeof(*header);
+    header->sequence = server->sequence++;
+    header->frame = frame;
+    header->time_secs = time_ts.tv_sec;
+    header->time_nsec = time_ts.tv_nsec;
+    header->channel = channel_index;
+    header->flags = flags;
+    header->config_version = mp->config_version;
+    header->sample_interval_secs = mp->sample_config.timebase_configs.sample_interval_secs;
+    header->analog_offset = mp->channel_configs[channel_index].analog_offset;
+    header->range = mp->channel_configs[channel_index].range;
+    header->resolution = mp->resolution;
+    header->samples = samples;
+
+    epicsRingPointerPush(server->ready, slot);
+    // A full pipe already has the server thread awake 
+    if (write(server->wake_fds[1], &wake, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        printf("Data server %s: cannot wake the server thread: %s\n", server->endpoint, strerror(errno));
+    }
+}
+
+/**
+ * Copies a captured frame, segment or streaming buffer into a frame slot and queues it for the 
+ * server thread. Never blocks, if every slot is still being sent the frame is dropped and 
+ * counted. Called from the acquisition thread only, while data still holds the capture. 
+ * 
+ * @param mp            PS6000AModule Pointer to the acquisition thread's module. 
+ * @param channel_index size_t The index of the channel the samples belong to. 
+ * @param data          int16_t Pointer The captured samples. 
+ * @param samples       uint64_t The number of captured samples. 
+ * @param time          epicsTimeStamp Pointer The time the frame was captured. 
+ * @param flags         uint16_t STREAM_TRIGGERED and STREAM_AUTO_TRIGGERED flags. 
+ */
+void data_server_publish(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples,
+                         const epicsTimeStamp* time, uint16_t flags){
+    publish(mp, channel_index, data, samples, time, flags, 0);
+}
+
+/**
+ * Publishes synthetic frames, a ramp on each channel in turn, as fast as the subscribers take 
+ * them, and prints the rate. Measures the server and the clients without a scope. The 
+ * acquisition must be stopped, as the benchmark stands in for the acquisition thread. 
+ * 
+ * @param mp      PS6000AModule Pointer to the module whose server is measured. 
+ * @param samples uint64_t Samples per frame. 
+ * @param seconds double Time to publish for. 
+ */
+void data_server_benchmark(struct PS6000AModule* mp, uint64_t samples, double seconds){
+    struct DataServer* server = mp->data_server;
+    epicsTimeStamp start, now;
+    uint64_t frames = 0;
+    double elapsed = 0;
+
+    if (!server) {
+        printf("PS6000ADataServerBenchmark: no data server, run PS6000ADataServer first\n");
+        return;
+    }
+    if (acquisition_state(mp) != ACQ_IDLE) {
+        printf("PS6000ADataServerBenchmark: stop the acquisition first\n");
+        return;
+    }
+    if (!data_server_active(server)) {
+        printf("PS6000ADataServerBenchmark: connect a client to %s first\n", server->endpoint);
+        return;
+    }
+    int16_t* data = malloc(samples * sizeof(int16_t));
+    if (!data) {
+        printf("PS6000ADataServerBenchmark: cannot allocate %llu samples\n", (unsigned long long)samples);
+        return;
+    }
+    for (uint64_t i = 0; i < samples; i++) {
+        data[i] = (int16_t)i;
+    }
+
+    size_t dropped_before = epicsAtomicGetSizeT(&server->dropped);
+    uint64_t bytes_before = server->bytes_sent;
+    epicsTimeGetCurrent(&start);
+    do {
+        epicsTimeGetCurrent(&now);
+        publish(mp, frames % NUM_CHANNELS, data, samples, &now, 0, 1);
+        frames++;
+        elapsed = epicsTimeDiffInSeconds(&now, &start);
+    } while (elapsed < seconds);
+    free(data);
+
+    printf("PS6000ADataServerBenchmark: %llu frames of %llu samples in %.2f s, %.1f frames/s, %.1f MB/s published, "
+           "%.1f MB/s sent, %zu frames dropped by subscribers\n",
+           (unsigned long long)frames, (unsigned long long)samples, elapsed, frames / elapsed,
+           frames * samples * sizeof(int16_t) / elapsed / 1e6, (server->bytes_sent - bytes_before) / elapsed / 1e6,
+           epicsAtomicGetSizeT(&server->dropped) - dropped_before);
+}
@@ -0,0 +1,94 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     drvPicoscopeDataServer.h
+ * Description:
+ *     Data socket server for the Picoscope PS6000A driver. Publishes raw
+ *     captures to local subscribers over a Unix domain or TCP socket
+ *     (picoscopeStream.h), bypassing Channel Access.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DRV_PICOSCOPE_DATA_SERVER
+#define DRV_PICOSCOPE_DATA_SERVER
+
+#include "picoscopeConfig.h"
+#include "picoscopeStream.h"
+#include <stddef.h>
+#include <epicsEvent.h>
+#include <epicsRingPointer.h>
+#include <epicsTime.h>
+
+struct PS6000AModule;
+
+// One published frame. Filled by the acquisition thread, then shared read-only by every 
+// subscriber queue it is added to, refs counts them. Returned to the free queue when the last 
+// subscriber has sent or dropped it. 
+struct DataSlot {
+    struct StreamFrameHeader header;
+    int16_t* data;
+    size_t capacity;                // Bytes allocated for data 
+    int refs;                       // Server thread 
+};
+
+// Connection of one client, owned by the server thread. Frames are sent from the head of the 
+// queue, sent counts the bytes of the head frame already written. 
+struct DataSubscriber {
+    int fd;
+    int subscribed;                 // The StreamRequest has been received 
+    struct StreamRequest request;
+    size_t request_bytes;
+    struct DataSlot* queue[DATA_SERVER_SUBSCRIBER_DEPTH];
+    size_t head;
+    size_t count;
+    size_t sent;
+};
+
+// Data socket server of one module. Frames circulate like the recorder blocks: the acquisition 
+// thread pops from free and pushes to ready, the server thread hands them to the subscribers and 
+// pushes them back once sent. The acquisition thread never waits for a subscriber. 
+struct DataServer {
+    char* endpoint;                 // Unix domain socket path, or [address:]port 
+    int listen_fd;
+    int is_unix;
+    int wake_fds[2];                // Pipe the acquisition thread writes to when a frame is ready 
+    struct DataSlot slots[DATA_SERVER_QUEUE_DEPTH];
+    epicsRingPointerId ready;
+    epicsRingPointerId free;
+    epicsEventId free_event;
+    struct DataSubscriber subscribers[DATA_SERVER_MAX_SUBSCRIBERS];    // Server thread 
+    int num_subscribers;            // Subscribed clients, accessed with epicsAtomic 
+    uint64_t sequence;              // Acquisition thread 
+    uint64_t channel_frames[NUM_CHANNELS];     // Acquisition thread 
+    size_t dropped;                 // Frames not delivered to a subscriber, accessed with epicsAtomic 
+    uint64_t bytes_sent;            // Server thread 
+    double rate_mbps;               // Sent to all subscribers over the last second 
+    epicsTimeStamp rate_time;
+    uint64_t rate_bytes;
+};
+
+struct DataServer* create_data_server(struct PS6000AModule* mp, const char* endpoint);
+
+int data_server_active(struct DataServer* server);
+
+void data_server_publish(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples,
+                         const epicsTimeStamp* time, uint16_t flags);
+
+void data_server_benchmark(struct PS6000AModule* mp, uint64_t samples, double seconds);
+
+#endif
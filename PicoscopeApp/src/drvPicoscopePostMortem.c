@@ -0,0 +1,443 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     drvPicoscopePostMortem.c
+ * Description:
+ *     Post-mortem capture history for the Picoscope PS6000A driver. The
+ *     acquisition thread keeps its latest captures in a memory bounded
+ *     ring. A freeze request keeps a few more captures, then a per module
+ *     dump thread writes the ring to a capture archive while acquisition
+ *     carries on.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <epicsThread.h>
+
+#include "drvPicoscope.h"
+#include "drvPicoscopeRecorder.h"
+#include "drvPicoscopePostMortem.h"
+
+#define POST_MORTEM_FILE_TAG "postmortem"
+
+void log_error(char* function_name, uint32_t status, const char* FILE, int LINE);
+
+/**
+ * Percentage of the ring holding captures. 
+ * 
+ * @param post_mortem PostMortem Pointer of the module. 
+ * 
+ * @return            0 to 100, 0 while the ring is disabled. 
+ */
+double post_mortem_fill(struct PostMortem* post_mortem){
+    double fill = 0;
+    epicsMutexLock(post_mortem->lock);
+    if (post_mortem->capacity > 0) {
+        fill = 100.0 * post_mortem->used / post_mortem->capacity;
+    }
+    epicsMutexUnlock(post_mortem->lock);
+    return fill;
+}
+
+/****************************************************************************************
+ * Dump thread 
+ ****************************************************************************************/
+
+/**
+ * Writes the slots of a frozen ring to a new capture archive, oldest first. Entry times are 
+ * relative to the oldest capture, which also names the file. 
+ * 
+ * @param mp    PS6000AModule Pointer of the module, for its serial number. 
+ * @param first size_t Index of the oldest slot. 
+ * @param count size_t Number of slots to write. 
+ */
+static void write_post_mortem_dump(struct PS6000AModule* mp, size_t first, size_t count){
+    struct PostMortem* post_mortem = mp->post_mortem;
+    struct ArchiveWriter writer;
+    struct ArchiveHeader header = post_mortem->header;
+    epicsTimeStamp start = post_mortem->slots[first].time;
+    char path[PATH_MAX];
+    struct timespec start_ts;
+
+    epicsTimeToTimespec(&start_ts, &start);
+    header.start_secs = start_ts.tv_sec;
+    header.start_nsec = start_ts.tv_nsec;
+    if (archive_file_path(mp, &start, POST_MORTEM_FILE_TAG, path) != 0) {
+        return;
+    }
+    int status = archive_writer_open(&writer, path, &header);
+    if (status != ARCHIVE_OK) {
+        printf("Error creating post-mortem archive %s: %s\n", path, archive_strerror(status));
+        return;
+    }
+    for (size_t i = 0; i < count && status == ARCHIVE_OK; i++) {
+        struct PostMortemSlot* slot = &post_mortem->slots[(first + i) % post_mortem->capacity];
+        struct ArchiveIndexEntry entry = slot->entry;
+        entry.time_ns = (int64_t)(epicsTimeDiffInSeconds(&slot->time, &start) * 1e9);
+        status = archive_write_chunk(&writer, &entry, slot->data, archive_page_align(entry.samples * sizeof(int16_t)));
+    }
+    if (status != ARCHIVE_OK) {
+        // What was written is still indexed on close 
+        printf("Error writing post-mortem archive: %s\n", archive_strerror(status));
+    }
+    status = archive_writer_close(&writer);
+    if (status != ARCHIVE_OK) {
+        printf("Error closing post-mortem archive: %s\n", archive_strerror(status));
+        return;
+    }
+    printf("Post-mortem dump of %zu captures written to %s\n", count, path);
+}
+
+/**
+ * Thread function of a module's post-mortem dump. Waits for the ring to be frozen, writes it 
+ * out, then empties the ring so it fills again. Returns once stopping is set. 
+ * 
+ * @param arg Void Pointer Passed in from EPICS thread create, the PS6000AModule pointer. 
+ */
+static void dump_thread_function(void *arg){
+    struct PS6000AModule* mp = (struct PS6000AModule*)arg;
+    struct PostMortem* post_mortem = mp->post_mortem;
+
+    while (1) {
+        epicsEventWait(post_mortem->dump_event);
+        if (post_mortem->stopping) {
+            return;
+        }
+
+        epicsMutexLock(post_mortem->lock);
+        if (post_mortem->state != POST_MORTEM_DUMPING) {
+            epicsMutexUnlock(post_mortem->lock);
+            continue;
+        }
+        size_t count = post_mortem->used;
+        size_t first = (post_mortem->next + post_mortem->capacity - count) % post_mortem->capacity;
+        epicsMutexUnlock(post_mortem->lock);
+
+        // The slots belong to this thread until the state goes back to filling 
+        epicsTimeStamp started, finished;
+        epicsTimeGetCurrent(&started);
+        write_post_mortem_dump(mp, first, count);
+        epicsTimeGetCurrent(&finished);
+
+        epicsMutexLock(post_mortem->lock);
+        post_mortem->next = 0;
+        post_mortem->used = 0;
+        post_mortem->state = POST_MORTEM_FILLING;
+        post_mortem->dump_secs = epicsTimeDiffInSeconds(&finished, &started);
+        post_mortem->dumps++;
+        epicsMutexUnlock(post_mortem->lock);
+        epicsEventSignal(post_mortem->idle_event);
+    }
+}
+
+/**
+ * Allocates the post-mortem ring of a module. Slot memory is allocated by the first acquisition 
+ * with the ring enabled, the dump thread is started by start_post_mortem. 
+ * 
+ * @return   Pointer to the new PostMortem, or NULL on failure. 
+ */
+struct PostMortem* create_post_mortem(void){
+    struct PostMortem* post_mortem = calloc(1, sizeof(struct PostMortem));
+    if (!post_mortem) {
+        return NULL;
+    }
+    post_mortem->lock = epicsMutexCreate();
+    post_mortem->dump_event = epicsEventCreate(epicsEventEmpty);
+    post_mortem->idle_event = epicsEventCreate(epicsEventEmpty);
+    if (!post_mortem->lock || !post_mortem->dump_event || !post_mortem->idle_event) {
+        destroy_post_mortem(post_mortem);
+        return NULL;
+    }
+    post_mortem->state = POST_MORTEM_FILLING;
+    return post_mortem;
+}
+
+/**
+ * Starts the dump thread of a module's post-mortem ring. 
+ * 
+ * @param mp PS6000AModule Pointer to the module, its post_mortem set. 
+ * 
+ * @return   0 on success, -1 if the thread could not be created. 
+ */
+int start_post_mortem(struct PS6000AModule* mp){
+    epicsThreadOpts opts = EPICS_THREAD_OPTS_INIT;
+    char thread_name[32];
+
+    // Lowest priority of the module's threads, a dump only competes with the recorder for the disk 
+    opts.priority = epicsThreadPriorityLow;
+    opts.stackSize = epicsThreadGetStackSize(epicsThreadStackMedium);
+    opts.joinable = 1;
+    snprintf(thread_name, sizeof(thread_name), "dump%s", mp->serial_num);
+    mp->post_mortem->thread = epicsThreadCreateOpt(thread_name, dump_thread_function, mp, &opts);
+    return mp->post_mortem->thread ? 0 : -1;
+}
+
+/**
+ * Ends the dump thread and waits for it, after the dump in progress if there is one. 
+ * 
+ * @param post_mortem PostMortem Pointer The ring whose thread was started. 
+ */
+void stop_post_mortem(struct PostMortem* post_mortem){
+    post_mortem->stopping = 1;
+    epicsEventSignal(post_mortem->dump_event);
+    epicsThreadMustJoin(post_mortem->thread);
+    post_mortem->thread = NULL;
+}
+
+// Frees a post-mortem ring whose thread is not running 
+void destroy_post_mortem(struct PostMortem* post_mortem){
+    for (size_t i = 0; i < post_mortem->num_slots; i++) {
+        free(post_mortem->slots[i].data);
+    }
+    free(post_mortem->slots);
+    if (post_mortem->lock)
+        epicsMutexDestroy(post_mortem->lock);
+    if (post_mortem->dump_event)
+        epicsEventDestroy(post_mortem->dump_event);
+    if (post_mortem->idle_event)
+        epicsEventDestroy(post_mortem->idle_event);
+    free(post_mortem);
+}
+
+/****************************************************************************************
+ * Acquisition thread side 
+ ****************************************************************************************/
+
+/**
+ * Replaces the slots with count slots of slot_bytes each. Called with no acquisition running 
+ * and no dump in progress. 
+ * 
+ * @return 0 on success, -1 if the memory could not be allocated. 
+ */
+static int allocate_post_mortem_slots(struct PostMortem* post_mortem, size_t count, size_t slot_bytes){
+    for (size_t i = 0; i < post_mortem->num_slots; i++) {
+        free(post_mortem->slots[i].data);
+    }
+    free(post_mortem->slots);
+    post_mortem->num_slots = 0;
+    post_mortem->slot_bytes = 0;
+
+    post_mortem->slots = calloc(count, sizeof(struct PostMortemSlot));
+    if (!post_mortem->slots) {
+        log_error("post-mortem calloc", ENOMEM, __FILE__, __LINE__);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        void* data = NULL;
+        if (posix_memalign(&data, ARCHIVE_PAGE_BYTES, slot_bytes) != 0) {
+            post_mortem->num_slots = i;
+            log_error("post-mortem posix_memalign", ENOMEM, __FILE__, __LINE__);
+            return -1;
+        }
+        post_mortem->slots[i].data = data;
+    }
+    post_mortem->num_slots = count;
+    post_mortem->slot_bytes = slot_bytes;
+    return 0;
+}
+
+/**
+ * Empties the ring and sizes it for the acquisition about to run: post_mortem_frames captures of 
+ * every enabled channel, cut down to fit POST_MORTEM_MAX_BYTES. Waits for a dump of the previous 
+ * acquisition to finish. Called from the acquisition thread before capturing. 
+ * 
+ * @param mp   PS6000AModule Pointer to the acquisition thread's module. 
+ * @param mode ArchiveCaptureMode The kind of chunk the acquisition produces. 
+ * 
+ * @return     0 if captures will be kept, -1 otherwise. 
+ */
+int post_mortem_start(struct PS6000AModule* mp, enum ArchiveCaptureMode mode){
+    struct PostMortem* post_mortem = mp->post_mortem;
+    size_t chunks_per_frame = 0;
+    epicsTimeStamp now;
+
+    epicsMutexLock(post_mortem->lock);
+    while (post_mortem->state == POST_MORTEM_DUMPING) {
+        epicsMutexUnlock(post_mortem->lock);
+        epicsEventWait(post_mortem->idle_event);
+        epicsMutexLock(post_mortem->lock);
+    }
+    post_mortem->capacity = 0;
+    post_mortem->next = 0;
+    post_mortem->used = 0;
+    post_mortem->running = 0;
+    epicsMutexUnlock(post_mortem->lock);
+
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        if (get_channel_status(mp->channel_configs[i].channel, mp->channel_status)) {
+            chunks_per_frame++;
+        }
+        post_mortem->channel_frames[i] = 0;
+        post_mortem->channel_samples[i] = 0;
+        post_mortem->channel_gap[i] = 0;
+    }
+    uint64_t chunk_samples = mode == ARCHIVE_STREAMING ?
+        mp->sample_config.subwaveform_samples_num : mp->sample_config.num_samples;
+    size_t slot_bytes = archive_page_align(chunk_samples * sizeof(int16_t));
+    if (chunks_per_frame == 0 || slot_bytes == 0) {
+        return -1;
+    }
+    size_t capacity = mp->sample_config.post_mortem_frames * chunks_per_frame;
+    if (capacity > POST_MORTEM_MAX_BYTES / slot_bytes) {
+        capacity = POST_MORTEM_MAX_BYTES / slot_bytes;
+        printf("Post-mortem ring limited to %zu captures per channel by POST_MORTEM_MAX_BYTES\n",
+               capacity / chunks_per_frame);
+    }
+    if (capacity < chunks_per_frame) {
+        return -1;
+    }
+    if ((capacity > post_mortem->num_slots || slot_bytes > post_mortem->slot_bytes) &&
+        allocate_post_mortem_slots(post_mortem, capacity, slot_bytes) != 0) {
+        return -1;
+    }
+
+    epicsTimeGetCurrent(&now);
+    fill_archive_header(mp, &post_mortem->header, mode, &now);
+    post_mortem->mode = mode;
+    post_mortem->chunks_per_frame = chunks_per_frame;
+
+    epicsMutexLock(post_mortem->lock);
+    post_mortem->capacity = capacity;
+    post_mortem->running = 1;
+    epicsMutexUnlock(post_mortem->lock);
+    return 0;
+}
+
+/**
+ * Copies a captured frame, segment or streaming buffer into the oldest slot of the ring. Nothing 
+ * is kept while a dump is in progress. Once a freeze has kept its post trigger captures the ring 
+ * is handed to the dump thread. Called from the acquisition thread only, while data still holds 
+ * the capture. 
+ * 
+ * @param mp            PS6000AModule Pointer to the acquisition thread's module. 
+ * @param channel_index size_t The index of the channel the samples belong to. 
+ * @param data          int16_t Pointer The captured samples. 
+ * @param samples       uint64_t The number of captured samples. 
+ * @param time          epicsTimeStamp Pointer The time the chunk was captured. 
+ * @param flags         uint16_t ARCHIVE_TRIGGERED and ARCHIVE_AUTO_TRIGGERED flags. 
+ */
+void post_mortem_push(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples,
+                      const epicsTimeStamp* time, uint16_t flags){
+    struct PostMortem* post_mortem = mp->post_mortem;
+    size_t bytes = samples * sizeof(int16_t);
+    uint64_t frame = post_mortem->channel_frames[channel_index]++;
+    uint64_t sample_offset = post_mortem->channel_samples[channel_index];
+
+    post_mortem->channel_samples[channel_index] += samples;
+    if (bytes > post_mortem->slot_bytes) {
+        post_mortem->channel_gap[channel_index] = 1;
+        return;
+    }
+
+    epicsMutexLock(post_mortem->lock);
+    int state = post_mortem->state;
+    size_t slot_index = post_mortem->next;
+    epicsMutexUnlock(post_mortem->lock);
+    if (state == POST_MORTEM_DUMPING) {
+        return;
+    }
+
+    // Only this thread writes slots until the state changes to dumping, below 
+    struct PostMortemSlot* slot = &post_mortem->slots[slot_index];
+    memcpy(slot->data, data, bytes);
+    memset((char*)slot->data + bytes, 0, archive_page_align(bytes) - bytes);
+    slot->time = *time;
+    memset(&slot->entry, 0, sizeof(slot->entry));
+    slot->entry.sample_offset = sample_offset;
+    slot->entry.frame = frame;
+    slot->entry.config_version = mp->config_version;
+    slot->entry.samples = samples;
+    slot->entry.channel = channel_index;
+    slot->entry.flags = flags | (post_mortem->channel_gap[channel_index] ? ARCHIVE_GAP : 0);
+    post_mortem->channel_gap[channel_index] = 0;
+
+    epicsMutexLock(post_mortem->lock);
+    post_mortem->next = (slot_index + 1) % post_mortem->capacity;
+    if (post_mortem->used < post_mortem->capacity) {
+        post_mortem->used++;
+    }
+    int dump = post_mortem->state == POST_MORTEM_POST_TRIGGER && --post_mortem->post_chunks_left == 0;
+    if (dump) {
+        post_mortem->state = POST_MORTEM_DUMPING;
+    }
+    epicsMutexUnlock(post_mortem->lock);
+    if (dump) {
+        epicsEventSignal(post_mortem->dump_event);
+    }
+}
+
+/**
+ * Stops filling the ring at the end of an acquisition. A freeze still waiting for its post 
+ * trigger captures is dumped with what it has. Called from the acquisition thread only. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's module. 
+ */
+void post_mortem_stop(struct PS6000AModule* mp){
+    struct PostMortem* post_mortem = mp->post_mortem;
+    int dump = 0;
+
+    epicsMutexLock(post_mortem->lock);
+    post_mortem->running = 0;
+    if (post_mortem->state == POST_MORTEM_POST_TRIGGER) {
+        dump = post_mortem->used > 0;
+        post_mortem->state = dump ? POST_MORTEM_DUMPING : POST_MORTEM_FILLING;
+    }
+    epicsMutexUnlock(post_mortem->lock);
+    if (dump) {
+        epicsEventSignal(post_mortem->dump_event);
+    }
+}
+
+/**
+ * Freezes the ring and dumps it to a capture archive. While acquiring, post_frames more captures 
+ * of every channel are kept first, acquisition is never stopped. Without an acquisition running 
+ * the ring left by the last one is dumped at once. 
+ * 
+ * @param mp PS6000AModule Pointer to the module, from any thread. 
+ * 
+ * @return   0 if a dump is on its way, -1 if the ring is empty, disabled or already frozen. 
+ */
+int post_mortem_freeze(struct PS6000AModule* mp){
+    struct PostMortem* post_mortem = mp->post_mortem;
+    int status = -1;
+    int dump = 0;
+
+    epicsMutexLock(post_mortem->lock);
+    if (post_mortem->state == POST_MORTEM_FILLING && post_mortem->capacity > 0) {
+        size_t post_chunks = post_mortem->post_frames * post_mortem->chunks_per_frame;
+        if (post_mortem->running && post_chunks > 0) {
+            // More post trigger captures than slots would push out every capture before the freeze 
+            post_mortem->post_chunks_left = post_chunks < post_mortem->capacity ? post_chunks : post_mortem->capacity;
+            post_mortem->state = POST_MORTEM_POST_TRIGGER;
+            status = 0;
+        } else if (post_mortem->used > 0) {
+            post_mortem->state = POST_MORTEM_DUMPING;
+            dump = 1;
+            status = 0;
+        }
+    }
+    epicsMutexUnlock(post_mortem->lock);
+    if (dump) {
+        epicsEventSignal(post_mortem->dump_event);
+    }
+    return status;
+}
@@ -0,0 +1,101 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     drvPicoscopePostMortem.h
+ * Description:
+ *     Post-mortem capture history for the Picoscope PS6000A driver. An
+ *     in-memory ring of the latest captures, frozen and dumped to a
+ *     capture archive on request.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DRV_PICOSCOPE_POST_MORTEM
+#define DRV_PICOSCOPE_POST_MORTEM
+
+#include "picoscopeConfig.h"
+#include "picoscopeArchive.h"
+#include <stddef.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+struct PS6000AModule;
+
+enum PostMortemState {
+    POST_MORTEM_FILLING,            // Captures overwrite the oldest slot 
+    POST_MORTEM_POST_TRIGGER,       // Frozen, filling the post trigger slots before dumping 
+    POST_MORTEM_DUMPING             // The dump thread owns the slots 
+};
+
+// One captured chunk of one channel. The entry's time_ns and payload_offset are filled in by the 
+// dump, relative to the oldest slot dumped. 
+struct PostMortemSlot {
+    int16_t* data;                  // Page aligned, slot_bytes long 
+    epicsTimeStamp time;
+    struct ArchiveIndexEntry entry;
+};
+
+// Post-mortem ring of one module. Slots are written by the acquisition thread while filling and 
+// read by the dump thread while dumping, state decides which, so the copies are made unlocked. 
+// Chunks of every channel share the ring in capture order, so it dumps in time order. 
+struct PostMortem {
+    epicsMutexId lock;              // Guards state and the fields marked shared 
+    epicsEventId dump_event;        // Signalled on entering POST_MORTEM_DUMPING 
+    epicsEventId idle_event;        // Signalled when a dump is finished 
+    struct PostMortemSlot* slots;
+    size_t num_slots;               // Slots allocated 
+    size_t slot_bytes;              // Capacity of each slot's data 
+    size_t capacity;                // Slots used by the current acquisition, 0 when disabled 
+    size_t chunks_per_frame;        // Enabled channels 
+    enum ArchiveCaptureMode mode;
+    struct ArchiveHeader header;    // Settings of the chunks in the ring, start is set by the dump 
+    uint64_t channel_frames[NUM_CHANNELS];     // Acquisition thread: chunks kept or skipped 
+    uint64_t channel_samples[NUM_CHANNELS];
+    int channel_gap[NUM_CHANNELS];  // Acquisition thread: a chunk did not fit its slot 
+    int state;                      // Shared: enum PostMortemState 
+    int running;                    // Shared: an acquisition is filling the ring 
+    size_t next;                    // Shared: slot written next 
+    size_t used;                    // Shared: slots holding a chunk 
+    size_t post_chunks_left;        // Shared: chunks still to keep before dumping 
+    uint64_t post_frames;           // Shared: frames kept after a freeze, set by device support 
+    double dump_secs;               // Time the last dump took, diagnostics 
+    uint64_t dumps;
+    epicsThreadId thread;           // Dump thread, joinable 
+    int stopping;                   // Set to end the dump thread 
+};
+
+struct PostMortem* create_post_mortem(void);
+
+int start_post_mortem(struct PS6000AModule* mp);
+
+void stop_post_mortem(struct PostMortem* post_mortem);
+
+void destroy_post_mortem(struct PostMortem* post_mortem);
+
+int post_mortem_start(struct PS6000AModule* mp, enum ArchiveCaptureMode mode);
+
+void post_mortem_push(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples,
+                      const epicsTimeStamp* time, uint16_t flags);
+
+void post_mortem_stop(struct PS6000AModule* mp);
+
+int post_mortem_freeze(struct PS6000AModule* mp);
+
+double post_mortem_fill(struct PostMortem* post_mortem);
+
+#endif
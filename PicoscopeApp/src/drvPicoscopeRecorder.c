@@ -0,0 +1,456 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     drvPicoscopeRecorder.c
+ * Description:
+ *     Disk recorder for the Picoscope PS6000A driver. The acquisition
+ *     thread hands captured frames, segments and streaming buffers to a
+ *     per module recorder thread, which appends them to one capture
+ *     archive per acquisition with large aligned writes.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+
+#include "drvPicoscope.h"
+#include "drvPicoscopeRecorder.h"
+
+#define RECORDER_RATE_SECS 1.0          // Interval the write rate is averaged over 
+
+static char* recorder_dir = NULL;       // Set by PS6000ARecorderDir 
+
+void log_error(char* function_name, uint32_t status, const char* FILE, int LINE);
+
+/**
+ * Sets the directory archives are created in. Without one they are created in the IOC's 
+ * working directory. 
+ * 
+ * @param dir Directory path, or NULL to reset it. 
+ */
+void set_recorder_dir(const char* dir){
+    free(recorder_dir);
+    recorder_dir = dir ? strdup(dir) : NULL;
+}
+
+size_t recorder_queue_depth(struct Recorder* recorder){
+    return epicsRingPointerGetUsed(recorder->ready);
+}
+
+/****************************************************************************************
+ * Recorder thread 
+ ****************************************************************************************/
+
+static void update_recorder_rate(struct Recorder* recorder){
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &recorder->rate_time);
+    if (elapsed < RECORDER_RATE_SECS) {
+        return;
+    }
+    recorder->rate_mbps = (recorder->bytes_written - recorder->rate_bytes) / elapsed / 1e6;
+    recorder->rate_bytes = recorder->bytes_written;
+    recorder->rate_time = now;
+}
+
+static void close_archive(struct Recorder* recorder){
+    int status = archive_writer_close(&recorder->writer);
+    if (status != ARCHIVE_OK) {
+        printf("Error closing capture archive: %s\n", archive_strerror(status));
+    }
+    recorder->open = 0;
+    recorder->writing = 0;
+}
+
+/**
+ * Runs one block on the recorder thread. 
+ * 
+ * @param recorder Recorder Pointer of the module. 
+ * @param block    RecorderBlock Pointer taken from the ready queue. 
+ */
+static void write_recorder_block(struct Recorder* recorder, struct RecorderBlock* block){
+    int status;
+
+    switch (block->type) {
+        case RECORDER_OPEN:
+            if (recorder->open) {
+                close_archive(recorder);
+            }
+            status = archive_writer_open(&recorder->writer, block->path, (struct ArchiveHeader*)block->data);
+            if (status != ARCHIVE_OK) {
+                printf("Error creating capture archive %s: %s\n", block->path, archive_strerror(status));
+            } else {
+                printf("Recording to %s%s\n", block->path, recorder->writer.direct ? " with O_DIRECT" : "");
+                recorder->open = 1;
+                recorder->writing = 1;
+            }
+            free(block->path);
+            block->path = NULL;
+            break;
+
+        case RECORDER_DATA:
+            if (!recorder->writing) {
+                epicsAtomicIncrSizeT(&recorder->dropped);
+                break;
+            }
+            status = archive_write_chunk(&recorder->writer, &block->entry, block->data, block->bytes);
+            if (status != ARCHIVE_OK) {
+                // Keep what was written readable, the last index block is still written on close 
+                printf("Error writing capture archive: %s\n", archive_strerror(status));
+                epicsAtomicIncrSizeT(&recorder->dropped);
+                recorder->writing = 0;
+            }
+            break;
+
+        case RECORDER_CLOSE:
+            if (recorder->open) {
+                close_archive(recorder);
+            }
+            break;
+    }
+}
+
+/**
+ * Thread function of a module's recorder. Writes the blocks queued by the acquisition thread in 
+ * order and returns them to the free queue. A chunk that cannot be written, because no archive 
+ * is open or an earlier write failed, is counted as dropped. Returns once stopping is set and 
+ * the ready queue is empty. 
+ * 
+ * @param arg Void Pointer Passed in from EPICS thread create, the module's Recorder pointer. 
+ */
+static void recorder_thread_function(void *arg){
+    struct Recorder* recorder = (struct Recorder*)arg;
+
+    while (1) {
+        struct RecorderBlock* block = epicsRingPointerPop(recorder->ready);
+        if (!block) {
+            if (recorder->stopping) {
+                return;
+            }
+            // Wake up at least once per interval so the rate falls to zero when idle 
+            epicsEventWaitWithTimeout(recorder->ready_event, RECORDER_RATE_SECS);
+            update_recorder_rate(recorder);
+            continue;
+        }
+        uint64_t bytes_before = recorder->writer.bytes_written;
+        write_recorder_block(recorder, block);
+        if (block->type == RECORDER_DATA) {
+            recorder->bytes_written += recorder->writer.bytes_written - bytes_before;
+        }
+        epicsRingPointerPush(recorder->free, block);
+        epicsEventSignal(recorder->free_event);
+        update_recorder_rate(recorder);
+    }
+}
+
+/**
+ * Allocates the disk recorder of a module. Block memory is allocated by the first recording, the 
+ * recorder thread is started by start_recorder. 
+ * 
+ * @return   Pointer to the new Recorder, or NULL on failure. 
+ */
+struct Recorder* create_recorder(void){
+    struct Recorder* recorder = calloc(1, sizeof(struct Recorder));
+    if (!recorder) {
+        return NULL;
+    }
+    // One spare slot so a ring can hold every block 
+    recorder->ready = epicsRingPointerCreate(RECORDER_QUEUE_DEPTH + 1);
+    recorder->free = epicsRingPointerCreate(RECORDER_QUEUE_DEPTH + 1);
+    recorder->ready_event = epicsEventCreate(epicsEventEmpty);
+    recorder->free_event = epicsEventCreate(epicsEventEmpty);
+    if (!recorder->ready || !recorder->free || !recorder->ready_event || !recorder->free_event) {
+        destroy_recorder(recorder);
+        return NULL;
+    }
+    for (size_t block_index = 0; block_index < RECORDER_QUEUE_DEPTH; block_index++) {
+        epicsRingPointerPush(recorder->free, &recorder->blocks[block_index]);
+    }
+    recorder->writer.fd = -1;
+    epicsTimeGetCurrent(&recorder->rate_time);
+    return recorder;
+}
+
+/**
+ * Starts the recorder thread of a module. 
+ * 
+ * @param mp PS6000AModule Pointer to the module, its recorder set. 
+ * 
+ * @return   0 on success, -1 if the thread could not be created. 
+ */
+int start_recorder(struct PS6000AModule* mp){
+    epicsThreadOpts opts = EPICS_THREAD_OPTS_INIT;
+    char thread_name[32];
+
+    // Below the capture thread, falling behind costs dropped chunks not missed captures 
+    opts.priority = epicsThreadPriorityMedium - 5;
+    opts.stackSize = epicsThreadGetStackSize(epicsThreadStackMedium);
+    opts.joinable = 1;
+    snprintf(thread_name, sizeof(thread_name), "record%s", mp->serial_num);
+    mp->recorder->thread = epicsThreadCreateOpt(thread_name, recorder_thread_function, mp->recorder, &opts);
+    return mp->recorder->thread ? 0 : -1;
+}
+
+/**
+ * Ends the recorder thread once it has written the blocks already queued, and waits for it. 
+ * 
+ * @param recorder Recorder Pointer The recorder whose thread was started. 
+ */
+void stop_recorder(struct Recorder* recorder){
+    recorder->stopping = 1;
+    epicsEventSignal(recorder->ready_event);
+    epicsThreadMustJoin(recorder->thread);
+    recorder->thread = NULL;
+}
+
+// Frees a recorder whose thread is not running 
+void destroy_recorder(struct Recorder* recorder){
+    if (recorder->open) {
+        close_archive(recorder);
+    }
+    for (size_t block_index = 0; block_index < RECORDER_QUEUE_DEPTH; block_index++) {
+        free(recorder->blocks[block_index].data);
+        free(recorder->blocks[block_index].path);
+    }
+    if (recorder->ready)
+        epicsRingPointerDelete(recorder->ready);
+    if (recorder->free)
+        epicsRingPointerDelete(recorder->free);
+    if (recorder->ready_event)
+        epicsEventDestroy(recorder->ready_event);
+    if (recorder->free_event)
+        epicsEventDestroy(recorder->free_event);
+    free(recorder);
+}
+
+/****************************************************************************************
+ * Acquisition thread side 
+ ****************************************************************************************/
+
+static struct RecorderBlock* take_recorder_block(struct Recorder* recorder, int wait){
+    struct RecorderBlock* block;
+    while (!(block = epicsRingPointerPop(recorder->free)) && wait) {
+        epicsEventWait(recorder->free_event);
+    }
+    return block;
+}
+
+static void queue_recorder_block(struct Recorder* recorder, struct RecorderBlock* block){
+    epicsRingPointerPush(recorder->ready, block);
+    epicsEventSignal(recorder->ready_event);
+}
+
+/**
+ * Grows the recorder blocks to hold chunks of the given size. Blocks are only replaced once the 
+ * recorder thread has returned all of them. 
+ * 
+ * @return 0 on success, -1 if the memory could not be allocated. 
+ */
+static int size_recorder_blocks(struct Recorder* recorder, size_t block_bytes){
+    if (block_bytes <= recorder->block_bytes) {
+        return 0;
+    }
+    while (epicsRingPointerGetUsed(recorder->free) < RECORDER_QUEUE_DEPTH) {
+        epicsEventWait(recorder->free_event);
+    }
+    recorder->block_bytes = 0;
+    for (size_t block_index = 0; block_index < RECORDER_QUEUE_DEPTH; block_index++) {
+        struct RecorderBlock* block = &recorder->blocks[block_index];
+        free(block->data);
+        block->data = NULL;
+        if (posix_memalign(&block->data, ARCHIVE_PAGE_BYTES, block_bytes) != 0) {
+            block->data = NULL;
+            log_error("recorder posix_memalign", ENOMEM, __FILE__, __LINE__);
+            return -1;
+        }
+    }
+    recorder->block_bytes = block_bytes;
+    return 0;
+}
+
+/**
+ * Builds the path of a capture archive in the recorder directory, from the module serial number, 
+ * the time the archive starts and an optional tag. 
+ * 
+ * @param mp    PS6000AModule Pointer to the module the archive belongs to. 
+ * @param start epicsTimeStamp Pointer The time the archive starts. 
+ * @param tag   Suffix told apart from recordings, e.g. "postmortem", or NULL. 
+ * @param path  Buffer of PATH_MAX bytes the path is written to. 
+ * 
+ * @return      0 on success, -1 if the path is too long. 
+ */
+int archive_file_path(struct PS6000AModule* mp, const epicsTimeStamp* start, const char* tag, char* path){
+    char start_text[32];
+    struct timespec start_ts;
+    struct tm start_tm;
+
+    epicsTimeToTimespec(&start_ts, start);
+    localtime_r(&start_ts.tv_sec, &start_tm);
+    strftime(start_text, sizeof(start_text), "%Y%m%dT%H%M%S", &start_tm);
+    if (snprintf(path, PATH_MAX, "%s/%s_%s_%03ld%s%s" ARCHIVE_FILE_EXTENSION,
+                 recorder_dir ? recorder_dir : ".", mp->serial_num, start_text,
+                 start_ts.tv_nsec / 1000000, tag ? "_" : "", tag ? tag : "") >= PATH_MAX) {
+        log_error("archive path", ENAMETOOLONG, __FILE__, __LINE__);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Fills an archive header with the capture settings of the acquisition thread's module, the 
+ * settings the archived samples need to be interpreted. 
+ * 
+ * @param mp     PS6000AModule Pointer to the acquisition thread's module. 
+ * @param header ArchiveHeader Pointer to the header to fill, cleared first. 
+ * @param mode   ArchiveCaptureMode The kind of chunk the acquisition produces. 
+ * @param start  epicsTimeStamp Pointer The time entry times are relative to. 
+ */
+void fill_archive_header(struct PS6000AModule* mp, struct ArchiveHeader* header, enum ArchiveCaptureMode mode, 
+                         const epicsTimeStamp* start){
+    struct timespec start_ts;
+
+    epicsTimeToTimespec(&start_ts, start);
+    memset(header, 0, sizeof(*header));
+    strncpy(header->serial_num, mp->serial_num, sizeof(header->serial_num) - 1);
+    header->start_secs = start_ts.tv_sec;
+    header->start_nsec = start_ts.tv_nsec;
+    header->resolution = mp->resolution;
+    header->capture_mode = mode;
+    header->timebase = mp->sample_config.timebase_configs.timebase;
+    header->down_sample_ratio_mode = mp->sample_config.down_sample_ratio_mode;
+    header->down_sample_ratio = mp->sample_config.down_sample_ratio;
+    header->sample_interval_secs = mp->sample_config.timebase_configs.sample_interval_secs;
+    header->trigger_position_ratio = mp->sample_config.trigger_position_ratio;
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        header->channels[i].enabled = get_channel_status(mp->channel_configs[i].channel, mp->channel_status) ? 1 : 0;
+        header->channels[i].coupling = mp->channel_configs[i].coupling;
+        header->channels[i].range = mp->channel_configs[i].range;
+        header->channels[i].bandwidth = mp->channel_configs[i].bandwidth;
+        header->channels[i].analog_offset = mp->channel_configs[i].analog_offset;
+    }
+}
+
+/**
+ * Starts a capture archive for the acquisition about to run. The archive is named after the 
+ * module serial number and the start time, its header holds the capture settings the samples 
+ * need to be interpreted. Called from the acquisition thread before capturing. 
+ * 
+ * @param mp   PS6000AModule Pointer to the acquisition thread's module. 
+ * @param mode ArchiveCaptureMode The kind of chunk the acquisition produces. 
+ * 
+ * @return     0 if the archive was queued, -1 otherwise. 
+ */
+int recorder_start(struct PS6000AModule* mp, enum ArchiveCaptureMode mode){
+    struct Recorder* recorder = mp->recorder;
+    char path[PATH_MAX];
+
+    uint64_t chunk_samples = mode == ARCHIVE_STREAMING ? 
+        mp->sample_config.subwaveform_samples_num : mp->sample_config.num_samples;
+    size_t chunk_bytes = archive_page_align(chunk_samples * sizeof(int16_t));
+    if (size_recorder_blocks(recorder, chunk_bytes > ARCHIVE_PAGE_BYTES ? chunk_bytes : ARCHIVE_PAGE_BYTES) != 0) {
+        return -1;
+    }
+
+    epicsTimeGetCurrent(&recorder->start);
+    if (archive_file_path(mp, &recorder->start, NULL, path) != 0) {
+        return -1;
+    }
+
+    struct RecorderBlock* block = take_recorder_block(recorder, 1);
+    block->path = strdup(path);
+    if (!block->path) {
+        epicsRingPointerPush(recorder->free, block);
+        return -1;
+    }
+    fill_archive_header(mp, (struct ArchiveHeader*)block->data, mode, &recorder->start);
+    for (size_t i = 0; i < NUM_CHANNELS; i++) {
+        recorder->channel_frames[i] = 0;
+        recorder->channel_samples[i] = 0;
+        recorder->channel_gap[i] = 0;
+    }
+
+    block->type = RECORDER_OPEN;
+    block->bytes = 0;
+    queue_recorder_block(recorder, block);
+    return 0;
+}
+
+/**
+ * Copies a captured frame, segment or streaming buffer into a recorder block and queues it for 
+ * the recorder thread. Never blocks, if every block is still queued the chunk is dropped and 
+ * counted. The channel's frame and sample numbers advance either way, and the next chunk queued 
+ * is flagged ARCHIVE_GAP. Called from the acquisition thread only, while data still holds the 
+ * capture. 
+ * 
+ * @param mp            PS6000AModule Pointer to the acquisition thread's module. 
+ * @param channel_index size_t The index of the channel the samples belong to. 
+ * @param data          int16_t Pointer The captured samples. 
+ * @param samples       uint64_t The number of captured samples. 
+ * @param time          epicsTimeStamp Pointer The time the chunk was captured. 
+ * @param flags         uint16_t ARCHIVE_TRIGGERED and ARCHIVE_AUTO_TRIGGERED flags. 
+ */
+void recorder_submit(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples, 
+                     const epicsTimeStamp* time, uint16_t flags){
+    struct Recorder* recorder = mp->recorder;
+    size_t bytes = samples * sizeof(int16_t);
+    uint64_t frame = recorder->channel_frames[channel_index]++;
+    uint64_t sample_offset = recorder->channel_samples[channel_index];
+
+    recorder->channel_samples[channel_index] += samples;
+    struct RecorderBlock* block = bytes <= recorder->block_bytes ? take_recorder_block(recorder, 0) : NULL;
+    if (!block) {
+        epicsAtomicIncrSizeT(&recorder->dropped);
+        recorder->channel_gap[channel_index] = 1;
+        return;
+    }
+
+    memset(&block->entry, 0, sizeof(block->entry));
+    block->entry.sample_offset = sample_offset;
+    block->entry.time_ns = (int64_t)(epicsTimeDiffInSeconds(time, &recorder->start) * 1e9);
+    block->entry.frame = frame;
+    block->entry.config_version = mp->config_version;
+    block->entry.samples = samples;
+    block->entry.channel = channel_index;
+    block->entry.flags = flags | (recorder->channel_gap[channel_index] ? ARCHIVE_GAP : 0);
+    recorder->channel_gap[channel_index] = 0;
+
+    block->bytes = archive_page_align(bytes);
+    memcpy(block->data, data, bytes);
+    memset((char*)block->data + bytes, 0, block->bytes - bytes);
+    block->type = RECORDER_DATA;
+    queue_recorder_block(recorder, block);
+}
+
+/**
+ * Ends the current archive. The recorder thread writes the index and closes the file once the 
+ * chunks queued before it are written. Called from the acquisition thread only. 
+ * 
+ * @param mp PS6000AModule Pointer to the acquisition thread's module. 
+ */
+void recorder_stop(struct PS6000AModule* mp){
+    struct RecorderBlock* block = take_recorder_block(mp->recorder, 1);
+    block->type = RECORDER_CLOSE;
+    block->bytes = 0;
+    queue_recorder_block(mp->recorder, block);
+}
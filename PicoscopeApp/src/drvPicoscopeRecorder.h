@@ -0,0 +1,103 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     drvPicoscopeRecorder.h
+ * Description:
+ *     Disk recorder for the Picoscope PS6000A driver. A writer pipeline
+ *     that appends captures to capture archives (picoscopeArchive.h).
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DRV_PICOSCOPE_RECORDER
+#define DRV_PICOSCOPE_RECORDER
+
+#include "picoscopeConfig.h"
+#include "picoscopeArchive.h"
+#include <stddef.h>
+#include <epicsEvent.h>
+#include <epicsRingPointer.h>
+#include <epicsTime.h>
+
+struct PS6000AModule;
+
+enum RecorderBlockType { 
+    RECORDER_OPEN,                  // Create path, the ArchiveHeader is in data 
+    RECORDER_DATA,                  // Append a chunk 
+    RECORDER_CLOSE                  // Write the index and close the archive 
+};
+
+// Page aligned write buffer passed from the acquisition thread to the recorder thread. 
+struct RecorderBlock { 
+    enum RecorderBlockType type; 
+    void* data; 
+    size_t bytes;                   // Bytes to write, a multiple of ARCHIVE_PAGE_BYTES 
+    struct ArchiveIndexEntry entry; // RECORDER_DATA only, the recorder thread fills in the offset 
+    char* path;                     // RECORDER_OPEN only, freed by the recorder thread 
+};
+
+// Disk recorder of one module. Blocks circulate like the channel frame queues: the acquisition 
+// thread pops from free and pushes to ready, the recorder thread writes them and pushes them back. 
+// Data is dropped, never waited for, when no block is free. The statistics are diagnostics. 
+struct Recorder { 
+    struct RecorderBlock blocks[RECORDER_QUEUE_DEPTH]; 
+    size_t block_bytes;             // Capacity of each block's data 
+    epicsRingPointerId ready; 
+    epicsRingPointerId free; 
+    epicsEventId ready_event; 
+    epicsEventId free_event; 
+    epicsTimeStamp start;           // Acquisition thread: start of the current archive 
+    uint64_t channel_frames[NUM_CHANNELS];     // Acquisition thread: chunks archived or dropped 
+    uint64_t channel_samples[NUM_CHANNELS]; 
+    int channel_gap[NUM_CHANNELS];  // Acquisition thread: a chunk was dropped since the last one queued 
+    struct ArchiveWriter writer;    // Recorder thread 
+    int writing;                    // Recorder thread: an archive is open and has not failed 
+    int open;                       // Recorder thread: an archive is open 
+    size_t dropped;                 // Chunks not archived, accessed with epicsAtomic 
+    uint64_t bytes_written; 
+    double rate_mbps;               // Sustained write rate over the last second 
+    epicsTimeStamp rate_time; 
+    uint64_t rate_bytes; 
+    epicsThreadId thread;           // Recorder thread, joinable 
+    int stopping;                   // Set to end the recorder thread once the ready blocks are written 
+};
+
+void set_recorder_dir(const char* dir);
+
+int archive_file_path(struct PS6000AModule* mp, const epicsTimeStamp* start, const char* tag, char* path);
+
+void fill_archive_header(struct PS6000AModule* mp, struct ArchiveHeader* header, enum ArchiveCaptureMode mode, 
+                         const epicsTimeStamp* start);
+
+struct Recorder* create_recorder(void);
+
+int start_recorder(struct PS6000AModule* mp);
+
+void stop_recorder(struct Recorder* recorder);
+
+void destroy_recorder(struct Recorder* recorder);
+
+int recorder_start(struct PS6000AModule* mp, enum ArchiveCaptureMode mode);
+
+void recorder_submit(struct PS6000AModule* mp, size_t channel_index, const int16_t* data, uint64_t samples, 
+                     const epicsTimeStamp* time, uint16_t flags);
+
+void recorder_stop(struct PS6000AModule* mp);
+
+size_t recorder_queue_depth(struct Recorder* recorder);
+
+#endif
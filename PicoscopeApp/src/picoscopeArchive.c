@@ -0,0 +1,433 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeArchive.c
+ * Description:
+ *     Writer and memory-mapped reader of the capture archives made by
+ *     the Picoscope PS6000A disk recorder. See picoscopeArchive.h for
+ *     the layout.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE                     // O_DIRECT
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "picoscopeArchive.h"
+
+size_t archive_page_align(size_t bytes){
+    return (bytes + ARCHIVE_PAGE_BYTES - 1) / ARCHIVE_PAGE_BYTES * ARCHIVE_PAGE_BYTES;
+}
+
+const char* archive_strerror(int error){
+    switch (error) {
+        case ARCHIVE_OK:               return "No error";
+        case ARCHIVE_ERROR_IO:         return strerror(errno);
+        case ARCHIVE_ERROR_FORMAT:     return "Not a capture archive, or an unsupported version";
+        case ARCHIVE_ERROR_INCOMPLETE: return "Archive was not closed before its first index block";
+        case ARCHIVE_ERROR_CORRUPT:    return "Archive index does not match the file";
+        default:                       return "Unknown error";
+    }
+}
+
+/****************************************************************************************
+ * Writer
+ ****************************************************************************************/
+
+static int write_pages(struct ArchiveWriter* writer, const void* data, size_t bytes, uint64_t offset){
+    const char* next = data;
+    while (bytes > 0) {
+        ssize_t written = pwrite(writer->fd, next, bytes, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+#ifdef O_DIRECT
+        if (written < 0 && errno == EINVAL && writer->direct) {
+            // The device wants a larger alignment, carry on through the page cache
+            fcntl(writer->fd, F_SETFL, fcntl(writer->fd, F_GETFL) & ~O_DIRECT);
+            writer->direct = 0;
+            continue;
+        }
+#endif
+        if (written <= 0) {
+            if (written == 0) {
+                errno = ENOSPC;
+            }
+            return ARCHIVE_ERROR_IO;
+        }
+        next += written;
+        offset += written;
+        bytes -= written;
+        writer->bytes_written += written;
+    }
+    return ARCHIVE_OK;
+}
+
+/**
+ * Writes the index block being filled after the payload it indexes, syncs it, then rewrites the
+ * header to point at it. An archive is readable up to its last index block whatever happens to
+ * the IOC afterwards.
+ *
+ * @param writer ArchiveWriter Pointer of an open archive.
+ *
+ * @return ARCHIVE_OK on success, or an ArchiveError. The entries stay in the block on failure.
+ */
+static int flush_index_block(struct ArchiveWriter* writer){
+    struct ArchiveIndexBlock* block = writer->block;
+    if (block->num_entries == 0) {
+        return ARCHIVE_OK;
+    }
+    size_t used = sizeof(*block) + block->num_entries * sizeof(struct ArchiveIndexEntry);
+    size_t bytes = archive_page_align(used);
+
+    memcpy(block->magic, ARCHIVE_INDEX_MAGIC, sizeof(block->magic));
+    block->previous_offset = writer->header->index_offset;
+    block->first_entry = writer->header->num_entries;
+    memset((char*)block + used, 0, bytes - used);
+    int status = write_pages(writer, block, bytes, writer->offset);
+    if (status != ARCHIVE_OK) {
+        return status;
+    }
+    // The block must be on disk before the header points at it
+    if (fdatasync(writer->fd) != 0) {
+        return ARCHIVE_ERROR_IO;
+    }
+    writer->header->index_offset = writer->offset;
+    writer->header->num_entries += block->num_entries;
+    writer->offset += bytes;
+    block->num_entries = 0;
+    return write_pages(writer, writer->header, ARCHIVE_PAGE_BYTES, 0);
+}
+
+/**
+ * Creates an archive and writes its header page. The file must not exist. O_DIRECT is used
+ * when the file system accepts it.
+ *
+ * @param writer ArchiveWriter Pointer to initialize.
+ * @param path   Path of the new archive.
+ * @param header ArchiveHeader Pointer with the capture settings. Magic, version and the
+ *               index fields are filled in by the writer.
+ *
+ * @return ARCHIVE_OK on success, or an ArchiveError.
+ */
+int archive_writer_open(struct ArchiveWriter* writer, const char* path, const struct ArchiveHeader* header){
+    int flags = O_WRONLY | O_CREAT | O_EXCL;
+    void* page = NULL;
+    void* block = NULL;
+
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    if (posix_memalign(&page, ARCHIVE_PAGE_BYTES, ARCHIVE_PAGE_BYTES) != 0) {
+        errno = ENOMEM;
+        return ARCHIVE_ERROR_IO;
+    }
+    if (posix_memalign(&block, ARCHIVE_PAGE_BYTES, ARCHIVE_INDEX_BLOCK_BYTES) != 0) {
+        free(page);
+        errno = ENOMEM;
+        return ARCHIVE_ERROR_IO;
+    }
+    memset(page, 0, ARCHIVE_PAGE_BYTES);
+    memset(block, 0, ARCHIVE_INDEX_BLOCK_BYTES);
+    writer->header = page;
+    writer->block = block;
+    writer->block_entries = (struct ArchiveIndexEntry*)(writer->block + 1);
+    *writer->header = *header;
+    memcpy(writer->header->magic, ARCHIVE_MAGIC, sizeof(writer->header->magic));
+    writer->header->version = ARCHIVE_VERSION;
+    writer->header->page_bytes = ARCHIVE_PAGE_BYTES;
+    writer->header->index_offset = 0;
+    writer->header->num_entries = 0;
+    writer->header->payload_bytes = 0;
+    writer->header->closed = 0;
+
+#ifdef O_DIRECT
+    writer->fd = open(path, flags | O_DIRECT, 0644);
+    writer->direct = writer->fd >= 0;
+#endif
+    if (writer->fd < 0) {
+        // Some file systems, tmpfs for one, refuse O_DIRECT
+        writer->fd = open(path, flags, 0644);
+    }
+    if (writer->fd < 0 || write_pages(writer, writer->header, ARCHIVE_PAGE_BYTES, 0) != ARCHIVE_OK) {
+        int error = errno;
+        if (writer->fd >= 0) {
+            close(writer->fd);
+            unlink(path);
+        }
+        free(writer->header);
+        free(writer->block);
+        writer->header = NULL;
+        writer->block = NULL;
+        errno = error;
+        return ARCHIVE_ERROR_IO;
+    }
+    writer->offset = ARCHIVE_PAGE_BYTES;
+    return ARCHIVE_OK;
+}
+
+/**
+ * Appends one chunk. The payload offset is filled into the entry, and the entry's time is raised
+ * to the previous entry's if it is earlier, so the index stays sorted by time. The index block is
+ * written out as soon as it is full.
+ *
+ * @param writer        ArchiveWriter Pointer of an open archive.
+ * @param entry         ArchiveIndexEntry Pointer describing the chunk.
+ * @param payload       The samples, page aligned and zero padded to payload_bytes.
+ * @param payload_bytes A multiple of ARCHIVE_PAGE_BYTES.
+ *
+ * @return ARCHIVE_OK on success, or an ArchiveError. A failed chunk is not indexed, a chunk whose
+ *         full index block could not be written stays in the block for the next attempt.
+ */
+int archive_write_chunk(struct ArchiveWriter* writer, struct ArchiveIndexEntry* entry, const void* payload, size_t payload_bytes){
+    struct ArchiveIndexBlock* block = writer->block;
+
+    if (block->num_entries == ARCHIVE_INDEX_BLOCK_ENTRIES) {
+        int status = flush_index_block(writer);
+        if (status != ARCHIVE_OK) {
+            return status;
+        }
+    }
+    if ((writer->header->num_entries > 0 || block->num_entries > 0) && entry->time_ns < writer->last_time_ns) {
+        entry->time_ns = writer->last_time_ns;
+    }
+
+    int status = write_pages(writer, payload, payload_bytes, writer->offset);
+    if (status != ARCHIVE_OK) {
+        return status;
+    }
+    entry->payload_offset = writer->offset;
+    writer->offset += payload_bytes;
+    writer->header->payload_bytes += payload_bytes;
+    writer->block_entries[block->num_entries++] = *entry;
+    writer->last_time_ns = entry->time_ns;
+    if (block->num_entries == ARCHIVE_INDEX_BLOCK_ENTRIES) {
+        return flush_index_block(writer);
+    }
+    return ARCHIVE_OK;
+}
+
+/**
+ * Writes the last index block, marks the header closed and closes the file. Chunks written before
+ * an earlier failure remain readable.
+ *
+ * @param writer ArchiveWriter Pointer of an open archive.
+ *
+ * @return ARCHIVE_OK on success, or an ArchiveError.
+ */
+int archive_writer_close(struct ArchiveWriter* writer){
+    int status = flush_index_block(writer);
+
+    if (status == ARCHIVE_OK) {
+        writer->header->closed = 1;
+        if (fdatasync(writer->fd) != 0 ||
+            write_pages(writer, writer->header, ARCHIVE_PAGE_BYTES, 0) != ARCHIVE_OK ||
+            fdatasync(writer->fd) != 0) {
+            status = ARCHIVE_ERROR_IO;
+        }
+    }
+    int error = errno;
+    close(writer->fd);
+    free(writer->block);
+    free(writer->header);
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    errno = error;
+    return status;
+}
+
+/****************************************************************************************
+ * Reader
+ ****************************************************************************************/
+
+/**
+ * Rebuilds the index of an archive by walking its index blocks back from the last one.
+ *
+ * @param reader ArchiveReader Pointer of a mapped archive with a checked header.
+ *
+ * @return ARCHIVE_OK on success, or an ArchiveError.
+ */
+static int load_index(struct ArchiveReader* reader){
+    const struct ArchiveHeader* header = reader->header;
+    uint64_t num_entries = header->num_entries;
+    uint64_t offset = header->index_offset;
+    uint64_t next_entry = num_entries;
+
+    if (num_entries > reader->map_bytes / sizeof(struct ArchiveIndexEntry)) {
+        return ARCHIVE_ERROR_CORRUPT;
+    }
+    struct ArchiveIndexEntry* index = malloc(num_entries ? num_entries * sizeof(*index) : 1);
+    if (!index) {
+        errno = ENOMEM;
+        return ARCHIVE_ERROR_IO;
+    }
+    // Blocks are written in order, each entirely before the next, so offsets fall and entries end
+    // where the next block's start
+    while (offset != 0) {
+        if (offset % ARCHIVE_PAGE_BYTES != 0 || offset > reader->map_bytes - sizeof(struct ArchiveIndexBlock)) {
+            break;
+        }
+        const struct ArchiveIndexBlock* block = (const struct ArchiveIndexBlock*)(reader->map + offset);
+        if (memcmp(block->magic, ARCHIVE_INDEX_MAGIC, sizeof(block->magic)) != 0 ||
+            block->num_entries > ARCHIVE_INDEX_BLOCK_ENTRIES ||
+            block->first_entry + block->num_entries != next_entry ||
+            block->num_entries > (reader->map_bytes - offset - sizeof(*block)) / sizeof(struct ArchiveIndexEntry) ||
+            block->previous_offset >= offset) {
+            break;
+        }
+        memcpy(&index[block->first_entry], block + 1, block->num_entries * sizeof(struct ArchiveIndexEntry));
+        next_entry = block->first_entry;
+        offset = block->previous_offset;
+    }
+    if (offset != 0 || next_entry != 0) {
+        free(index);
+        return ARCHIVE_ERROR_CORRUPT;
+    }
+    reader->index = index;
+    reader->num_entries = num_entries;
+    return ARCHIVE_OK;
+}
+
+/**
+ * Maps an archive read only, checks its header and rebuilds its index from the index blocks.
+ *
+ * @param reader ArchiveReader Pointer to initialize.
+ * @param path   Path of the archive.
+ *
+ * @return ARCHIVE_OK on success, or an ArchiveError.
+ */
+int archive_open(struct ArchiveReader* reader, const char* path){
+    struct stat info;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        return ARCHIVE_ERROR_IO;
+    }
+    if (fstat(reader->fd, &info) != 0) {
+        archive_close(reader);
+        return ARCHIVE_ERROR_IO;
+    }
+    if ((size_t)info.st_size < sizeof(struct ArchiveHeader)) {
+        archive_close(reader);
+        return ARCHIVE_ERROR_FORMAT;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (map == MAP_FAILED) {
+        archive_close(reader);
+        return ARCHIVE_ERROR_IO;
+    }
+    reader->map = map;
+    reader->map_bytes = info.st_size;
+    reader->header = (const struct ArchiveHeader*)reader->map;
+
+    const struct ArchiveHeader* header = reader->header;
+    if (memcmp(header->magic, ARCHIVE_MAGIC, sizeof(header->magic)) != 0 || header->version != ARCHIVE_VERSION) {
+        archive_close(reader);
+        return ARCHIVE_ERROR_FORMAT;
+    }
+    if (header->index_offset == 0 && !header->closed) {
+        archive_close(reader);
+        return ARCHIVE_ERROR_INCOMPLETE;
+    }
+    int status = load_index(reader);
+    if (status != ARCHIVE_OK) {
+        int error = errno;
+        archive_close(reader);
+        errno = error;
+        return status;
+    }
+    return ARCHIVE_OK;
+}
+
+void archive_close(struct ArchiveReader* reader){
+    free((void*)reader->index);
+    if (reader->map) {
+        munmap((void*)reader->map, reader->map_bytes);
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+}
+
+/**
+ * Binary searches the index for the first chunk captured at or after a time.
+ *
+ * @param reader  ArchiveReader Pointer of an open archive.
+ * @param time_ns Time since the archive start.
+ *
+ * @return Index of the entry, num_entries if every chunk is earlier.
+ */
+uint64_t archive_find_time(const struct ArchiveReader* reader, int64_t time_ns){
+    uint64_t low = 0;
+    uint64_t high = reader->num_entries;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (reader->index[middle].time_ns < time_ns) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * Binary searches the index for a frame, then steps over the other channels of that frame.
+ *
+ * @param reader  ArchiveReader Pointer of an open archive.
+ * @param channel Channel index, or -1 for any channel.
+ * @param frame   Frame number.
+ *
+ * @return Index of the first entry of the channel at or after the frame, num_entries if none.
+ */
+uint64_t archive_find_frame(const struct ArchiveReader* reader, int channel, uint64_t frame){
+    uint64_t low = 0;
+    uint64_t high = reader->num_entries;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (reader->index[middle].frame < frame) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    while (channel >= 0 && low < reader->num_entries && reader->index[low].channel != channel) {
+        low++;
+    }
+    return low;
+}
+
+/**
+ * Returns the samples of a chunk, straight from the mapping.
+ *
+ * @return int16_t Pointer to entry->samples samples, or NULL if the chunk lies outside the file.
+ */
+const int16_t* archive_samples(const struct ArchiveReader* reader, const struct ArchiveIndexEntry* entry){
+    if (entry->payload_offset > reader->map_bytes ||
+        entry->samples > (reader->map_bytes - entry->payload_offset) / sizeof(int16_t)) {
+        return NULL;
+    }
+    return (const int16_t*)(reader->map + entry->payload_offset);
+}
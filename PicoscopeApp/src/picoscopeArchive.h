@@ -0,0 +1,172 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeArchive.h
+ * Description:
+ *     Capture archive container written by the Picoscope PS6000A disk
+ *     recorder, with the writer and a memory-mapped random-access
+ *     reader. Has no EPICS or Pico SDK dependencies, so offline tools
+ *     and synthetic captures can use it directly.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PICOSCOPE_ARCHIVE
+#define PICOSCOPE_ARCHIVE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC "PS6KARC1"
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_PAGE_BYTES 4096         // Header, payload and index are page aligned, as O_DIRECT requires
+#define ARCHIVE_INDEX_MAGIC "PS6KIDX1"
+#define ARCHIVE_INDEX_BLOCK_BYTES (64 * 1024)   // Largest index block, the writer's only index memory
+#define ARCHIVE_FILE_EXTENSION ".ps6karc"
+#define ARCHIVE_MAX_CHANNELS 4
+
+// Archive layout, little endian as written by the IOC host:
+//   page 0          ArchiveHeader, zero padded to ARCHIVE_PAGE_BYTES
+//   payload pages   The int16 samples of each chunk, zero padded to whole pages, in index order
+//   index blocks    Between the payload pages, an ArchiveIndexBlock followed by its entries,
+//                   zero padded to whole pages
+// The writer keeps one index block in memory. Each time it fills, and when the archive is closed,
+// the block is written after the payload it indexes, then the header is rewritten to point at it.
+// Each block points at the one before, so the reader walks back from index_offset to rebuild the
+// index. An archive that was not closed, the IOC stopped while recording, reads up to its last
+// index block; an archive with index_offset 0 and not closed has no index and cannot be read.
+
+enum ArchiveCaptureMode {
+    ARCHIVE_BLOCK = 0,              // One chunk per channel per block capture
+    ARCHIVE_RAPID_BLOCK = 1,        // One chunk per channel per segment
+    ARCHIVE_STREAMING = 2           // One chunk per channel per streaming buffer
+};
+
+// ArchiveIndexEntry flags
+#define ARCHIVE_TRIGGERED       0x0001  // A trigger event captured the chunk, or falls within it when streaming
+#define ARCHIVE_AUTO_TRIGGERED  0x0002  // Captured by the auto trigger, not a trigger event
+#define ARCHIVE_GAP             0x0004  // Chunks of this channel were dropped before this one
+
+struct ArchiveChannelInfo {
+    int32_t enabled;
+    int16_t coupling;
+    int16_t range;                  // PICO_CONNECT_PROBE_RANGE
+    int32_t bandwidth;
+    int32_t reserved;
+    double analog_offset;           // Volts
+};
+
+struct ArchiveHeader {
+    char magic[8];                  // ARCHIVE_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t page_bytes;            // ARCHIVE_PAGE_BYTES when written
+    char serial_num[16];
+    int64_t start_secs;             // Start of the archive, POSIX time, entry times are relative to it
+    int32_t start_nsec;
+    int16_t resolution;             // PICO_DEVICE_RESOLUTION
+    int16_t capture_mode;           // enum ArchiveCaptureMode
+    uint32_t timebase;
+    uint32_t down_sample_ratio_mode;
+    uint64_t down_sample_ratio;
+    double sample_interval_secs;
+    double trigger_position_ratio;  // Percent of a block capture before the trigger
+    struct ArchiveChannelInfo channels[ARCHIVE_MAX_CHANNELS];
+    uint64_t index_offset;          // File offset of the last index block, 0 until the first is written
+    uint64_t num_entries;           // Entries in the index blocks written
+    uint64_t payload_bytes;         // Bytes of payload pages
+    uint32_t closed;                // 1 once archive_writer_close wrote the last index block
+    uint32_t reserved;
+};
+
+// One chunk of one channel. Entries are in the order the chunks were captured: time_ns never
+// decreases, and as the chunks of a frame are written together, neither does frame.
+struct ArchiveIndexEntry {
+    uint64_t payload_offset;        // File offset of the samples, a multiple of page_bytes
+    uint64_t sample_offset;         // Samples of this channel archived, or dropped, before this chunk
+    int64_t time_ns;                // Capture time since the archive start
+    uint64_t frame;                 // Block capture, rapid block segment or streaming buffer number
+    uint64_t config_version;        // ConfigSnapshot the chunk was captured with
+    uint32_t samples;
+    uint16_t channel;               // Channel index, 0 for channel A
+    uint16_t flags;
+};
+
+// Start of an index block, the same size as an entry so the entries that follow stay aligned.
+struct ArchiveIndexBlock {
+    char magic[8];                  // ARCHIVE_INDEX_MAGIC, not NUL terminated
+    uint64_t previous_offset;       // File offset of the previous index block, 0 for the first
+    uint64_t first_entry;           // Position of the block's first entry in the archive index
+    uint32_t num_entries;
+    uint32_t reserved[5];
+};
+
+#define ARCHIVE_INDEX_BLOCK_ENTRIES \
+    ((ARCHIVE_INDEX_BLOCK_BYTES - sizeof(struct ArchiveIndexBlock)) / sizeof(struct ArchiveIndexEntry))
+
+enum ArchiveError {
+    ARCHIVE_OK = 0,
+    ARCHIVE_ERROR_IO = -1,          // See errno
+    ARCHIVE_ERROR_FORMAT = -2,      // Not an archive, or an unsupported version
+    ARCHIVE_ERROR_INCOMPLETE = -3,  // The archive was not closed before its first index block
+    ARCHIVE_ERROR_CORRUPT = -4      // The index or a chunk lies outside the file
+};
+
+// Archive being written. Payload and the index are written with O_DIRECT where the file system
+// supports it, so payload passed to archive_write_chunk must be page aligned and padded.
+struct ArchiveWriter {
+    int fd;
+    int direct;                     // Writing with O_DIRECT
+    struct ArchiveHeader* header;   // Page aligned header page, as last written
+    struct ArchiveIndexBlock* block;    // Page aligned index block being filled, ARCHIVE_INDEX_BLOCK_BYTES
+    struct ArchiveIndexEntry* block_entries;
+    int64_t last_time_ns;           // Time of the last entry, later entries are never earlier
+    uint64_t offset;                // File offset of the next payload page
+    uint64_t bytes_written;
+};
+
+// Memory-mapped archive. The index is rebuilt from the index blocks when the archive is opened,
+// lookups search it and never touch the payload.
+struct ArchiveReader {
+    int fd;
+    const uint8_t* map;
+    size_t map_bytes;
+    const struct ArchiveHeader* header;
+    const struct ArchiveIndexEntry* index;
+    uint64_t num_entries;
+};
+
+size_t archive_page_align(size_t bytes);
+
+const char* archive_strerror(int error);
+
+int archive_writer_open(struct ArchiveWriter* writer, const char* path, const struct ArchiveHeader* header);
+
+int archive_write_chunk(struct ArchiveWriter* writer, struct ArchiveIndexEntry* entry, const void* payload, size_t payload_bytes);
+
+int archive_writer_close(struct ArchiveWriter* writer);
+
+int archive_open(struct ArchiveReader* reader, const char* path);
+
+void archive_close(struct ArchiveReader* reader);
+
+uint64_t archive_find_time(const struct ArchiveReader* reader, int64_t time_ns);
+
+uint64_t archive_find_frame(const struct ArchiveReader* reader, int channel, uint64_t frame);
+
+const int16_t* archive_samples(const struct ArchiveReader* reader, const struct ArchiveIndexEntry* entry);
+
+#endif
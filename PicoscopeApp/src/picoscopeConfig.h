@@ -32,6 +32,23 @@
 
 
 #define NUM_CHANNELS 4
+#define FRAME_QUEUE_DEPTH 4     // Frames per channel queued between acquisition and the waveform record 
+#define OFFSET_LIMITS_CACHE_SIZE 36     // Cached analog offset limits, one per (range, coupling) pair 
+#define TIMEBASE_TABLE_MAX_ENTRIES 32   // Timebases listed per table before the interval grows linearly 
+#define TIMEBASE_LUT_MAX_TABLES 48      // One table per (enabled channel mask, resolution) pair 
+#define TIMEBASE_LUT_VERSION_LENGTH 160 // Driver and firmware versions the timebase tables were built with 
+#define RESTART_WINDOW_SECS 0.2         // Default quiet time before coalesced writes restart acquisition 
+#define RESTART_MAX_DELAY_WINDOWS 10    // A continuous stream of writes still restarts after this many windows 
+#define ASYNC_WRITE_QUEUE_DEPTH 64      // Output record writes waiting for the writer thread, per module 
+#define ASYNC_WRITE_MAX_PROCESS 8       // Readback and limit records a write processes once it completes 
+#define LOG_TEXT_LENGTH 500             // Latest log message kept for the log record, its NELM 
+#define RECORDER_QUEUE_DEPTH 32         // Captured chunks waiting for the disk recorder, per module 
+#define POST_MORTEM_MAX_BYTES (256UL << 20)     // Sample memory of the post-mortem ring, per module 
+#define DATA_SERVER_QUEUE_DEPTH 64              // Frames waiting to be sent by the data server, per module 
+#define DATA_SERVER_SUBSCRIBER_DEPTH 16         // Frames queued for one data socket client before it drops 
+#define DATA_SERVER_MAX_SUBSCRIBERS 16          // Data socket clients per module 
+#define SHM_RING_DEFAULT_SLOTS 32               // Frames in a shared memory ring when PS6000AShmRing is not given a count 
+#define SHM_RING_DEFAULT_SAMPLES 1000000        // Samples per shared memory ring slot when not given 
 
 // The following struct is intended to track which channels 
 // are enabled (1) or disabled (0) using individual bits. 
@@ -132,6 +149,10 @@ struct SampleConfigs{
     uint64_t subwaveform_samples_num;
     uint64_t original_subwaveform_samples_num;
     float trigger_position_ratio;
+    uint64_t num_segments;          // Rapid block captures per arm, 1 for a single block capture 
+    int8_t double_buffer;           // Rearm the next block capture before publishing the previous one 
+    int8_t record_to_disk;          // Append every capture to a capture archive, stream without end 
+    uint64_t post_mortem_frames;    // Captures of each channel kept in the post-mortem ring, 0 disables it 
     uint64_t down_sample_ratio;
     enum RatioMode down_sample_ratio_mode; 
     
@@ -165,6 +186,15 @@ struct TriggerTimingInfo {
     uint64_t prev_trigger_time; 
     uint64_t missed_triggers; 
     double trigger_freq_secs;    
+    uint64_t auto_triggered_frames; // Block frames and segments captured by the auto trigger, not a trigger event 
+    int auto_triggered;             // Trigger info of the latest block frame found no trigger event 
+    uint64_t capture_timeouts;      // Block captures abandoned after the capture timeout 
+};
+
+struct StreamPollStats { 
+    double poll_interval_secs;      // Wait between ps6000aGetStreamingLatestValues calls 
+    uint64_t polls;                 // Polls made during the current streaming capture 
+    uint64_t useful_polls;          // Polls that returned new samples 
 };
 
 #endif
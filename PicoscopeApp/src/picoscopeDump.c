@@ -0,0 +1,168 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeDump.c
+ * Description:
+ *     Command line reader of Picoscope PS6000A capture archives. Prints
+ *     the archive header, and the index entries and samples from a
+ *     time or frame, found by binary search of the index.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "picoscopeArchive.h"
+
+static const char* CAPTURE_MODE_NAMES[] = {"block", "rapid block", "streaming"};
+
+static void usage(const char* program){
+    fprintf(stderr,
+        "Usage: %s [options] archive\n"
+        "  Prints the archive header, and the index entries selected by any of the options.\n"
+        "  -t seconds  Start at the first chunk captured at or after this time since the start\n"
+        "  -f frame    Start at this frame number\n"
+        "  -c channel  Only list this channel, A-D\n"
+        "  -n count    Number of entries to list, all if not given\n"
+        "  -s          Print the samples of each entry listed, one per line\n",
+        program);
+}
+
+static void print_header(const struct ArchiveReader* reader){
+    const struct ArchiveHeader* header = reader->header;
+    const char* mode = (header->capture_mode >= 0 && header->capture_mode <= ARCHIVE_STREAMING) ?
+        CAPTURE_MODE_NAMES[header->capture_mode] : "unknown";
+
+    printf("Serial number:      %.*s\n", (int)sizeof(header->serial_num), header->serial_num);
+    printf("Start:              %" PRId64 ".%09" PRId32 "\n", header->start_secs, header->start_nsec);
+    printf("Capture mode:       %s\n", mode);
+    printf("Resolution:         %d\n", header->resolution);
+    printf("Timebase:           %" PRIu32 "\n", header->timebase);
+    printf("Sample interval:    %.12g s\n", header->sample_interval_secs);
+    printf("Down sampling:      ratio %" PRIu64 ", mode %" PRIu32 "\n", header->down_sample_ratio, header->down_sample_ratio_mode);
+    printf("Trigger position:   %g %%\n", header->trigger_position_ratio);
+    for (int i = 0; i < ARCHIVE_MAX_CHANNELS; i++) {
+        const struct ArchiveChannelInfo* channel = &header->channels[i];
+        if (channel->enabled) {
+            printf("Channel %c:          coupling %d, range %d, bandwidth %d, offset %g V\n",
+                   'A' + i, channel->coupling, channel->range, channel->bandwidth, channel->analog_offset);
+        }
+    }
+    printf("Chunks:             %" PRIu64 "%s\n", header->num_entries,
+           header->closed ? "" : ", not closed, chunks after the last index block are not indexed");
+    printf("Payload:            %" PRIu64 " bytes\n", header->payload_bytes);
+}
+
+static void print_entry(const struct ArchiveReader* reader, uint64_t entry_index, int samples){
+    const struct ArchiveIndexEntry* entry = &reader->index[entry_index];
+
+    printf("%8" PRIu64 "  ch %c  frame %8" PRIu64 "  sample %12" PRIu64 "  time %.9f s  samples %8" PRIu32 "  config %" PRIu64 "%s%s%s\n",
+           entry_index, 'A' + entry->channel, entry->frame, entry->sample_offset, entry->time_ns * 1e-9,
+           entry->samples, entry->config_version,
+           entry->flags & ARCHIVE_TRIGGERED ? "  triggered" : "",
+           entry->flags & ARCHIVE_AUTO_TRIGGERED ? "  auto triggered" : "",
+           entry->flags & ARCHIVE_GAP ? "  gap" : "");
+    if (!samples) {
+        return;
+    }
+    const int16_t* data = archive_samples(reader, entry);
+    if (!data) {
+        printf("  chunk lies outside the file\n");
+        return;
+    }
+    for (uint32_t i = 0; i < entry->samples; i++) {
+        printf("%d\n", data[i]);
+    }
+}
+
+int main(int argc, char** argv){
+    struct ArchiveReader reader;
+    int option;
+    int channel = -1;
+    int samples = 0;
+    int seek_time = 0;
+    int seek_frame = 0;
+    int list = 0;
+    double time_secs = 0;
+    uint64_t frame = 0;
+    uint64_t count = UINT64_MAX;
+
+    while ((option = getopt(argc, argv, "t:f:c:n:sh")) != -1) {
+        list = 1;
+        switch (option) {
+            case 't':
+                seek_time = 1;
+                time_secs = strtod(optarg, NULL);
+                break;
+            case 'f':
+                seek_frame = 1;
+                frame = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                if (optarg[0] >= 'A' && optarg[0] < 'A' + ARCHIVE_MAX_CHANNELS) {
+                    channel = optarg[0] - 'A';
+                } else if (optarg[0] >= 'a' && optarg[0] < 'a' + ARCHIVE_MAX_CHANNELS) {
+                    channel = optarg[0] - 'a';
+                } else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'n':
+                count = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                samples = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1 || (seek_time && seek_frame)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int status = archive_open(&reader, argv[optind]);
+    if (status != ARCHIVE_OK) {
+        fprintf(stderr, "%s: %s\n", argv[optind], archive_strerror(status));
+        return 1;
+    }
+    print_header(&reader);
+
+    uint64_t entry_index = 0;
+    if (seek_time) {
+        entry_index = archive_find_time(&reader, (int64_t)(time_secs * 1e9));
+    } else if (seek_frame) {
+        entry_index = archive_find_frame(&reader, channel, frame);
+    }
+    for (uint64_t listed = 0; list && entry_index < reader.num_entries && listed < count; entry_index++) {
+        if (channel >= 0 && reader.index[entry_index].channel != channel) {
+            continue;
+        }
+        print_entry(&reader, entry_index, samples);
+        listed++;
+    }
+
+    archive_close(&reader);
+    return 0;
+}
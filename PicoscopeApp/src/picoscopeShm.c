@@ -0,0 +1,325 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeShm.c
+ * Description:
+ *     Writer and reader of the Picoscope PS6000A shared memory frame
+ *     ring. Frames are published with a sequence lock per slot, readers
+ *     block on a futex in the ring header rather than polling.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "picoscopeShm.h"
+
+static size_t page_align(size_t bytes){
+    return (bytes + SHM_RING_PAGE_BYTES - 1) / SHM_RING_PAGE_BYTES * SHM_RING_PAGE_BYTES;
+}
+
+static uint8_t* slot_address(const uint8_t* map, const struct ShmRingHeader* header, uint64_t sequence){
+    return (uint8_t*)map + SHM_RING_PAGE_BYTES + (sequence - 1) % header->num_slots * header->slot_bytes;
+}
+
+/**
+ * The clock ready_ns and publish_ns are taken from. Monotonic and shared by every process on
+ * the host, so a reader can subtract them from its own reading.
+ *
+ * @return CLOCK_MONOTONIC in nanoseconds.
+ */
+uint64_t shm_ring_now_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+const char* shm_ring_strerror(int error){
+    switch (error) {
+        case SHM_RING_OK:              return "No error";
+        case SHM_RING_ERROR_IO:        return strerror(errno);
+        case SHM_RING_ERROR_FORMAT:    return "Not a frame ring, or an unsupported version";
+        case SHM_RING_ERROR_TOO_LARGE: return "Frame is larger than a slot";
+        case SHM_RING_ERROR_TIMEOUT:   return "No new frame";
+        default:                       return "Unknown error";
+    }
+}
+
+/****************************************************************************************
+ * Writer
+ ****************************************************************************************/
+
+/**
+ * Creates the shared memory object and maps it, with every page faulted in so the first frames
+ * are not slowed down. A ring left under the same name is unlinked first, readers still mapping
+ * it keep their copy and should reopen once it stops advancing.
+ *
+ * @param writer       ShmRingWriter Pointer to initialize.
+ * @param name         shm_open name, "/name".
+ * @param serial_num   Serial number of the scope, copied to the header.
+ * @param num_slots    Frames the ring holds.
+ * @param slot_samples Samples each slot holds.
+ *
+ * @return SHM_RING_OK on success, or a ShmRingError.
+ */
+int shm_ring_create(struct ShmRingWriter* writer, const char* name, const char* serial_num, uint32_t num_slots,
+                    uint64_t slot_samples){
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    if (num_slots < 2 || slot_samples == 0 || slot_samples > UINT32_MAX) {
+        errno = EINVAL;
+        return SHM_RING_ERROR_IO;
+    }
+    snprintf(writer->name, sizeof(writer->name), "%s", name);
+
+    size_t slot_bytes = page_align(sizeof(struct ShmSlotHeader) + slot_samples * sizeof(int16_t));
+    writer->map_bytes = SHM_RING_PAGE_BYTES + num_slots * slot_bytes;
+
+    shm_unlink(writer->name);
+    writer->fd = shm_open(writer->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (writer->fd < 0) {
+        return SHM_RING_ERROR_IO;
+    }
+    if (ftruncate(writer->fd, writer->map_bytes) != 0) {
+        shm_ring_destroy(writer);
+        return SHM_RING_ERROR_IO;
+    }
+    void* map = mmap(NULL, writer->map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->fd, 0);
+    if (map == MAP_FAILED) {
+        writer->map = NULL;
+        shm_ring_destroy(writer);
+        return SHM_RING_ERROR_IO;
+    }
+    writer->map = map;
+    writer->header = (struct ShmRingHeader*)writer->map;
+
+    // ftruncate zeroed the object, every slot reads as empty
+    struct ShmRingHeader* header = writer->header;
+    header->version = SHM_RING_VERSION;
+    header->header_bytes = sizeof(*header);
+    header->num_slots = num_slots;
+    header->slot_header_bytes = sizeof(struct ShmSlotHeader);
+    header->slot_bytes = slot_bytes;
+    header->slot_samples = slot_samples;
+    snprintf(header->serial_num, sizeof(header->serial_num), "%s", serial_num);
+    header->writer_pid = getpid();
+    __atomic_store_n(&header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    return SHM_RING_OK;
+}
+
+/**
+ * Copies a frame into the next slot and wakes waiting readers. The slot is marked as being
+ * written first, so a reader still using the frame it held finds out.
+ *
+ * @param writer  ShmRingWriter Pointer of a created ring.
+ * @param frame   ShmSlotHeader Pointer with the frame's settings, samples and ready_ns set. seq,
+ *                frame and publish_ns are filled in.
+ * @param samples int16_t Pointer to frame->samples samples.
+ *
+ * @return SHM_RING_OK, or SHM_RING_ERROR_TOO_LARGE if the frame was dropped.
+ */
+int shm_ring_write(struct ShmRingWriter* writer, struct ShmSlotHeader* frame, const int16_t* samples){
+    struct ShmRingHeader* header = writer->header;
+
+    if (frame->samples > header->slot_samples) {
+        __atomic_add_fetch(&header->dropped, 1, __ATOMIC_RELAXED);
+        return SHM_RING_ERROR_TOO_LARGE;
+    }
+    uint64_t sequence = writer->sequence + 1;
+    struct ShmSlotHeader* slot = (struct ShmSlotHeader*)slot_address(writer->map, header, sequence);
+    if (frame->channel < SHM_RING_MAX_CHANNELS) {
+        frame->frame = writer->channel_frames[frame->channel]++;
+    }
+
+    __atomic_store_n(&slot->seq, 2 * sequence - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((uint8_t*)slot + sizeof(slot->seq), (const uint8_t*)frame + sizeof(frame->seq),
+           sizeof(*frame) - sizeof(frame->seq));
+    memcpy((uint8_t*)slot + sizeof(*slot), samples, frame->samples * sizeof(int16_t));
+    slot->publish_ns = shm_ring_now_ns();
+    __atomic_store_n(&slot->seq, 2 * sequence, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&header->head, sequence, __ATOMIC_RELEASE);
+    writer->sequence = sequence;
+    __atomic_add_fetch(&header->futex, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return SHM_RING_OK;
+}
+
+uint64_t shm_ring_published(const struct ShmRingWriter* writer){
+    return __atomic_load_n(&writer->header->head, __ATOMIC_RELAXED);
+}
+
+uint64_t shm_ring_dropped(const struct ShmRingWriter* writer){
+    return __atomic_load_n(&writer->header->dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * Unmaps and unlinks the ring. Readers keep their mapping until they close it.
+ *
+ * @param writer ShmRingWriter Pointer of a created ring.
+ */
+void shm_ring_destroy(struct ShmRingWriter* writer){
+    if (writer->map) {
+        munmap(writer->map, writer->map_bytes);
+    }
+    if (writer->fd >= 0) {
+        close(writer->fd);
+        shm_unlink(writer->name);
+    }
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+}
+
+/****************************************************************************************
+ * Reader
+ ****************************************************************************************/
+
+/**
+ * Maps a ring read only. The reader starts at the next frame written, frames already in the
+ * ring are skipped.
+ *
+ * @param reader ShmRingReader Pointer to initialize.
+ * @param name   shm_open name the IOC created the ring with.
+ *
+ * @return SHM_RING_OK on success, or a ShmRingError.
+ */
+int shm_ring_open(struct ShmRingReader* reader, const char* name){
+    struct stat info;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = shm_open(name, O_RDONLY, 0);
+    if (reader->fd < 0) {
+        return SHM_RING_ERROR_IO;
+    }
+    if (fstat(reader->fd, &info) != 0) {
+        shm_ring_close(reader);
+        return SHM_RING_ERROR_IO;
+    }
+    if ((size_t)info.st_size < SHM_RING_PAGE_BYTES) {
+        shm_ring_close(reader);
+        return SHM_RING_ERROR_FORMAT;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (map == MAP_FAILED) {
+        shm_ring_close(reader);
+        return SHM_RING_ERROR_IO;
+    }
+    reader->map = map;
+    reader->map_bytes = info.st_size;
+    reader->header = (const struct ShmRingHeader*)reader->map;
+
+    const struct ShmRingHeader* header = reader->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || header->version != SHM_RING_VERSION ||
+        header->header_bytes != sizeof(*header) || header->slot_header_bytes != sizeof(struct ShmSlotHeader) ||
+        header->num_slots == 0 || header->slot_bytes < sizeof(struct ShmSlotHeader) + header->slot_samples * sizeof(int16_t) ||
+        header->num_slots > (reader->map_bytes - SHM_RING_PAGE_BYTES) / header->slot_bytes) {
+        shm_ring_close(reader);
+        return SHM_RING_ERROR_FORMAT;
+    }
+    reader->next = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) + 1;
+    return SHM_RING_OK;
+}
+
+/**
+ * Waits for the next frame and returns it in place, without copying. Frames the writer has
+ * already overwritten are skipped and counted in lost. The frame may be overwritten while in
+ * use, check shm_ring_still_valid once done with it.
+ *
+ * @param reader       ShmRingReader Pointer of an open ring.
+ * @param timeout_secs Longest time to wait for a frame.
+ * @param frame        Set to the frame's slot, the samples follow it, see shm_ring_samples.
+ * @param sequence     Set to the frame's sequence number.
+ *
+ * @return SHM_RING_OK, or SHM_RING_ERROR_TIMEOUT if no frame was written in time.
+ */
+int shm_ring_next(struct ShmRingReader* reader, double timeout_secs, const struct ShmSlotHeader** frame,
+                  uint64_t* sequence){
+    const struct ShmRingHeader* header = reader->header;
+    uint64_t deadline = shm_ring_now_ns() + (uint64_t)(timeout_secs * 1e9);
+
+    while (1) {
+        uint32_t futex = __atomic_load_n(&header->futex, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (head < reader->next) {
+            uint64_t now = shm_ring_now_ns();
+            if (now >= deadline) {
+                return SHM_RING_ERROR_TIMEOUT;
+            }
+            struct timespec timeout = {(deadline - now) / 1000000000ull, (deadline - now) % 1000000000ull};
+            // Returns at once if a frame was written since futex was read
+            syscall(SYS_futex, &header->futex, FUTEX_WAIT, futex, &timeout, NULL, 0);
+            continue;
+        }
+
+        // The oldest frame in the ring is the next one to be overwritten, start after it
+        if (head - reader->next + 1 >= header->num_slots) {
+            uint64_t oldest = head - header->num_slots + 2;
+            reader->lost += oldest - reader->next;
+            reader->next = oldest;
+        }
+        const struct ShmSlotHeader* slot = (const struct ShmSlotHeader*)slot_address(reader->map, header, reader->next);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * reader->next) {
+            reader->lost++;
+            reader->next++;
+            continue;
+        }
+        *frame = slot;
+        *sequence = reader->next++;
+        return SHM_RING_OK;
+    }
+}
+
+/**
+ * Checks that a frame returned by shm_ring_next was not overwritten while it was being used.
+ * If it was, whatever was read from it must be discarded.
+ *
+ * @param frame    ShmSlotHeader Pointer returned by shm_ring_next.
+ * @param sequence Sequence number returned with it.
+ *
+ * @return Non-zero if the frame is intact.
+ */
+int shm_ring_still_valid(const struct ShmSlotHeader* frame, uint64_t sequence){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&frame->seq, __ATOMIC_RELAXED) == 2 * sequence;
+}
+
+const int16_t* shm_ring_samples(const struct ShmSlotHeader* frame){
+    return (const int16_t*)(frame + 1);
+}
+
+void shm_ring_close(struct ShmRingReader* reader){
+    if (reader->map) {
+        munmap((void*)reader->map, reader->map_bytes);
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+}
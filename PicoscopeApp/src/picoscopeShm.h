@@ -0,0 +1,144 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeShm.h
+ * Description:
+ *     POSIX shared memory frame ring of the Picoscope PS6000A driver.
+ *     The IOC writes each capture into a slot of a shm_open ring, readers
+ *     on the same host map it and use the samples in place. Single
+ *     writer, any number of readers, no locks. Has no EPICS dependencies,
+ *     so readers can link it directly.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PICOSCOPE_SHM
+#define PICOSCOPE_SHM
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC 0x4D365350u      // "PS6M" on a little endian host
+#define SHM_RING_VERSION 1
+#define SHM_RING_PAGE_BYTES 4096        // The header and every slot start on a page
+#define SHM_RING_MAX_CHANNELS 8
+
+// Layout of the shared memory object:
+//   page 0      ShmRingHeader, zero padded to SHM_RING_PAGE_BYTES
+//   slots       num_slots slots of slot_bytes, each a ShmSlotHeader followed by slot_samples int16
+// Frame sequence numbers start at 1. Frame s is written to slot (s - 1) % num_slots, so a reader
+// has num_slots frames of time before a frame is overwritten.
+//
+// Each slot is a sequence lock: the writer sets seq odd, writes the frame, then sets seq to 2 * s.
+// A reader checks seq is 2 * s before using the frame and again afterwards, a changed seq means
+// the writer lapped the reader and the frame was overwritten while in use.
+
+// ShmSlotHeader flags, the same values as the capture archive flags
+#define SHM_RING_TRIGGERED      0x0001  // A trigger event captured the frame, or falls within it when streaming
+#define SHM_RING_AUTO_TRIGGERED 0x0002  // Captured by the auto trigger, not a trigger event
+
+struct ShmRingHeader {
+    uint32_t magic;                 // SHM_RING_MAGIC, set last once the ring is initialized
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(struct ShmRingHeader)
+    uint32_t num_slots;
+    uint32_t slot_header_bytes;     // sizeof(struct ShmSlotHeader), the samples follow
+    uint64_t slot_bytes;            // Distance between slots, a multiple of SHM_RING_PAGE_BYTES
+    uint64_t slot_samples;          // Samples a slot holds, larger frames are not published
+    char serial_num[32];
+    int64_t writer_pid;
+    uint64_t head;                  // Writer: sequence of the newest complete frame, 0 when empty
+    uint32_t futex;                 // Writer: changes with every frame, readers wait on it
+    uint32_t reserved;
+    uint64_t dropped;               // Writer: frames larger than a slot
+};
+
+struct ShmSlotHeader {
+    uint64_t seq;                   // 2 * sequence when complete, odd while being written
+    uint64_t frame;                 // Block capture, rapid block segment or streaming buffer number of the channel
+    int64_t time_secs;              // Capture time, POSIX time
+    int32_t time_nsec;
+    uint16_t channel;               // Channel index, 0 for channel A
+    uint16_t flags;
+    uint64_t ready_ns;              // CLOCK_MONOTONIC when the samples were read from the scope
+    uint64_t publish_ns;            // CLOCK_MONOTONIC when the frame was complete in the ring
+    uint64_t config_version;        // ConfigSnapshot the frame was captured with
+    double sample_interval_secs;
+    double analog_offset;           // Volts
+    int16_t range;                  // PICO_CONNECT_PROBE_RANGE
+    int16_t resolution;             // PICO_DEVICE_RESOLUTION
+    uint32_t samples;
+    uint64_t reserved[6];           // Pads the header to 128 bytes, keeping the samples aligned
+};
+
+enum ShmRingError {
+    SHM_RING_OK = 0,
+    SHM_RING_ERROR_IO = -1,         // See errno
+    SHM_RING_ERROR_FORMAT = -2,     // Not a frame ring, an unsupported version, or not initialized yet
+    SHM_RING_ERROR_TOO_LARGE = -3,  // The frame does not fit a slot
+    SHM_RING_ERROR_TIMEOUT = -4     // No new frame within the timeout
+};
+
+// Ring being written, by one thread only.
+struct ShmRingWriter {
+    int fd;
+    char name[256];                 // shm_open name
+    uint8_t* map;
+    size_t map_bytes;
+    struct ShmRingHeader* header;
+    uint64_t sequence;              // Sequence of the last frame written
+    uint64_t channel_frames[SHM_RING_MAX_CHANNELS];
+};
+
+// Mapped ring, read only. next is the sequence the reader takes next, lost counts frames the
+// writer overwrote before the reader got to them.
+struct ShmRingReader {
+    int fd;
+    const uint8_t* map;
+    size_t map_bytes;
+    const struct ShmRingHeader* header;
+    uint64_t next;
+    uint64_t lost;
+};
+
+uint64_t shm_ring_now_ns(void);
+
+const char* shm_ring_strerror(int error);
+
+int shm_ring_create(struct ShmRingWriter* writer, const char* name, const char* serial_num, uint32_t num_slots,
+                    uint64_t slot_samples);
+
+int shm_ring_write(struct ShmRingWriter* writer, struct ShmSlotHeader* frame, const int16_t* samples);
+
+uint64_t shm_ring_published(const struct ShmRingWriter* writer);
+
+uint64_t shm_ring_dropped(const struct ShmRingWriter* writer);
+
+void shm_ring_destroy(struct ShmRingWriter* writer);
+
+int shm_ring_open(struct ShmRingReader* reader, const char* name);
+
+int shm_ring_next(struct ShmRingReader* reader, double timeout_secs, const struct ShmSlotHeader** frame,
+                  uint64_t* sequence);
+
+int shm_ring_still_valid(const struct ShmSlotHeader* frame, uint64_t sequence);
+
+const int16_t* shm_ring_samples(const struct ShmSlotHeader* frame);
+
+void shm_ring_close(struct ShmRingReader* reader);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeShmReader.c
+ * Description:
+ *     Reference reader of the Picoscope PS6000A shared memory frame ring.
+ *     Consumes frames in place, as an analysis process would, and
+ *     measures the latency from the samples being read from the scope to
+ *     the reader seeing the frame.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "picoscopeShm.h"
+
+#define MAX_LATENCIES (1 << 20)         // Latencies kept for the percentiles, the first of a long run
+
+static void usage(const char* program){
+    fprintf(stderr,
+        "Usage: %s [options] name\n"
+        "  Reads frames from the IOC's shared memory ring, e.g. /ps6000a-XXXX, and prints the\n"
+        "  frame rate, the frames lost and the latency from the samples being read from the scope\n"
+        "  (ready) and from the frame being written to the ring (publish) to this reader seeing it.\n"
+        "  -c channels  Channels to read, e.g. AC, all if not given\n"
+        "  -t seconds   Stop after this time, run until interrupted if not given\n"
+        "  -q           Only print the summary\n",
+        program);
+}
+
+static int compare_latency(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t* sorted, size_t count, double percent){
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(percent / 100.0 * (count - 1) + 0.5);
+    return sorted[index] / 1e3;
+}
+
+int main(int argc, char** argv){
+    struct ShmRingReader reader;
+    int option;
+    int quiet = 0;
+    uint32_t channel_mask = 0;
+    double run_secs = 0;
+    uint64_t frames = 0, torn = 0, bytes = 0;
+    uint64_t interval_frames = 0, interval_max_ns = 0, interval_lost = 0;
+    size_t num_latencies = 0;
+    uint64_t publish_sum_ns = 0;
+
+    while ((option = getopt(argc, argv, "c:t:qh")) != -1) {
+        switch (option) {
+            case 'c':
+                for (const char* c = optarg; *c; c++) {
+                    if (*c >= 'A' && *c < 'A' + SHM_RING_MAX_CHANNELS) {
+                        channel_mask |= 1u << (*c - 'A');
+                    } else if (*c >= 'a' && *c < 'a' + SHM_RING_MAX_CHANNELS) {
+                        channel_mask |= 1u << (*c - 'a');
+                    } else {
+                        usage(argv[0]);
+                        return 2;
+                    }
+                }
+                break;
+            case 't':
+                run_secs = strtod(optarg, NULL);
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int status = shm_ring_open(&reader, argv[optind]);
+    if (status != SHM_RING_OK) {
+        fprintf(stderr, "%s: %s\n", argv[optind], shm_ring_strerror(status));
+        return 1;
+    }
+    const struct ShmRingHeader* header = reader.header;
+    printf("%s: %.*s, %" PRIu32 " slots of %" PRIu64 " samples, written by pid %" PRId64 "\n", argv[optind],
+           (int)sizeof(header->serial_num), header->serial_num, header->num_slots, header->slot_samples,
+           header->writer_pid);
+
+    uint64_t* latencies = malloc(MAX_LATENCIES * sizeof(uint64_t));
+    if (!latencies) {
+        fprintf(stderr, "Cannot allocate the latency buffer\n");
+        shm_ring_close(&reader);
+        return 1;
+    }
+    uint64_t start = shm_ring_now_ns();
+    uint64_t interval_start = start;
+    uint64_t lost_before = 0;
+    while (run_secs <= 0 || shm_ring_now_ns() - start < run_secs * 1e9) {
+        const struct ShmSlotHeader* frame;
+        uint64_t sequence;
+        if (shm_ring_next(&reader, 0.1, &frame, &sequence) == SHM_RING_OK &&
+            (!channel_mask || (frame->channel < 32 && (channel_mask & (1u << frame->channel))))) {
+            uint64_t seen = shm_ring_now_ns();
+
+            // Use the samples in place, as an analysis would, then check they were not overwritten
+            const int16_t* samples = shm_ring_samples(frame);
+            uint64_t ready_ns = frame->ready_ns;
+            uint64_t publish_ns = frame->publish_ns;
+            uint32_t num_samples = frame->samples;
+            int16_t low = INT16_MAX, high = INT16_MIN;
+            for (uint32_t i = 0; i < num_samples; i++) {
+                low = samples[i] < low ? samples[i] : low;
+                high = samples[i] > high ? samples[i] : high;
+            }
+            if (!shm_ring_still_valid(frame, sequence)) {
+                torn++;
+            } else {
+                uint64_t latency = seen > ready_ns ? seen - ready_ns : 0;
+                if (num_latencies < MAX_LATENCIES) {
+                    latencies[num_latencies++] = latency;
+                }
+                publish_sum_ns += seen > publish_ns ? seen - publish_ns : 0;
+                interval_max_ns = latency > interval_max_ns ? latency : interval_max_ns;
+                interval_frames++;
+                bytes += num_samples * sizeof(int16_t);
+            }
+        }
+
+        uint64_t now = shm_ring_now_ns();
+        if (now - interval_start >= 1000000000ull) {
+            interval_lost = reader.lost - lost_before;
+            if (!quiet) {
+                printf("%.1f s: %.1f frames/s, %" PRIu64 " frames lost, ready latency max %.1f us\n",
+                       (now - start) / 1e9, interval_frames / ((now - interval_start) / 1e9), interval_lost,
+                       interval_max_ns / 1e3);
+                fflush(stdout);
+            }
+            frames += interval_frames;
+            lost_before = reader.lost;
+            interval_frames = interval_max_ns = 0;
+            interval_start = now;
+        }
+    }
+    frames += interval_frames;
+
+    double elapsed = (shm_ring_now_ns() - start) / 1e9;
+    qsort(latencies, num_latencies, sizeof(uint64_t), compare_latency);
+    printf("%" PRIu64 " frames, %.1f MB in %.2f s, %.1f frames/s, %" PRIu64 " frames lost, %" PRIu64 " overwritten while read\n",
+           frames, bytes / 1e6, elapsed, frames / elapsed, reader.lost, torn);
+    printf("Ready to seen latency: min %.1f us, median %.1f us, 99%% %.1f us, 99.9%% %.1f us, max %.1f us\n",
+           percentile_us(latencies, num_latencies, 0), percentile_us(latencies, num_latencies, 50),
+           percentile_us(latencies, num_latencies, 99), percentile_us(latencies, num_latencies, 99.9),
+           percentile_us(latencies, num_latencies, 100));
+    printf("Publish to seen latency: mean %.1f us\n", frames ? publish_sum_ns / 1e3 / frames : 0);
+
+    free(latencies);
+    shm_ring_close(&reader);
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeStream.h
+ * Description:
+ *     Wire format of the Picoscope PS6000A data socket, which publishes
+ *     raw captures to local clients without Channel Access. Has no EPICS
+ *     or Pico SDK dependencies, so clients can include it directly.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PICOSCOPE_STREAM
+#define PICOSCOPE_STREAM
+
+#include <stdint.h>
+
+#define STREAM_VERSION 1
+#define STREAM_REQUEST_MAGIC 0x52365350u    // "PS6R" on a little endian host
+#define STREAM_FRAME_MAGIC 0x46365350u      // "PS6F" on a little endian host
+
+// Protocol, little endian as sent by the IOC host:
+//   1. The client connects, to a Unix domain socket path or a TCP port, and sends one StreamRequest.
+//   2. The server sends frames, each a StreamFrameHeader followed by samples int16 samples, until
+//      either side closes the connection. A request the server does not accept closes it at once.
+// A subscriber that does not keep up loses frames according to its drop policy. Lost frames show
+// as gaps in a channel's frame numbers.
+
+enum StreamDropPolicy {
+    STREAM_DROP_OLDEST = 0,         // Discard the oldest queued frame, the client sees the latest data
+    STREAM_DROP_NEWEST = 1,         // Discard the new frame, the client sees runs of contiguous frames
+    STREAM_DISCONNECT = 2           // Close the connection, the client never silently misses a frame
+};
+
+// StreamFrameHeader flags, the same values as the capture archive flags
+#define STREAM_TRIGGERED        0x0001  // A trigger event captured the frame, or falls within it when streaming
+#define STREAM_AUTO_TRIGGERED   0x0002  // Captured by the auto trigger, not a trigger event
+
+struct StreamRequest {
+    uint32_t magic;                 // STREAM_REQUEST_MAGIC
+    uint16_t version;               // STREAM_VERSION
+    uint16_t policy;                // enum StreamDropPolicy
+    uint32_t channel_mask;          // Bit 0 for channel A, 0 for every channel
+    uint32_t reserved;
+};
+
+struct StreamFrameHeader {
+    uint32_t magic;                 // STREAM_FRAME_MAGIC
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(struct StreamFrameHeader), the samples follow
+    uint64_t sequence;              // Frames published by the server, across channels and subscribers
+    uint64_t frame;                 // Block capture, rapid block segment or streaming buffer number of the channel
+    int64_t time_secs;              // Capture time, POSIX time
+    int32_t time_nsec;
+    uint16_t channel;               // Channel index, 0 for channel A
+    uint16_t flags;
+    uint64_t config_version;        // ConfigSnapshot the frame was captured with
+    double sample_interval_secs;
+    double analog_offset;           // Volts
+    int16_t range;                  // PICO_CONNECT_PROBE_RANGE
+    int16_t resolution;             // PICO_DEVICE_RESOLUTION
+    uint32_t samples;
+};
+
+#endif
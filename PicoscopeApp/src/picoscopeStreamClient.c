@@ -0,0 +1,251 @@
+/*
+ * ---------------------------------------------------------------------
+ * File:
+ *     picoscopeStreamClient.c
+ * Description:
+ *     Reference client of the Picoscope PS6000A data socket. Subscribes
+ *     with a drop policy and channel selection, checks the frames it
+ *     receives and prints the throughput and the frames lost.
+ * ---------------------------------------------------------------------
+ * Copyright (c) 2025 Canadian Light Source Inc.
+ *
+ * This file is part of DRIVER_Picoscope6000ESeries.
+ *
+ * DRIVER_Picoscope6000ESeries is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DRIVER_Picoscope6000ESeries is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "picoscopeStream.h"
+
+#define CLIENT_MAX_CHANNELS 8
+
+static void usage(const char* program){
+    fprintf(stderr,
+        "Usage: %s [options] endpoint\n"
+        "  Subscribes to an IOC data socket, a Unix domain socket path, a TCP port on the\n"
+        "  loopback interface or address:port, and prints the rate frames are received at.\n"
+        "  -p policy    Drop policy when this client falls behind: oldest (default), newest\n"
+        "               or disconnect\n"
+        "  -c channels  Channels to receive, e.g. AC, all if not given\n"
+        "  -t seconds   Stop after this time, run until the server closes if not given\n"
+        "  -q           Only print the summary\n",
+        program);
+}
+
+static double now_secs(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static int connect_endpoint(const char* endpoint){
+    int fd;
+
+    if (endpoint[0] == '/') {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", endpoint);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct sockaddr_in address;
+    char host[64] = "127.0.0.1";
+    const char* port = strrchr(endpoint, ':');
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    if (port) {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - endpoint), endpoint);
+        port++;
+    } else {
+        port = endpoint;
+    }
+    address.sin_port = htons((uint16_t)atoi(port));
+    if (inet_pton(AF_INET, host, &address.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads exactly bytes, returns 0 on success, 1 if the server closed the connection first
+static int read_all(int fd, void* buffer, size_t bytes){
+    for (size_t done = 0; done < bytes; ) {
+        ssize_t received = read(fd, (char*)buffer + done, bytes - done);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return 1;
+        }
+        done += received;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv){
+    struct StreamRequest request;
+    struct StreamFrameHeader header;
+    int option;
+    int quiet = 0;
+    double run_secs = 0;
+    int16_t* samples = NULL;
+    size_t capacity = 0;
+    uint64_t next_frame[CLIENT_MAX_CHANNELS] = {0};
+    int seen[CLIENT_MAX_CHANNELS] = {0};
+    uint64_t frames = 0, bytes = 0, lost = 0;
+    uint64_t interval_frames = 0, interval_bytes = 0, interval_lost = 0;
+
+    memset(&request, 0, sizeof(request));
+    request.magic = STREAM_REQUEST_MAGIC;
+    request.version = STREAM_VERSION;
+    request.policy = STREAM_DROP_OLDEST;
+
+    while ((option = getopt(argc, argv, "p:c:t:qh")) != -1) {
+        switch (option) {
+            case 'p':
+                if (strcmp(optarg, "oldest") == 0) {
+                    request.policy = STREAM_DROP_OLDEST;
+                } else if (strcmp(optarg, "newest") == 0) {
+                    request.policy = STREAM_DROP_NEWEST;
+                } else if (strcmp(optarg, "disconnect") == 0) {
+                    request.policy = STREAM_DISCONNECT;
+                } else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'c':
+                for (const char* c = optarg; *c; c++) {
+                    if (*c >= 'A' && *c < 'A' + CLIENT_MAX_CHANNELS) {
+                        request.channel_mask |= 1u << (*c - 'A');
+                    } else if (*c >= 'a' && *c < 'a' + CLIENT_MAX_CHANNELS) {
+                        request.channel_mask |= 1u << (*c - 'a');
+                    } else {
+                        usage(argv[0]);
+                        return 2;
+                    }
+                }
+                break;
+            case 't':
+                run_secs = strtod(optarg, NULL);
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = connect_endpoint(argv[optind]);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (write(fd, &request, sizeof(request)) != sizeof(request)) {
+        fprintf(stderr, "%s: sending the request failed\n", argv[optind]);
+        close(fd);
+        return 1;
+    }
+
+    double start = now_secs();
+    double interval_start = start;
+    int status = 0;
+    while (run_secs <= 0 || now_secs() - start < run_secs) {
+        if (read_all(fd, &header, sizeof(header)) != 0) {
+            break;
+        }
+        if (header.magic != STREAM_FRAME_MAGIC || header.version != STREAM_VERSION ||
+            header.header_bytes != sizeof(header) || header.channel >= CLIENT_MAX_CHANNELS) {
+            fprintf(stderr, "%s: invalid frame header after %" PRIu64 " frames\n", argv[optind], frames);
+            status = 1;
+            break;
+        }
+        size_t payload = header.samples * sizeof(int16_t);
+        if (payload > capacity) {
+            free(samples);
+            samples = malloc(payload);
+            capacity = samples ? payload : 0;
+            if (!samples) {
+                fprintf(stderr, "Cannot allocate %" PRIu32 " samples\n", header.samples);
+                status = 1;
+                break;
+            }
+        }
+        if (read_all(fd, samples, payload) != 0) {
+            break;
+        }
+
+        // Frame numbers count per channel, a jump is frames the server dropped for this client
+        if (seen[header.channel] && header.frame > next_frame[header.channel]) {
+            interval_lost += header.frame - next_frame[header.channel];
+        }
+        seen[header.channel] = 1;
+        next_frame[header.channel] = header.frame + 1;
+        interval_frames++;
+        interval_bytes += sizeof(header) + payload;
+
+        double now = now_secs();
+        if (now - interval_start >= 1.0) {
+            if (!quiet) {
+                printf("%.1f s: %.1f frames/s, %.1f MB/s, %" PRIu64 " frames lost\n", now - start,
+                       interval_frames / (now - interval_start), interval_bytes / (now - interval_start) / 1e6,
+                       interval_lost);
+                fflush(stdout);
+            }
+            frames += interval_frames;
+            bytes += interval_bytes;
+            lost += interval_lost;
+            interval_frames = interval_bytes = interval_lost = 0;
+            interval_start = now;
+        }
+    }
+    frames += interval_frames;
+    bytes += interval_bytes;
+    lost += interval_lost;
+
+    double elapsed = now_secs() - start;
+    printf("%" PRIu64 " frames, %.1f MB in %.2f s, %.1f frames/s, %.1f MB/s, %" PRIu64 " frames lost\n",
+           frames, bytes / 1e6, elapsed, elapsed > 0 ? frames / elapsed : 0, elapsed > 0 ? bytes / elapsed / 1e6 : 0,
+           lost);
+    free(samples);
+    close(fd);
+    return status;
+}
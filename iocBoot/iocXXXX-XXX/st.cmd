@@ -28,9 +28,21 @@ dbLoadRecords("PicoscopeApp/Db/Picoscope.template", "OSC=OSCXXXX-XX, SERIAL_NUM=
 ##-----------------------------------------------------------------------------
 ## Initialize the Picoscope device
 ## Replace with actual serial number (must match what is used above)
+##
+## Optional: directory the timebase tables are saved to, so they are not read 
+## from the device again after a restart. Must be set before PS6000ASetup.
+## Optional: directory streaming acquisitions are recorded to.
+## Optional: data socket publishing raw captures to local clients, a Unix 
+## domain socket path or a TCP port. Must be run after PS6000ASetup.
+## Optional: shared memory frame ring for analysis processes on this host, 
+## name, slots and samples per slot. Must be run after PS6000ASetup.
 ##-----------------------------------------------------------------------------
 
+#PS6000ATimebaseCacheDir("${TOP}/iocBoot/${IOC}")
+#PS6000ARecorderDir("/data/picoscope")
 PS6000ASetup("XXXX/XXXX")
+#PS6000ADataServer("XXXX/XXXX", "/tmp/picoscope-XXXX.sock")
+#PS6000AShmRing("XXXX/XXXX", "/ps6000a-XXXX", 32, 1000000)
 
 cd "${TOP}/iocBoot/${IOC}"
 iocInit